@@ -4,11 +4,13 @@ logging.basicConfig(level=logging.DEBUG)
 from flask import Flask, request, jsonify, send_from_directory
 from flask_cors import CORS
 from vrp_solver import VRPSolver
+from routing_engine import create_routing_engine
 import random
 import os
 import math
 import json
 import csv
+import threading
 import requests
 
 # Get the absolute path to the frontend directory
@@ -41,7 +43,7 @@ def solve_vrp():
         passengers = data.get('passengers', [])
         
         # Create and setup solver
-        solver = VRPSolver()
+        solver = VRPSolver(get_routing_engine())
         solver.add_driver_location(driver_location)
         
         # Add all passengers
@@ -59,6 +61,45 @@ def solve_vrp():
         print(f"Error in solve_vrp: {str(e)}")
         return jsonify({"error": f"Server error: {str(e)}"}), 500
 
+# One routing engine shared by all requests, created on first use: the
+# in-process vrp_engine module when it is built, else a server-mode process
+routing_engine = None
+routing_engine_lock = threading.Lock()
+
+def get_routing_engine():
+    global routing_engine
+    with routing_engine_lock:
+        if routing_engine is None or not routing_engine.is_running():
+            routing_engine = create_routing_engine()
+        return routing_engine
+
+@app.route('/api/shortest-path', methods=['GET'])
+def shortest_path():
+    """Shortest path between two graph nodes via the routing engine."""
+    try:
+        src = int(request.args.get('src'))
+        dest = int(request.args.get('dest'))
+        path = get_routing_engine().shortest_path(src, dest)
+        return jsonify({"path": [int(node) for node in path]})
+    except (TypeError, ValueError) as e:
+        return jsonify({"error": f"Invalid request: {str(e)}"}), 400
+    except Exception as e:
+        print(f"Error in shortest_path: {str(e)}")
+        return jsonify({"error": f"Server error: {str(e)}"}), 500
+
+@app.route('/api/tsp', methods=['POST'])
+def plan_multi_user_route():
+    """Multi-user route over graph user nodes via the routing engine."""
+    try:
+        user_ids = request.json.get('users', [])
+        result = get_routing_engine().plan_route(user_ids)
+        return jsonify({"path": [int(node) for node in result['path']], "details": result['details']})
+    except (TypeError, ValueError) as e:
+        return jsonify({"error": f"Invalid request: {str(e)}"}), 400
+    except Exception as e:
+        print(f"Error in plan_multi_user_route: {str(e)}")
+        return jsonify({"error": f"Server error: {str(e)}"}), 500
+
 def load_users_from_csv():
     """Load users from the CSV file with their addresses."""
     users = []
@@ -0,0 +1,321 @@
+import importlib
+import itertools
+import json
+import mmap
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+from concurrent.futures import Future
+
+# Default location of the compiled C++ engine (frontend/files/dijkstra.cpp)
+engine_dir = os.path.join(os.path.dirname(os.path.dirname(os.path.abspath(__file__))), 'frontend', 'files')
+
+# Cell value of unreachable pairs in a distance matrix, by bytes per cell
+UNREACHABLE = {2: 0xFFFF, 4: 0xFFFFFFFF}
+
+_MATRIX_MAGIC = b'VRPDM001'
+_MATRIX_HEADER_BYTES = 64
+
+
+def load_matrix(path):
+    """Map a distance matrix file written by the engine.
+
+    Returns a read-only memoryview of shape (rows, columns) over the mapped
+    file, without copying; numpy.asarray() of it is zero-copy as well.
+    Unreachable pairs hold UNREACHABLE[view.itemsize].
+    """
+    with open(path, 'rb') as f:
+        data = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    magic, rows, columns, cell_bytes = struct.unpack_from('=8sIII', data)
+    if magic != _MATRIX_MAGIC or cell_bytes not in UNREACHABLE:
+        raise ValueError('not a distance matrix file: %s' % path)
+    cells = memoryview(data)[_MATRIX_HEADER_BYTES:_MATRIX_HEADER_BYTES + rows * columns * cell_bytes]
+    fmt = 'H' if cell_bytes == 2 else 'I'
+    return cells.cast(fmt, (rows, columns)) if rows and columns else cells.cast(fmt)
+
+
+def _import_native_module():
+    """The vrp_engine extension module, or None if it has not been built.
+
+    It is looked up on sys.path first, then next to the engine sources.
+    """
+    try:
+        return importlib.import_module('vrp_engine')
+    except ImportError:
+        pass
+    sys.path.insert(0, engine_dir)
+    try:
+        return importlib.import_module('vrp_engine')
+    except ImportError:
+        return None
+    finally:
+        sys.path.remove(engine_dir)
+
+
+def create_routing_engine():
+    """NativeEngine when the extension module is available, else RoutingEngine.
+
+    NativeEngine has only the path, matrix, snap and tour methods; callers
+    that need dispatch, update_weights, metrics or travel_time_profiles
+    should construct RoutingEngine themselves. Setting ROUTING_ENGINE to an
+    executable always selects the process.
+    ROUTING_GRAPH names a binary graph file (see the engine's convert mode)
+    to route on instead of the demo network; one converted from an OSM
+    extract carries the node locations that snap() needs.
+    """
+    graph_file = os.environ.get('ROUTING_GRAPH')
+    module = _import_native_module()
+    if module is not None and not os.environ.get('ROUTING_ENGINE'):
+        return NativeEngine(module, graph_file=graph_file)
+    # The engine process runs in its own directory
+    return RoutingEngine(extra_args=['--graph', os.path.abspath(graph_file)] if graph_file else None)
+
+
+class NativeEngine:
+    """The routing engine loaded in-process through the vrp_engine module.
+
+    Offers RoutingEngine's path, matrix, snap and tour methods without a
+    child process or any JSON: paths, tours and matrices come back as numpy
+    arrays that share the engine's buffers, and the engine releases the GIL
+    while it searches, so requests from several threads run in parallel.
+    dispatch, update_weights, metrics and travel_time_profiles are only
+    served by the engine process.
+    """
+
+    def __init__(self, module=None, graph_file=None, threads=0):
+        module = module or _import_native_module()
+        if module is None:
+            raise ImportError('vrp_engine is not built (see VRP_PYTHON_MODULE in dijkstra.cpp)')
+        if graph_file is None:
+            self.graph = module.Graph.demo()
+        else:
+            self.graph = module.Graph()
+            if not self.graph.load_binary(graph_file):
+                raise ValueError('cannot load graph file: %s' % graph_file)
+        self.graph.set_threads(threads)
+
+    def is_running(self):
+        return True
+
+    def shortest_path(self, src, dest, departure=None):
+        return self.graph.shortest_path(int(src), int(dest), departure)
+
+    def shortest_paths(self, pairs):
+        return self.graph.shortest_paths([(int(src), int(dest)) for src, dest in pairs])
+
+    def distance_matrix(self, nodes, compact=False):
+        """uint32 (n, n) array; unreachable pairs hold UNREACHABLE[4].
+
+        The array views the engine's matrix, so passing it back to a solver
+        costs no copy; compact is accepted for RoutingEngine compatibility.
+        """
+        return self.graph.distance_matrix([int(n) for n in nodes])
+
+    def snap(self, points):
+        """(nodes, distances) arrays for [lon, lat] points; see RoutingEngine.snap."""
+        snapped = self.graph.snap([(float(lon), float(lat)) for lon, lat in points])
+        return snapped['node'], snapped['distance'] + snapped['offset']
+
+    def plan_route(self, user_ids):
+        return self.graph.plan_route([int(u) for u in user_ids])
+
+    def pickup_delivery(self, matrix, demands=None, capacity=None, return_to_start=False):
+        return self.graph.pickup_delivery(matrix, demands, capacity, bool(return_to_start))
+
+    def close(self):
+        pass
+
+
+class RoutingEngine:
+    """Single long-lived connection to the routing engine in server mode.
+
+    The engine loads the graph once and answers line-delimited JSON requests,
+    so queries no longer pay for process startup and graph construction.
+    Requests may be issued from several threads at once; responses are matched
+    back to their callers by request id.
+    """
+
+    def __init__(self, executable=None, extra_args=None):
+        if executable is None:
+            executable = os.environ.get('ROUTING_ENGINE') or os.path.join(
+                engine_dir, 'dijkstra.exe' if os.name == 'nt' else 'dijkstra')
+        self.process = subprocess.Popen(
+            [executable, 'serve'] + list(extra_args or []),
+            cwd=os.path.dirname(executable) or None,
+            stdin=subprocess.PIPE,
+            stdout=subprocess.PIPE,
+            text=True,
+            bufsize=1,
+        )
+        self._ids = itertools.count(1)
+        self._pending = {}
+        self._lock = threading.Lock()
+        self._reader = threading.Thread(target=self._read_responses, daemon=True)
+        self._reader.start()
+
+    def request(self, payload, timeout=30):
+        """Send one request dict and wait for its response dict."""
+        future = Future()
+        with self._lock:
+            request_id = next(self._ids)
+            self._pending[request_id] = future
+            try:
+                self.process.stdin.write(json.dumps(dict(payload, id=request_id)) + '\n')
+                self.process.stdin.flush()
+            except OSError:
+                del self._pending[request_id]
+                raise
+        try:
+            response = future.result(timeout=timeout)
+        except BaseException:
+            # Forget the request so a late response is dropped, not kept forever
+            with self._lock:
+                self._pending.pop(request_id, None)
+            raise
+        if 'error' in response:
+            raise ValueError(response['error'])
+        return response
+
+    def shortest_path(self, src, dest, departure=None):
+        """Node sequence of the shortest path from src to dest (empty if none).
+
+        With a departure time the engine returns the fastest path under its
+        travel-time profiles (started with --profiles) for leaving then.
+        """
+        payload = {'type': 'path', 'src': int(src), 'dest': int(dest)}
+        if departure is not None:
+            payload['departure'] = int(departure)
+        return self.request(payload)['path']
+
+    def shortest_paths(self, pairs):
+        """Distances and paths for many (src, dest) pairs in one request.
+
+        Pairs sharing a source are answered by one search. Returns a list of
+        (distance, path) in the order of pairs; distance is -1 and path empty
+        where there is no path.
+        """
+        queries = [[int(src), int(dest)] for src, dest in pairs]
+        results = self.request({'type': 'batch', 'queries': queries})['results']
+        return [(result['distance'], result['path']) for result in results]
+
+    def travel_time_profiles(self, src, targets):
+        """Travel time from src to each target by departure time.
+
+        Each entry is a list of (time, travel_time) points, linear in between
+        and wrapping around the day; empty if the target is unreachable.
+        """
+        response = self.request({'type': 'profile', 'src': int(src), 'targets': [int(t) for t in targets]})
+        return [[tuple(point) for point in profile] for profile in response['profiles']]
+
+    def distance_matrix(self, nodes, compact=False):
+        """Distances between every pair of nodes, as a (n, n) memoryview.
+
+        The engine writes the matrix to a temporary file that is mapped
+        rather than parsed, so large matrices cost no JSON. compact asks for
+        16-bit cells, which the engine uses when every distance fits.
+        """
+        fd, path = tempfile.mkstemp(suffix='.vdm')
+        os.close(fd)
+        try:
+            self.request({'type': 'matrix', 'nodes': [int(n) for n in nodes], 'file': path,
+                          'compact': bool(compact)})
+            return load_matrix(path)
+        finally:
+            try:
+                os.remove(path)  # The mapping stays valid on POSIX
+            except OSError:
+                pass
+
+    def snap(self, points):
+        """Snap [lon, lat] points onto the nearest edges of the road graph.
+
+        Returns (nodes, distances): per point the end of its edge nearer to
+        the snapped position, and the cost of getting there, i.e. the metres
+        from the point to the edge plus the edge weight up to the node (also
+        metres for graphs imported from OSM). node is -1 where the graph has
+        no located edge. Raises ValueError if it has no node locations.
+        """
+        payload = {'type': 'snap', 'points': [[float(lon), float(lat)] for lon, lat in points]}
+        snapped = self.request(payload)['snapped']
+        nodes = [point['node'] if point else -1 for point in snapped]
+        distances = [point['distance'] + point['offset'] if point else 0.0 for point in snapped]
+        return nodes, distances
+
+    def plan_route(self, user_ids):
+        """Multi-user route over the given user nodes, as returned by 'tsp'."""
+        return self.request({'type': 'tsp', 'users': [int(u) for u in user_ids]})
+
+    def dispatch(self, vehicle, stops=None, add=None, remove=None, position=None, path=False):
+        """Keep a vehicle's route up to date as riders join and cancel.
+
+        stops plans the vehicle from scratch, its current node first (an
+        empty list forgets it). Afterwards position, remove and add change
+        the kept route with one search per new node instead of a new plan.
+        Returns the response dict with the visiting order in 'stops' and the
+        route 'length', plus the node-by-node 'path' if asked for.
+        """
+        payload = {'type': 'dispatch', 'vehicle': int(vehicle)}
+        if stops is not None:
+            payload['stops'] = [int(s) for s in stops]
+        for key, node in (('position', position), ('remove', remove), ('add', add)):
+            if node is not None:
+                payload[key] = int(node)
+        if path:
+            payload['path'] = True
+        return self.request(payload)
+
+    def pickup_delivery(self, matrix, demands=None, capacity=None, return_to_start=False):
+        """Pickup-and-delivery route over an explicit distance matrix.
+
+        Row 0 is the vehicle start, rows 2k+1 and 2k+2 the pickup and delivery
+        of request k. Returns the response dict with 'order', 'distance' and
+        'unassigned'.
+        """
+        payload = {'type': 'pdp', 'matrix': [[int(d) for d in row] for row in matrix],
+                   'return': bool(return_to_start)}
+        if demands is not None:
+            payload['demands'] = [int(d) for d in demands]
+        if capacity is not None:
+            payload['capacity'] = int(capacity)
+        return self.request(payload)
+
+    def update_weights(self, edges):
+        """Set new weights for existing edges, given as (u, v, weight) triples.
+
+        The engine applies the whole batch at once; requests already running
+        finish on the old weights. Returns the new graph version.
+        """
+        payload = {'type': 'update', 'edges': [[int(u), int(v), int(w)] for u, v, w in edges]}
+        return self.request(payload)['version']
+
+    def metrics(self):
+        """Engine counters in the Prometheus text format."""
+        return self.request({'type': 'metrics'})['metrics']
+
+    def is_running(self):
+        return self.process.poll() is None
+
+    def close(self):
+        if self.process.poll() is None:
+            self.process.stdin.close()
+            self.process.wait()
+
+    def _read_responses(self):
+        for line in self.process.stdout:
+            try:
+                response = json.loads(line)
+            except ValueError:
+                continue
+            with self._lock:
+                future = self._pending.pop(response.get('id'), None)
+            if future is not None:
+                future.set_result(response)
+
+        # Engine exited: fail everything still waiting
+        with self._lock:
+            pending, self._pending = self._pending, {}
+        for future in pending.values():
+            future.set_exception(RuntimeError('routing engine exited'))
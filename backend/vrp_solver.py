@@ -1,9 +1,11 @@
-from ortools.constraint_solver import routing_enums_pb2
-from ortools.constraint_solver import pywrapcp
 import numpy as np
 
+from routing_engine import UNREACHABLE
+
 class VRPSolver:
-    def __init__(self):
+    def __init__(self, engine):
+        """engine: RoutingEngine that runs the pickup-and-delivery search."""
+        self.engine = engine
         self.locations = []
         self.distance_matrix = None
         self.pickups_deliveries = []
@@ -24,14 +26,23 @@ class VRPSolver:
         self.pickups_deliveries.append((pickup_index, dropoff_index))
     
     def _calculate_distance(self, point1, point2):
-        """Calculate distance between two points."""
+        """Straight-line distance between two points, for graphs without node locations."""
         lon1, lat1 = point1
         lon2, lat2 = point2
         # Simple scaling for testing purposes
         return ((lon2 - lon1)**2 + (lat2 - lat1)**2)**0.5 * 111000  # Rough conversion to meters
     
     def _compute_distance_matrix(self):
-        """Compute distance matrix between all locations."""
+        """Compute distance matrix between all locations.
+
+        Uses road distances when the engine's graph has node locations,
+        straight-line distances otherwise.
+        """
+        try:
+            return self._road_distance_matrix()
+        except ValueError:
+            pass
+
         num_locations = len(self.locations)
         self.distance_matrix = np.zeros((num_locations, num_locations))
         
@@ -40,7 +51,31 @@ class VRPSolver:
                 if i != j:
                     self.distance_matrix[i][j] = self._calculate_distance(self.locations[i], self.locations[j])
         
-        return self.distance_matrix.astype(int).tolist()
+        # Stays a numpy array: the native engine reads it without a JSON detour
+        return self.distance_matrix.astype(np.int64)
+
+    def _road_distance_matrix(self):
+        """Shortest road distances between the locations, in metres.
+
+        Every location is snapped onto the nearest road; an entry is the way
+        onto the road at one end, the shortest path between the snapped
+        nodes, and the way off the road at the other. Pairs without a path
+        are -1. Raises ValueError when the graph cannot snap the locations.
+        """
+        nodes, access = self.engine.snap(self.locations)
+        nodes = np.asarray(nodes, dtype=np.int64)
+        access = np.asarray(access, dtype=np.float64)
+        if (nodes < 0).any():
+            raise ValueError('no road near some location')
+
+        # One matrix row per distinct node; locations on the same node share it
+        distinct, rows = np.unique(nodes, return_inverse=True)
+        roads = np.asarray(self.engine.distance_matrix(distinct.tolist()), dtype=np.int64)[np.ix_(rows, rows)]
+        matrix = np.rint(roads + access[:, None] + access[None, :]).astype(np.int64)
+        matrix[roads == UNREACHABLE[4]] = -1
+        np.fill_diagonal(matrix, 0)
+        self.distance_matrix = matrix
+        return matrix
     
     def solve(self):
         """Solve the VRP problem."""
@@ -50,80 +85,21 @@ class VRPSolver:
             
         distance_matrix = self._compute_distance_matrix()
         
-        # Create the routing model
-        manager = pywrapcp.RoutingIndexManager(len(distance_matrix), 1, 0)
-        routing = pywrapcp.RoutingModel(manager)
-        
-        # Define distance callback
-        def distance_callback(from_index, to_index):
-            from_node = manager.IndexToNode(from_index)
-            to_node = manager.IndexToNode(to_index)
-            return distance_matrix[from_node][to_node]
-        
-        transit_callback_index = routing.RegisterTransitCallback(distance_callback)
-        routing.SetArcCostEvaluatorOfAllVehicles(transit_callback_index)
+        # Pickup-and-delivery search in the routing engine; the matrix rows
+        # already follow its layout (driver, then pickup/dropoff per passenger)
+        solution = self.engine.pickup_delivery(distance_matrix, return_to_start=True)
         
-        # Add a dimension for distance/time
-        routing.AddDimension(
-            transit_callback_index,
-            0,     # no slack
-            10000,  # large enough for any route
-            True,   # start cumul to zero
-            "Distance"
-        )
-        
-        distance_dimension = routing.GetDimensionOrDie("Distance")
-        
-        # Add pickup and delivery constraints
-        for pickup, delivery in self.pickups_deliveries:
-            routing.AddPickupAndDelivery(pickup, delivery)
-            routing.solver().Add(
-                routing.VehicleVar(manager.NodeToIndex(pickup)) == 
-                routing.VehicleVar(manager.NodeToIndex(delivery))
-            )
-            # Pickup must happen before delivery - FIXED THIS PART
-            pickup_index = manager.NodeToIndex(pickup)
-            delivery_index = manager.NodeToIndex(delivery)
-            routing.solver().Add(
-                distance_dimension.CumulVar(pickup_index) <= 
-                distance_dimension.CumulVar(delivery_index)
-            )
-        
-        # Set first solution heuristic
-        search_parameters = pywrapcp.DefaultRoutingSearchParameters()
-        search_parameters.first_solution_strategy = (
-            routing_enums_pb2.FirstSolutionStrategy.PATH_CHEAPEST_ARC
-        )
-        search_parameters.local_search_metaheuristic = (
-            routing_enums_pb2.LocalSearchMetaheuristic.GUIDED_LOCAL_SEARCH
-        )
-        search_parameters.time_limit.FromSeconds(5)  # 5 second time limit
-        
-        # Solve the problem
-        solution = routing.SolveWithParameters(search_parameters)
-        
-        if not solution:
+        if len(solution['unassigned']) > 0:
             return None
             
-        # Extract the route
+        # Extract the route (it ends with the return to the driver location)
         route = []
-        index = routing.Start(0)
-        while not routing.IsEnd(index):
-            node_index = manager.IndexToNode(index)
+        for node_index in solution['order']:
             route.append({
-                "index": node_index,
+                "index": int(node_index),
                 "location": self.locations[node_index],
                 "type": self._get_location_type(node_index)
             })
-            index = solution.Value(routing.NextVar(index))
-            
-        # Add the final return to depot
-        node_index = manager.IndexToNode(index)
-        route.append({
-            "index": node_index, 
-            "location": self.locations[node_index],
-            "type": "driver"
-        })
         
         return {
             "route": route,
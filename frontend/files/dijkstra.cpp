@@ -6,6 +6,66 @@
 #include <algorithm>
 #include <fstream>
 #include <string>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <utility>
+#include <exception>
+#include <sstream>
+#include <deque>
+#include <list>
+#include <map>
+#include <cmath>
+#include <numeric>
+#include <tuple>
+
+#include <cstdint>
+#include <cstdio>
+#include <charconv>
+#include <chrono>
+#include <random>
+
+#ifdef VRP_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+// Vector kernels: AVX2/AVX-512 picked at run time on x86 with GCC or Clang,
+// NEON on AArch64, plain loops elsewhere or with -DVRP_NO_SIMD
+#if !defined(VRP_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VRP_SIMD_X86
+#include <immintrin.h>
+#elif !defined(VRP_NO_SIMD) && defined(__aarch64__)
+#define VRP_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Built as the vrp_engine Python extension instead of the command-line tool
+#ifdef VRP_PYTHON_MODULE
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+#endif
 
 using namespace std;
 
@@ -15,253 +75,8127 @@ struct UserInfo {
     string destination;
 };
 
-class Graph {
+// Read-only view of a contiguous array owned elsewhere (a vector or a
+// memory-mapped file)
+template <typename T>
+struct ArrayView {
+    const T* ptr = nullptr;
+    size_t count = 0;
+
+    ArrayView() {}
+    ArrayView(const vector<T>& values) : ptr(values.data()), count(values.size()) {}
+    ArrayView(const pmr::vector<T>& values) : ptr(values.data()), count(values.size()) {}
+    ArrayView(const T* data, size_t size) : ptr(data), count(size) {}
+
+    const T& operator[](size_t i) const { return ptr[i]; }
+    size_t size() const { return count; }
+    const T* begin() const { return ptr; }
+    const T* end() const { return ptr + count; }
+};
+
+// Read-only memory mapping of a whole file. Pages are shared between every
+// process that maps the same file.
+class MappedFile {
 public:
-    unordered_map<int, vector<pair<int, int>>> adjList;
-    unordered_map<int, UserInfo> users;
+    ~MappedFile() {
+#ifdef _WIN32
+        if (base != nullptr) UnmapViewOfFile(base);
+        if (mapping != nullptr) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (base != nullptr) munmap(base, length);
+#endif
+    }
 
-    void addEdge(int u, int v, int weight) {
-        adjList[u].push_back({v, weight});
-        adjList[v].push_back({u, weight}); // Assuming undirected graph
+    bool open(const string& filename) {
+#ifdef _WIN32
+        file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, nullptr);
+        LARGE_INTEGER size;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size) || size.QuadPart == 0) return false;
+        length = size.QuadPart;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping == nullptr) return false;
+        base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        length = info.st_size;
+        void* mapped = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        base = mapped == MAP_FAILED ? nullptr : mapped;
+#endif
+        return base != nullptr;
     }
 
-    void addUser(int nodeId, const string& name, const string& pickup, const string& destination) {
-        users[nodeId] = {name, pickup, destination};
+    const char* data() const { return (const char*)base; }
+    size_t size() const { return length; }
+
+private:
+    void* base = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
+
+// Frozen adjacency in compressed sparse row form. External node ids are
+// remapped to dense indices 0..n-1 (ascending id order, unless the graph has
+// been reordered for locality), so a search only touches flat arrays instead
+// of hashing a node id on every relaxation. The arrays live either in
+// vectors built by Graph::freeze() or directly in a mapped graph file;
+// storage keeps whichever it is alive.
+struct CSRGraph {
+    ArrayView<int> offsets;  // arcs of node i are [offsets[i], offsets[i + 1])
+    ArrayView<int> targets;  // dense index of each arc's head
+    ArrayView<int> weights;
+    ArrayView<int> nodeIds;  // dense index -> external node id, ascending unless byId is set
+    ArrayView<int> byId;     // Dense indices in ascending id order; empty = the identity
+    shared_ptr<const void> storage;
+
+    int numNodes() const { return nodeIds.size(); }
+
+    // Dense index of an external node id, or -1 if the node is unknown
+    int index(int nodeId) const {
+        if (byId.size() != 0) {
+            const int* it = lower_bound(byId.begin(), byId.end(), nodeId,
+                                        [this](int node, int id) { return nodeIds[node] < id; });
+            return it != byId.end() && nodeIds[*it] == nodeId ? *it : -1;
+        }
+        const int* it = lower_bound(nodeIds.begin(), nodeIds.end(), nodeId);
+        return it != nodeIds.end() && *it == nodeId ? it - nodeIds.begin() : -1;
     }
 
-    vector<int> dijkstra(int src, int dest) {
-        // Same implementation as before
-        unordered_map<int, int> dist;
-        unordered_map<int, int> parent;
-        for (auto node : adjList) {
-            dist[node.first] = INT_MAX;
+    // Dense index of the node with the k-th smallest id
+    int byRank(int k) const { return byId.size() != 0 ? byId[k] : k; }
+};
+
+// Binary graph file, little-endian. Every section is 64-byte aligned so the
+// arrays can be used in place from a read-only mapping:
+//
+//   GraphFileHeader, GraphFileSection[numSections], section payloads
+//
+// Readers skip section kinds they do not know, so sections can be added
+// without a version bump; the version changes only when the layout of an
+// existing section does.
+struct GraphFileHeader {
+    char magic[8];  // "VRPGRAPH"
+    uint32_t version;
+    uint32_t numSections;
+    uint64_t numNodes;
+    uint64_t numArcs;
+};
+
+struct GraphFileSection {
+    uint32_t kind;
+    uint32_t reserved;
+    uint64_t offset;  // from the start of the file
+    uint64_t bytes;
+};
+
+enum GraphSectionKind : uint32_t {
+    kSectionOffsets = 1,  // int32[numNodes + 1]
+    kSectionTargets = 2,  // int32[numArcs]
+    kSectionWeights = 3,  // int32[numArcs]
+    kSectionNodeIds = 4,  // int32[numNodes], ascending unless there is a kSectionNodeOrder
+    kSectionUsers = 5,    // GraphFileUser[]
+    kSectionStrings = 6,  // UTF-8 text referenced by GraphFileUser
+    kSectionLandmarks = 7,          // int32[k], dense landmark indices (optional)
+    kSectionLandmarkDistances = 8,  // int32[k * numNodes], landmark-major
+    kSectionNodeOrder = 9,  // int32[numNodes], dense indices in ascending id order (reordered graphs)
+    kSectionLocations = 10,  // int32[2 * numNodes], (latitude, longitude) in 1e-7 degrees (optional)
+    kSectionCellMap = 11,    // int32[2 * k], (node id, cell) of every node of a partitioned graph, ids ascending
+                             // (shard overlay files only)
+};
+
+// One user table row; strings are (offset, length) slices of kSectionStrings
+struct GraphFileUser {
+    int32_t nodeId;
+    uint32_t name[2];
+    uint32_t pickup[2];
+    uint32_t destination[2];
+};
+
+// Version 2 files may hold reordered nodes (kSectionNodeOrder), which a
+// version 1 reader would take for ascending ids; graphs in id order are
+// still written as version 1
+const uint32_t kGraphFileVersion = 2;
+
+// A mapped graph file whose header has been checked
+struct GraphFileReader {
+    shared_ptr<MappedFile> file;
+    GraphFileHeader header;
+
+    bool open(const string& filename) {
+        file = make_shared<MappedFile>();
+        if (!file->open(filename) || file->size() < sizeof(GraphFileHeader)) return false;
+        memcpy(&header, file->data(), sizeof(header));
+        return memcmp(header.magic, "VRPGRAPH", 8) == 0 && header.version >= 1 && header.version <= kGraphFileVersion &&
+               header.numNodes < INT_MAX && header.numArcs < INT_MAX &&
+               sizeof(header) + (uint64_t)header.numSections * sizeof(GraphFileSection) <= file->size();
+    }
+
+    // Payload of the first section of a kind; false if there is none or it
+    // is out of bounds, misaligned or not expectedBytes long (UINT64_MAX =
+    // any length)
+    bool section(uint32_t kind, uint64_t expectedBytes, const char*& where, uint64_t& bytes) const {
+        const GraphFileSection* table = (const GraphFileSection*)(file->data() + sizeof(header));
+        for (uint32_t s = 0; s < header.numSections; s++) {
+            if (table[s].kind != kind) continue;
+            if (table[s].offset > file->size() || table[s].bytes > file->size() - table[s].offset ||
+                table[s].offset % 64 != 0 || (expectedBytes != UINT64_MAX && table[s].bytes != expectedBytes)) {
+                return false;
+            }
+            where = file->data() + table[s].offset;
+            bytes = table[s].bytes;
+            return true;
         }
-        dist[src] = 0;
+        return false;
+    }
+};
 
-        priority_queue<pair<int, int>, vector<pair<int, int>>, greater<pair<int, int>>> pq;
-        pq.push({0, src});
+// Priority queues for Dijkstra. All share one interface so the search can take
+// the queue type as a template parameter:
+//   reset(n)          prepare for node ids in [0, n) and empty the queue
+//   push(node, key)   insert node, or lower its key if it is already queued
+//   pop(node, key)    remove a minimum entry
+// Lazy queues may hand back an entry whose key is larger than the node's
+// current distance; the search skips those.
 
-        while (!pq.empty()) {
-            int node = pq.top().second;
-            int nodeDist = pq.top().first;
-            pq.pop();
+// Binary heap with lazy insertion (duplicates instead of decrease-key). Pops
+// in the same order as priority_queue<pair<int, int>, ..., greater<>>.
+class BinaryHeapQueue {
+public:
+    void reset(int) { heap.clear(); }
+    bool empty() const { return heap.empty(); }
 
-            for (auto neighbor : adjList[node]) {
-                int nextNode = neighbor.first;
-                int edgeWeight = neighbor.second;
+    void push(int node, int key) {
+        heap.push_back({key, node});
+        push_heap(heap.begin(), heap.end(), greater<pair<int, int>>());
+    }
 
-                if (nodeDist + edgeWeight < dist[nextNode]) {
-                    dist[nextNode] = nodeDist + edgeWeight;
-                    pq.push({dist[nextNode], nextNode});
-                    parent[nextNode] = node;
-                }
+    void pop(int& node, int& key) {
+        pop_heap(heap.begin(), heap.end(), greater<pair<int, int>>());
+        key = heap.back().first;
+        node = heap.back().second;
+        heap.pop_back();
+    }
+
+private:
+    vector<pair<int, int>> heap;  // (key, node)
+};
+
+// Indexed D-ary heap with decrease-key: every node is queued at most once, so
+// there are no stale entries and the heap stays as small as the frontier.
+template<int D>
+class DaryHeapQueue {
+public:
+    void reset(int numNodes) {
+        for (const pair<int, int>& entry : heap) {
+            position[entry.second] = -1;
+        }
+        heap.clear();
+        position.resize(numNodes, -1);
+    }
+
+    bool empty() const { return heap.empty(); }
+
+    void push(int node, int key) {
+        int i = position[node];
+        if (i < 0) {
+            i = heap.size();
+            heap.push_back({key, node});
+        } else if (key < heap[i].first) {
+            heap[i].first = key;
+        } else {
+            return;
+        }
+        siftUp(i);
+    }
+
+    void pop(int& node, int& key) {
+        key = heap[0].first;
+        node = heap[0].second;
+        position[node] = -1;
+        pair<int, int> last = heap.back();
+        heap.pop_back();
+        if (!heap.empty()) {
+            heap[0] = last;
+            position[last.second] = 0;
+            siftDown(0);
+        }
+    }
+
+private:
+    void siftUp(int i) {
+        pair<int, int> entry = heap[i];
+        while (i > 0) {
+            int up = (i - 1) / D;
+            if (heap[up] <= entry) break;
+            heap[i] = heap[up];
+            position[heap[i].second] = i;
+            i = up;
+        }
+        heap[i] = entry;
+        position[entry.second] = i;
+    }
+
+    void siftDown(int i) {
+        pair<int, int> entry = heap[i];
+        int size = heap.size();
+        while (true) {
+            int first = i * D + 1;
+            if (first >= size) break;
+            int best = first;
+            for (int c = first + 1; c < first + D && c < size; c++) {
+                if (heap[c] < heap[best]) best = c;
             }
+            if (entry <= heap[best]) break;
+            heap[i] = heap[best];
+            position[heap[i].second] = i;
+            i = best;
         }
+        heap[i] = entry;
+        position[entry.second] = i;
+    }
 
-        vector<int> path;
-        int current = dest;
-        
-        // Handle case where there is no path
-        if (dist[dest] == INT_MAX) {
-            return path; // Empty path
+    vector<pair<int, int>> heap;  // (key, node)
+    vector<int> position;         // index in heap, -1 if not queued
+};
+
+// Radix heap for non-negative integer keys that never drop below the last
+// popped key (true for Dijkstra). Entries live in buckets by the highest bit in
+// which they differ from the last minimum and only move towards bucket 0, so
+// each entry is redistributed at most 32 times. Lazy, like BinaryHeapQueue.
+class RadixHeapQueue {
+public:
+    void reset(int) {
+        for (vector<pair<int, int>>& bucket : buckets) {
+            bucket.clear();
         }
-        
-        while (current != src) {
-            path.push_back(current);
-            current = parent[current];
+        last = 0;
+        count = 0;
+    }
+
+    bool empty() const { return count == 0; }
+
+    void push(int node, int key) {
+        buckets[bucketOf(key)].push_back({key, node});
+        count++;
+    }
+
+    void pop(int& node, int& key) {
+        if (buckets[0].empty()) {
+            int b = 1;
+            while (buckets[b].empty()) b++;
+            // The new minimum comes from bucket b; every entry there now
+            // differs from it in a lower bit than before.
+            last = buckets[b][0].first;
+            for (const pair<int, int>& entry : buckets[b]) {
+                last = min(last, entry.first);
+            }
+            for (const pair<int, int>& entry : buckets[b]) {
+                buckets[bucketOf(entry.first)].push_back(entry);
+            }
+            buckets[b].clear();
         }
-        path.push_back(src);
-        reverse(path.begin(), path.end());
-        return path;
+        key = buckets[0].back().first;
+        node = buckets[0].back().second;
+        buckets[0].pop_back();
+        count--;
     }
 
-    // Calculate distance matrix between multiple nodes
-    vector<vector<int>> calculateDistanceMatrix(const vector<int>& nodes) {
-        int n = nodes.size();
-        vector<vector<int>> distances(n, vector<int>(n, INT_MAX));
-        
-        // Calculate shortest path distance between each pair
-        for (int i = 0; i < n; i++) {
-            for (int j = 0; j < n; j++) {
-                if (i == j) {
-                    distances[i][j] = 0;
-                    continue;
-                }
-                
-                vector<int> path = dijkstra(nodes[i], nodes[j]);
-                if (!path.empty()) {
-                    // Calculate total distance from the path
-                    int totalDist = 0;
-                    for (size_t k = 0; k < path.size() - 1; k++) {
-                        for (const auto& edge : adjList[path[k]]) {
-                            if (edge.first == path[k + 1]) {
-                                totalDist += edge.second;
-                                break;
-                            }
-                        }
-                    }
-                    distances[i][j] = totalDist;
-                }
+private:
+    int bucketOf(int key) const {
+        unsigned diff = (unsigned)key ^ (unsigned)last;
+        if (diff == 0) return 0;
+#if defined(__GNUC__) || defined(__clang__)
+        return 32 - __builtin_clz(diff);
+#else
+        int bits = 0;
+        for (; diff != 0; diff >>= 1) bits++;
+        return bits;
+#endif
+    }
+
+    vector<pair<int, int>> buckets[33];  // (key, node)
+    int last = 0;
+    size_t count = 0;
+};
+
+// Work counters for finding out why a request is slow, compiled in with
+// -DVRP_ENABLE_STATS. A request points its thread at its own QueryStats
+// (StatsScope; forEachIndex carries it into pool workers). Searches count in
+// a local SearchCounters and add it once at the end, so the hot loops only
+// touch registers. Everything is also added to processStats(), which the
+// server exports as metrics. Without the flag the VRP_STATS() hooks compile
+// to nothing.
+#ifdef VRP_ENABLE_STATS
+#define VRP_STATS(statement) statement
+
+struct QueryStats {
+    atomic<long long> settled{0};      // Nodes settled by the searches
+    atomic<long long> relaxed{0};      // Arcs scanned
+    atomic<long long> pushes{0};       // Priority queue inserts and decrease-keys
+    atomic<long long> pops{0};
+    atomic<long long> stalePops{0};    // Pops of entries already superseded
+    atomic<long long> cacheHits{0};    // RouteCache lookups
+    atomic<long long> cacheMisses{0};
+    atomic<long long> tourScans{0};    // Stops examined by the TSP local search
+    atomic<long long> tourMoves{0};    // Improving moves it applied
+    atomic<long long> arenaAllocations{0};  // Served by the request's RequestArena
+    atomic<long long> arenaBytes{0};
+    atomic<long long> matrixNanos{0};  // Wall time in calculateDistanceMatrix
+    atomic<long long> tspNanos{0};     // ... in solveTSP
+    atomic<long long> stitchNanos{0};  // ... in expandRoute
+};
+
+struct SearchCounters {
+    long long settled = 0;
+    long long relaxed = 0;
+    long long pushes = 0;
+    long long pops = 0;
+    long long stalePops = 0;
+};
+
+static QueryStats& processStats() {
+    static QueryStats stats;
+    return stats;
+}
+
+// Stats of the request running on this thread (nullptr = process totals only)
+static QueryStats*& activeStats() {
+    thread_local QueryStats* stats = nullptr;
+    return stats;
+}
+
+// Count this thread's work towards stats until the end of the scope
+struct StatsScope {
+    QueryStats* previous;
+    explicit StatsScope(QueryStats* stats) : previous(activeStats()) { activeStats() = stats; }
+    ~StatsScope() { activeStats() = previous; }
+};
+
+static void addStat(atomic<long long> QueryStats::*field, long long value) {
+    if (value == 0) return;
+    (processStats().*field).fetch_add(value, memory_order_relaxed);
+    if (QueryStats* stats = activeStats()) (stats->*field).fetch_add(value, memory_order_relaxed);
+}
+
+static void recordSearch(const SearchCounters& counters) {
+    addStat(&QueryStats::settled, counters.settled);
+    addStat(&QueryStats::relaxed, counters.relaxed);
+    addStat(&QueryStats::pushes, counters.pushes);
+    addStat(&QueryStats::pops, counters.pops);
+    addStat(&QueryStats::stalePops, counters.stalePops);
+}
+
+// Adds the wall time of its scope to one of the phase timers
+struct StatsTimer {
+    atomic<long long> QueryStats::*phase;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    explicit StatsTimer(atomic<long long> QueryStats::*field) : phase(field) {}
+    ~StatsTimer() {
+        addStat(phase, chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+    }
+};
+#else
+#define VRP_STATS(statement)
+#endif
+
+// Queue used by the plain Dijkstra searches (--queue)
+enum class QueueKind { Binary, Dary, Radix };
+
+// Scratch arrays for one search, indexed by dense node. Reused across queries
+// on the same thread, so once it has grown to the graph size a matrix row
+// costs no allocations. Labels carry the generation of the search that wrote
+// them: reset() just starts a new generation, and anything older reads as
+// unreached, so a short query pays only for the nodes it touches.
+struct SearchWorkspace {
+    long long settled = 0;  // Nodes settled by the last search
+    BinaryHeapQueue binaryQueue;
+    DaryHeapQueue<4> daryQueue;
+    RadixHeapQueue radixQueue;
+
+    void reset(int numNodes) {
+        if ((int)labels.size() != numNodes) {
+            labels.assign(numNodes, Label());
+            generation = 0;
+        }
+        if (++generation == 0) {
+            // Wrapped around: old stamps could pass for current ones
+            for (Label& label : labels) label.stamp = label.targetStamp = 0;
+            generation = 1;
+        }
+        settled = 0;
+    }
+
+    // Distance of node in the current search, INT_MAX if not reached
+    int dist(int node) const {
+        const Label& label = labels[node];
+        return label.stamp == generation ? label.dist : INT_MAX;
+    }
+
+    // Predecessor on the current shortest path, -1 for the source or an
+    // unreached node
+    int parent(int node) const {
+        const Label& label = labels[node];
+        return label.stamp == generation ? label.parent : -1;
+    }
+
+    void reach(int node, int distance, int from) {
+        Label& label = labels[node];
+        label.stamp = generation;
+        label.dist = distance;
+        label.parent = from;
+    }
+
+    bool isTarget(int node) const { return labels[node].targetStamp == generation; }
+    void markTarget(int node) { labels[node].targetStamp = generation; }
+    void clearTarget(int node) { labels[node].targetStamp = 0; }
+
+private:
+    struct Label {
+        unsigned stamp = 0;        // Generation that set dist and parent
+        unsigned targetStamp = 0;  // Generation in which the node is an unsettled target
+        int dist = INT_MAX;
+        int parent = -1;
+    };
+
+    vector<Label> labels;
+    unsigned generation = 0;
+};
+
+static SearchWorkspace& localWorkspace() {
+    thread_local SearchWorkspace workspace;
+    return workspace;
+}
+
+// Monotonic arena for the short-lived state of one request: node lists, leg
+// paths, local-search scratch. An allocation is a pointer bump, nothing is
+// freed until the arena goes away, and memory comes from the global allocator
+// in a few growing blocks, so concurrent requests stop contending there.
+// Install it with ArenaScope; code on that thread then allocates through
+// requestMemory(). Pool workers keep using the global allocator, since the
+// arena is not thread-safe - and nothing allocated from it may outlive the
+// request.
+class RequestArena : public pmr::memory_resource {
+public:
+    RequestArena() : arena(kFirstBlock) {}
+
+    ~RequestArena() override {
+        VRP_STATS(addStat(&QueryStats::arenaAllocations, allocations));
+        VRP_STATS(addStat(&QueryStats::arenaBytes, bytes));
+    }
+
+    long long numAllocations() const { return allocations; }
+    long long numBytes() const { return bytes; }
+
+private:
+    static constexpr size_t kFirstBlock = 1 << 16;
+
+    void* do_allocate(size_t size, size_t alignment) override {
+        allocations++;
+        bytes += size;
+        return arena.allocate(size, alignment);
+    }
+
+    void do_deallocate(void*, size_t, size_t) override {} // Released with the arena
+
+    bool do_is_equal(const pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    pmr::monotonic_buffer_resource arena;
+    long long allocations = 0;
+    long long bytes = 0;
+};
+
+static RequestArena*& activeArena() {
+    thread_local RequestArena* arena = nullptr;
+    return arena;
+}
+
+// Where per-request containers allocate: the arena of the request running on
+// this thread, or the global allocator outside one
+static pmr::memory_resource* requestMemory() {
+    RequestArena* arena = activeArena();
+    if (arena == nullptr) return pmr::new_delete_resource();
+    return arena;
+}
+
+// Serve this thread's request allocations from arena until the end of the scope
+struct ArenaScope {
+    RequestArena* previous;
+    explicit ArenaScope(RequestArena* arena) : previous(activeArena()) { activeArena() = arena; }
+    ~ArenaScope() { activeArena() = previous; }
+};
+
+// Bounded least-recently-used map, split into independently locked shards so
+// concurrent requests rarely contend. Values are copied out under the lock.
+template<typename Key, typename Value>
+class ShardedLruCache {
+public:
+    explicit ShardedLruCache(size_t capacity) : perShard(max<size_t>(1, (capacity + kShards - 1) / kShards)) {}
+
+    bool get(const Key& key, Value& value) {
+        Shard& shard = shardOf(key);
+        lock_guard<mutex> lock(shard.m);
+        auto it = shard.index.find(key);
+        if (it == shard.index.end()) return false;
+        shard.order.splice(shard.order.begin(), shard.order, it->second);
+        value = it->second->second;
+        return true;
+    }
+
+    void put(const Key& key, const Value& value) {
+        Shard& shard = shardOf(key);
+        lock_guard<mutex> lock(shard.m);
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            it->second->second = value;
+            shard.order.splice(shard.order.begin(), shard.order, it->second);
+            return;
+        }
+        shard.order.emplace_front(key, value);
+        shard.index[key] = shard.order.begin();
+        if (shard.order.size() > perShard) {
+            shard.index.erase(shard.order.back().first);
+            shard.order.pop_back();
+        }
+    }
+
+    void clear() {
+        for (Shard& shard : shards) {
+            lock_guard<mutex> lock(shard.m);
+            shard.order.clear();
+            shard.index.clear();
+        }
+    }
+
+    size_t size() {
+        size_t total = 0;
+        for (Shard& shard : shards) {
+            lock_guard<mutex> lock(shard.m);
+            total += shard.order.size();
+        }
+        return total;
+    }
+
+private:
+    static constexpr int kShards = 16;
+
+    struct Shard {
+        mutex m;
+        list<pair<Key, Value>> order;  // Most recently used first
+        unordered_map<Key, typename list<pair<Key, Value>>::iterator> index;
+    };
+
+    Shard& shardOf(const Key& key) {
+        // Fibonacci hashing spreads sequential keys over the shards
+        return shards[(hash<Key>()(key) * 0x9E3779B97F4A7C15ull) >> 60];
+    }
+
+    size_t perShard;
+    Shard shards[kShards];
+};
+
+// Shortest paths from one source to a set of targets, kept as a sparse
+// predecessor list over just the nodes on those paths (dense indices)
+struct PathTree {
+    int source = -1;
+    vector<pair<int, int>> parents;  // (node, parent), sorted by node
+
+    // Collect the paths to the reached targets of a finished search
+    static shared_ptr<const PathTree> fromSearch(int source, const vector<int>& targets, const SearchWorkspace& ws) {
+        shared_ptr<PathTree> tree = make_shared<PathTree>();
+        tree->source = source;
+        unordered_map<int, int> seen;
+        for (int t : targets) {
+            if (t < 0 || ws.dist(t) == INT_MAX) continue;
+            for (int v = t; v != source && seen.emplace(v, ws.parent(v)).second; v = ws.parent(v)) {
+                tree->parents.push_back({v, ws.parent(v)});
             }
         }
-        return distances;
+        sort(tree->parents.begin(), tree->parents.end());
+        return tree;
     }
 
-    // Nearest neighbor algorithm for TSP
-    vector<int> solveTSP(const vector<vector<int>>& distances) {
-        int n = distances.size();
-        vector<bool> visited(n, false);
-        vector<int> tour;
-        
-        // Start from the first node
-        int currentNode = 0;
-        tour.push_back(currentNode);
-        visited[currentNode] = true;
-        
-        // Visit all nodes
-        for (int i = 1; i < n; i++) {
-            int nextNode = -1;
-            int minDist = INT_MAX;
-            
-            for (int j = 0; j < n; j++) {
-                if (!visited[j] && distances[currentNode][j] < minDist) {
-                    nextNode = j;
-                    minDist = distances[currentNode][j];
+    // Predecessor list of a single path (dense nodes, source first)
+    static shared_ptr<const PathTree> fromPath(const vector<int>& path) {
+        shared_ptr<PathTree> tree = make_shared<PathTree>();
+        tree->source = path[0];
+        for (size_t k = 1; k < path.size(); k++) {
+            tree->parents.push_back({path[k], path[k - 1]});
+        }
+        sort(tree->parents.begin(), tree->parents.end());
+        return tree;
+    }
+
+    // Dense node sequence source..target, or false if target is not covered
+    bool path(int target, vector<int>& out) const {
+        out.clear();
+        for (int v = target; v != source;) {
+            auto it = lower_bound(parents.begin(), parents.end(), make_pair(v, INT_MIN));
+            if (it == parents.end() || it->first != v) return false;
+            out.push_back(v);
+            v = it->second;
+        }
+        out.push_back(source);
+        reverse(out.begin(), out.end());
+        return true;
+    }
+};
+
+// Results shared by the requests of a server: pair distances and the
+// predecessor trees of recent searches, keyed by dense node index. Paths and
+// distances are symmetric because the graph is undirected, so a tree rooted at
+// either end serves a pair. Must be cleared whenever the graph changes.
+class RouteCache {
+public:
+    RouteCache(size_t maxDistances, size_t maxTrees)
+        : distances(maxDistances), trees(maxTrees), distanceLimit(maxDistances), treeLimit(maxTrees) {}
+
+    size_t distanceCapacity() const { return distanceLimit; }
+    size_t treeCapacity() const { return treeLimit; }
+
+    bool distance(int s, int t, int& value) {
+        bool hit = distances.get(pairKey(s, t), value);
+        (hit ? distanceHits : distanceMisses)++;
+        VRP_STATS(addStat(hit ? &QueryStats::cacheHits : &QueryStats::cacheMisses, 1));
+        return hit;
+    }
+
+    void storeDistance(int s, int t, int value) {
+        distances.put(pairKey(s, t), value);
+    }
+
+    // Dense node sequence s..t from a cached tree rooted at s or t
+    bool path(int s, int t, vector<int>& out) {
+        shared_ptr<const PathTree> tree;
+        bool hit = (trees.get(s, tree) && tree->path(t, out)) ||
+                   (trees.get(t, tree) && tree->path(s, out) && (reverse(out.begin(), out.end()), true));
+        (hit ? pathHits : pathMisses)++;
+        VRP_STATS(addStat(hit ? &QueryStats::cacheHits : &QueryStats::cacheMisses, 1));
+        return hit;
+    }
+
+    // replace = false keeps a tree already cached for the same source, so a
+    // single-pair search does not evict a whole matrix row
+    void storeTree(const shared_ptr<const PathTree>& tree, bool replace = true) {
+        shared_ptr<const PathTree> existing;
+        if (!replace && trees.get(tree->source, existing)) return;
+        trees.put(tree->source, tree);
+    }
+
+    void clear() {
+        distances.clear();
+        trees.clear();
+    }
+
+    size_t numDistances() { return distances.size(); }
+    size_t numTrees() { return trees.size(); }
+
+    atomic<uint64_t> distanceHits{0}, distanceMisses{0};
+    atomic<uint64_t> pathHits{0}, pathMisses{0};
+
+private:
+    static uint64_t pairKey(int s, int t) {
+        if (s > t) swap(s, t);
+        return (uint64_t)(uint32_t)s << 32 | (uint32_t)t;
+    }
+
+    ShardedLruCache<uint64_t, int> distances;
+    ShardedLruCache<int, shared_ptr<const PathTree>> trees;
+    size_t distanceLimit;
+    size_t treeLimit;
+};
+
+// Fixed set of worker threads used for independent, coarse-grained jobs such
+// as distance-matrix rows. parallelFor() hands every worker a contiguous block
+// of indices; a worker drains its own block from the front and, once it runs
+// dry, steals single indices from the back of the fullest remaining block.
+class ThreadPool {
+public:
+    // numThreads <= 0 means one worker per hardware thread
+    explicit ThreadPool(int numThreads) {
+        if (numThreads <= 0) {
+            numThreads = max(1u, thread::hardware_concurrency());
+        }
+        numWorkers = numThreads;
+        ranges.reset(new atomic<uint64_t>[numWorkers]);
+        for (int w = 1; w < numWorkers; w++) {
+            threads.emplace_back([this, w] { workerLoop(w); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> lock(stateMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread& t : threads) {
+            t.join();
+        }
+    }
+
+    int size() const { return numWorkers; }
+
+    // Run body(worker, i) for every i in [0, count) and wait for all of them.
+    // The calling thread takes part as worker 0. Calls made from inside a body
+    // run inline on the worker that issued them.
+    void parallelFor(int count, const function<void(int, int)>& body) {
+        if (count <= 0) return;
+        if (currentWorker() >= 0) {
+            for (int i = 0; i < count; i++) {
+                body(currentWorker(), i);
+            }
+            return;
+        }
+
+        lock_guard<mutex> jobLock(jobMutex);
+        for (int w = 0; w < numWorkers; w++) {
+            uint32_t begin = (uint64_t)count * w / numWorkers;
+            uint32_t end = (uint64_t)count * (w + 1) / numWorkers;
+            ranges[w].store(pack(begin, end));
+        }
+        job = &body;
+        firstError = nullptr;
+        {
+            lock_guard<mutex> lock(stateMutex);
+            busyWorkers = numWorkers - 1;
+            generation++;
+        }
+        wake.notify_all();
+
+        currentWorker() = 0;
+        runJob(0);
+        currentWorker() = -1;
+
+        unique_lock<mutex> lock(stateMutex);
+        done.wait(lock, [this] { return busyWorkers == 0; });
+        job = nullptr;
+        if (firstError) {
+            rethrow_exception(firstError);
+        }
+    }
+
+private:
+    static uint64_t pack(uint32_t begin, uint32_t end) { return ((uint64_t)begin << 32) | end; }
+    static uint32_t rangeBegin(uint64_t range) { return range >> 32; }
+    static uint32_t rangeEnd(uint64_t range) { return (uint32_t)range; }
+
+    static int& currentWorker() {
+        thread_local int worker = -1;
+        return worker;
+    }
+
+    // Take the next index from the front of the worker's own block
+    bool popOwn(int w, int& index) {
+        uint64_t range = ranges[w].load();
+        while (rangeBegin(range) < rangeEnd(range)) {
+            if (ranges[w].compare_exchange_weak(range, pack(rangeBegin(range) + 1, rangeEnd(range)))) {
+                index = rangeBegin(range);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Take an index from the back of the block with the most work left
+    bool steal(int w, int& index) {
+        while (true) {
+            int victim = -1;
+            uint32_t mostLeft = 0;
+            for (int v = 0; v < numWorkers; v++) {
+                uint64_t range = ranges[v].load();
+                uint32_t left = rangeEnd(range) - min(rangeBegin(range), rangeEnd(range));
+                if (v != w && left > mostLeft) {
+                    victim = v;
+                    mostLeft = left;
                 }
             }
-            
-            tour.push_back(nextNode);
-            visited[nextNode] = true;
-            currentNode = nextNode;
+            if (victim < 0) return false;
+
+            uint64_t range = ranges[victim].load();
+            if (rangeBegin(range) < rangeEnd(range) &&
+                ranges[victim].compare_exchange_strong(range, pack(rangeBegin(range), rangeEnd(range) - 1))) {
+                index = rangeEnd(range) - 1;
+                return true;
+            }
+        }
+    }
+
+    void runJob(int w) {
+        int index;
+        while (popOwn(w, index) || steal(w, index)) {
+            try {
+                (*job)(w, index);
+            } catch (...) {
+                lock_guard<mutex> lock(errorMutex);
+                if (!firstError) firstError = current_exception();
+            }
+        }
+    }
+
+    void workerLoop(int w) {
+        currentWorker() = w;
+        uint64_t seen = 0;
+        while (true) {
+            {
+                unique_lock<mutex> lock(stateMutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            runJob(w);
+            lock_guard<mutex> lock(stateMutex);
+            if (--busyWorkers == 0) {
+                done.notify_all();
+            }
+        }
+    }
+
+    int numWorkers = 1;
+    vector<thread> threads;
+    unique_ptr<atomic<uint64_t>[]> ranges;  // per-worker [begin, end) packed into one word
+
+    mutex jobMutex;  // one parallelFor at a time
+    mutex stateMutex;
+    condition_variable wake;
+    condition_variable done;
+    const function<void(int, int)>* job = nullptr;
+    uint64_t generation = 0;
+    int busyWorkers = 0;
+    bool stopping = false;
+
+    mutex errorMutex;
+    exception_ptr firstError;
+};
+
+// Run body(worker, i) over [0, count) on the pool, or inline without one
+static void forEachIndex(ThreadPool* pool, int count, const function<void(int, int)>& body) {
+    if (pool != nullptr && pool->size() > 1) {
+#ifdef VRP_ENABLE_STATS
+        QueryStats* stats = activeStats();
+        pool->parallelFor(count, [&](int worker, int i) {
+            StatsScope scope(stats);
+            body(worker, i);
+        });
+#else
+        pool->parallelFor(count, body);
+#endif
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        body(0, i);
+    }
+}
+
+// Distances between the stops of one problem, row-major in a single
+// allocation. Every row starts on a cache line and is padded to whole lines,
+// so scanning row a never touches another row's data. Pairs without a path
+// hold kUnreachable, which is above any real distance (those fit in an int);
+// solvers treat it as a very long edge and add entries up in long long.
+class DistanceMatrix {
+public:
+    typedef uint32_t Value;
+    static constexpr Value kUnreachable = UINT32_MAX;
+
+    DistanceMatrix() {}
+
+    // rows x columns (square if columns is left out), all unreachable
+    explicit DistanceMatrix(int rows, int columns = -1)
+        : numRows(rows), numColumns(columns < 0 ? rows : columns), stride(paddedLength(numColumns)),
+          cells(allocate((size_t)numRows * stride)) {
+        fill(cells.get(), cells.get() + (size_t)numRows * stride, kUnreachable);
+    }
+
+    DistanceMatrix(DistanceMatrix&& other) { *this = move(other); }
+
+    DistanceMatrix& operator=(DistanceMatrix&& other) {
+        numRows = exchange(other.numRows, 0);
+        numColumns = exchange(other.numColumns, 0);
+        stride = exchange(other.stride, 0);
+        cells = move(other.cells);
+        return *this;
+    }
+
+    DistanceMatrix(const DistanceMatrix&) = delete;
+    DistanceMatrix& operator=(const DistanceMatrix&) = delete;
+
+    int size() const { return numRows; }
+    int columns() const { return numColumns; }
+    size_t rowStride() const { return stride; }  // Cells from one row to the next, padding included
+
+    // Row i, so that d[a][b] reads the entry from a to b
+    Value* operator[](int i) { return cells.get() + (size_t)i * stride; }
+    const Value* operator[](int i) const { return cells.get() + (size_t)i * stride; }
+
+    bool reachable(int i, int j) const { return (*this)[i][j] != kUnreachable; }
+
+    // Conversions from and to the INT_MAX convention of the searches
+    static Value fromDistance(int distance) { return distance == INT_MAX || distance < 0 ? kUnreachable : distance; }
+    static int toDistance(Value value) { return value == kUnreachable ? INT_MAX : (int)value; }
+
+    int distance(int i, int j) const { return toDistance((*this)[i][j]); }
+    void setDistance(int i, int j, int distance) { (*this)[i][j] = fromDistance(distance); }
+
+    // Fill row i from one search result (INT_MAX = unreachable)
+    void setRow(int i, const vector<int>& distances) {
+        Value* row = (*this)[i];
+        for (int j = 0; j < numColumns; j++) row[j] = fromDistance(distances[j]);
+    }
+
+    // Square matrix grown or shrunk to n x n, keeping the entries among the
+    // first min(n, size()) rows and columns; new entries are unreachable
+    void resize(int n) {
+        DistanceMatrix next(n);
+        int kept = min(n, numRows);
+        for (int i = 0; i < kept; i++) copy((*this)[i], (*this)[i] + kept, next[i]);
+        *this = move(next);
+    }
+
+    // Remove row and column k of a square matrix, in place
+    void erase(int k) {
+        for (int i = 0, to = 0; i < numRows; i++) {
+            if (i == k) continue;
+            Value* row = (*this)[i];
+            Value* target = (*this)[to++];
+            copy(row, row + k, target);
+            copy(row + k + 1, row + numColumns, target + k);
+        }
+        numRows--;
+        numColumns--;
+    }
+
+    // Whether every reachable entry fits a 16-bit cell, with 0xFFFF left
+    // for unreachable
+    bool fitsCompact() const {
+        for (int i = 0; i < numRows; i++) {
+            const Value* row = (*this)[i];
+            for (int j = 0; j < numColumns; j++) {
+                if (row[j] != kUnreachable && row[j] >= UINT16_MAX) return false;
+            }
+        }
+        return true;
+    }
+
+    // Binary form: a kFileHeaderBytes header (magic, rows, columns, bytes per
+    // cell) and then the rows back to back without padding, native byte
+    // order, so a reader can map the file and view it as a rows x columns
+    // array. Compact files use 16-bit cells (see fitsCompact) with
+    // unreachable as 0xFFFF, otherwise 32-bit cells with 0xFFFFFFFF.
+    bool write(const string& filename, bool compact) const {
+        FILE* file = fopen(filename.c_str(), "wb");
+        if (file == nullptr) return false;
+        char header[kFileHeaderBytes] = {};
+        uint32_t shape[3] = {(uint32_t)numRows, (uint32_t)numColumns, compact ? 2u : 4u};
+        memcpy(header, kFileMagic, sizeof(kFileMagic));
+        memcpy(header + sizeof(kFileMagic), shape, sizeof(shape));
+        bool ok = fwrite(header, 1, sizeof(header), file) == sizeof(header);
+        vector<uint16_t> packed(compact ? numColumns : 0);
+        for (int i = 0; i < numRows && ok; i++) {
+            const Value* row = (*this)[i];
+            if (compact) {
+                for (int j = 0; j < numColumns; j++) packed[j] = row[j] == kUnreachable ? UINT16_MAX : row[j];
+                ok = fwrite(packed.data(), sizeof(uint16_t), numColumns, file) == (size_t)numColumns;
+            } else {
+                ok = fwrite(row, sizeof(Value), numColumns, file) == (size_t)numColumns;
+            }
+        }
+        return fclose(file) == 0 && ok;
+    }
+
+private:
+    static constexpr size_t kAlignment = 64;
+    static constexpr size_t kFileHeaderBytes = 64;
+    static constexpr char kFileMagic[8] = {'V', 'R', 'P', 'D', 'M', '0', '0', '1'};
+
+    struct Release {
+        void operator()(Value* cells) const { ::operator delete(cells, align_val_t(kAlignment)); }
+    };
+
+    static size_t paddedLength(int columns) {
+        size_t perLine = kAlignment / sizeof(Value);
+        return (columns + perLine - 1) / perLine * perLine;
+    }
+
+    static Value* allocate(size_t count) {
+        if (count == 0) return nullptr;
+        return static_cast<Value*>(::operator new(count * sizeof(Value), align_val_t(kAlignment)));
+    }
+
+    int numRows = 0;
+    int numColumns = 0;
+    size_t stride = 0;
+    unique_ptr<Value[], Release> cells;
+};
+
+// Dense loops of the tour builders over matrix rows and per-gap cost arrays,
+// with one implementation per instruction set. All of them return exactly
+// what the plain loop does, including the lowest index on ties, so the
+// choice of kernel never changes a tour.
+struct SimdKernels {
+    const char* name;
+    // Index of the smallest values[j] with skip[j] == 0, -1 if every such
+    // value is DistanceMatrix::kUnreachable
+    int (*maskedArgmin)(const uint32_t* values, const char* skip, int n);
+    // delta[g] = in[g] + out[g] - leg[g]: the cost of putting a stop into
+    // gap g, given the legs into and out of the stop and the leg it replaces
+    void (*gapDeltas)(const long long* in, const long long* out, const long long* leg, int n, long long* delta);
+};
+
+static int maskedArgminScalar(const uint32_t* values, const char* skip, int n) {
+    int best = -1;
+    uint32_t bestValue = DistanceMatrix::kUnreachable;
+    for (int j = 0; j < n; j++) {
+        if (!skip[j] && values[j] < bestValue) {
+            best = j;
+            bestValue = values[j];
+        }
+    }
+    return best;
+}
+
+static void gapDeltasScalar(const long long* in, const long long* out, const long long* leg, int n, long long* delta) {
+    for (int g = 0; g < n; g++) delta[g] = in[g] + out[g] - leg[g];
+}
+
+#if defined(VRP_SIMD_X86) || defined(VRP_SIMD_NEON)
+// Reduce per-lane (value, first index) minima to the overall first minimum;
+// lanes with index -1 found nothing
+static int firstMinimum(const uint32_t* values, const int* indices, int lanes, uint32_t& bestValue) {
+    int best = -1;
+    for (int k = 0; k < lanes; k++) {
+        if (indices[k] < 0) continue;
+        if (best < 0 || values[k] < bestValue || (values[k] == bestValue && indices[k] < best)) {
+            best = indices[k];
+            bestValue = values[k];
+        }
+    }
+    return best;
+}
+#endif
+
+#ifdef VRP_SIMD_X86
+__attribute__((target("avx2")))
+static int maskedArgminAvx2(const uint32_t* values, const char* skip, int n) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i best = _mm256_set1_epi32(-1);
+    __m256i bestIndex = _mm256_set1_epi32(-1);
+    __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    int j = 0;
+    for (; j + 8 <= n; j += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(values + j));
+        __m256i skipped = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(skip + j)));
+        // Skipped lanes become kUnreachable, which never wins
+        v = _mm256_or_si256(v, _mm256_xor_si256(_mm256_cmpeq_epi32(skipped, zero), _mm256_set1_epi32(-1)));
+        __m256i smaller = _mm256_min_epu32(v, best);
+        __m256i less = _mm256_xor_si256(_mm256_cmpeq_epi32(smaller, best), _mm256_set1_epi32(-1));
+        best = smaller;
+        bestIndex = _mm256_blendv_epi8(bestIndex, index, less);
+        index = _mm256_add_epi32(index, _mm256_set1_epi32(8));
+    }
+    alignas(32) uint32_t laneValue[8];
+    alignas(32) int laneIndex[8];
+    _mm256_store_si256((__m256i*)laneValue, best);
+    _mm256_store_si256((__m256i*)laneIndex, bestIndex);
+    uint32_t bestValue = DistanceMatrix::kUnreachable;
+    int result = firstMinimum(laneValue, laneIndex, 8, bestValue);
+    for (; j < n; j++) {
+        if (!skip[j] && values[j] < bestValue) {
+            result = j;
+            bestValue = values[j];
+        }
+    }
+    return bestValue == DistanceMatrix::kUnreachable ? -1 : result;
+}
+
+__attribute__((target("avx2")))
+static void gapDeltasAvx2(const long long* in, const long long* out, const long long* leg, int n, long long* delta) {
+    int g = 0;
+    for (; g + 4 <= n; g += 4) {
+        __m256i sum = _mm256_add_epi64(_mm256_loadu_si256((const __m256i*)(in + g)),
+                                       _mm256_loadu_si256((const __m256i*)(out + g)));
+        _mm256_storeu_si256((__m256i*)(delta + g), _mm256_sub_epi64(sum, _mm256_loadu_si256((const __m256i*)(leg + g))));
+    }
+    for (; g < n; g++) delta[g] = in[g] + out[g] - leg[g];
+}
+
+__attribute__((target("avx512f")))
+static int maskedArgminAvx512(const uint32_t* values, const char* skip, int n) {
+    const __m512i zero = _mm512_setzero_si512();
+    __m512i best = _mm512_set1_epi32(-1);
+    __m512i bestIndex = _mm512_set1_epi32(-1);
+    __m512i index = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    int j = 0;
+    for (; j + 16 <= n; j += 16) {
+        __m512i v = _mm512_loadu_si512((const void*)(values + j));
+        __mmask16 open = _mm512_cmpeq_epi32_mask(_mm512_maskz_cvtepu8_epi32(0xFFFF, _mm_loadu_si128((const __m128i*)(skip + j))), zero);
+        __mmask16 less = _mm512_mask_cmplt_epu32_mask(open, v, best);
+        best = _mm512_mask_mov_epi32(best, less, v);
+        bestIndex = _mm512_mask_mov_epi32(bestIndex, less, index);
+        index = _mm512_add_epi32(index, _mm512_set1_epi32(16));
+    }
+    alignas(64) uint32_t laneValue[16];
+    alignas(64) int laneIndex[16];
+    _mm512_store_si512((void*)laneValue, best);
+    _mm512_store_si512((void*)laneIndex, bestIndex);
+    uint32_t bestValue = DistanceMatrix::kUnreachable;
+    int result = firstMinimum(laneValue, laneIndex, 16, bestValue);
+    for (; j < n; j++) {
+        if (!skip[j] && values[j] < bestValue) {
+            result = j;
+            bestValue = values[j];
+        }
+    }
+    return bestValue == DistanceMatrix::kUnreachable ? -1 : result;
+}
+
+__attribute__((target("avx512f")))
+static void gapDeltasAvx512(const long long* in, const long long* out, const long long* leg, int n, long long* delta) {
+    int g = 0;
+    for (; g + 8 <= n; g += 8) {
+        __m512i sum = _mm512_add_epi64(_mm512_loadu_si512((const void*)(in + g)), _mm512_loadu_si512((const void*)(out + g)));
+        _mm512_storeu_si512((void*)(delta + g), _mm512_sub_epi64(sum, _mm512_loadu_si512((const void*)(leg + g))));
+    }
+    for (; g < n; g++) delta[g] = in[g] + out[g] - leg[g];
+}
+
+#endif
+
+#ifdef VRP_SIMD_NEON
+static int maskedArgminNeon(const uint32_t* values, const char* skip, int n) {
+    uint32x4_t best[2] = {vdupq_n_u32(UINT32_MAX), vdupq_n_u32(UINT32_MAX)};
+    uint32x4_t bestIndex[2] = {vdupq_n_u32(UINT32_MAX), vdupq_n_u32(UINT32_MAX)};
+    static const uint32_t first[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+    uint32x4_t index[2] = {vld1q_u32(first), vld1q_u32(first + 4)};
+    int j = 0;
+    for (; j + 8 <= n; j += 8) {
+        uint16x8_t wide = vmovl_u8(vld1_u8((const uint8_t*)(skip + j)));
+        uint32x4_t skipped[2] = {vmovl_u16(vget_low_u16(wide)), vmovl_u16(vget_high_u16(wide))};
+        for (int h = 0; h < 2; h++) {
+            // Skipped lanes become kUnreachable, which never wins
+            uint32x4_t v = vorrq_u32(vld1q_u32(values + j + 4 * h), vtstq_u32(skipped[h], skipped[h]));
+            uint32x4_t less = vcltq_u32(v, best[h]);
+            best[h] = vbslq_u32(less, v, best[h]);
+            bestIndex[h] = vbslq_u32(less, index[h], bestIndex[h]);
+            index[h] = vaddq_u32(index[h], vdupq_n_u32(8));
+        }
+    }
+    uint32_t laneValue[8];
+    int laneIndex[8];
+    vst1q_u32(laneValue, best[0]);
+    vst1q_u32(laneValue + 4, best[1]);
+    vst1q_u32((uint32_t*)laneIndex, bestIndex[0]);
+    vst1q_u32((uint32_t*)laneIndex + 4, bestIndex[1]);
+    uint32_t bestValue = DistanceMatrix::kUnreachable;
+    int result = firstMinimum(laneValue, laneIndex, 8, bestValue);
+    for (; j < n; j++) {
+        if (!skip[j] && values[j] < bestValue) {
+            result = j;
+            bestValue = values[j];
+        }
+    }
+    return bestValue == DistanceMatrix::kUnreachable ? -1 : result;
+}
+
+static void gapDeltasNeon(const long long* in, const long long* out, const long long* leg, int n, long long* delta) {
+    int g = 0;
+    for (; g + 2 <= n; g += 2) {
+        int64x2_t sum = vaddq_s64(vld1q_s64((const int64_t*)(in + g)), vld1q_s64((const int64_t*)(out + g)));
+        vst1q_s64((int64_t*)(delta + g), vsubq_s64(sum, vld1q_s64((const int64_t*)(leg + g))));
+    }
+    for (; g < n; g++) delta[g] = in[g] + out[g] - leg[g];
+}
+
+#endif
+
+static constexpr SimdKernels kScalarKernels = {"scalar", maskedArgminScalar, gapDeltasScalar};
+#ifdef VRP_SIMD_X86
+static constexpr SimdKernels kAvx2Kernels = {"avx2", maskedArgminAvx2, gapDeltasAvx2};
+static constexpr SimdKernels kAvx512Kernels = {"avx512", maskedArgminAvx512, gapDeltasAvx512};
+#endif
+#ifdef VRP_SIMD_NEON
+static constexpr SimdKernels kNeonKernels = {"neon", maskedArgminNeon, gapDeltasNeon};
+#endif
+
+// Kernel sets this build and CPU can run, best first
+static vector<const SimdKernels*> supportedSimdKernels() {
+    vector<const SimdKernels*> kernels;
+#ifdef VRP_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) kernels.push_back(&kAvx512Kernels);
+    if (__builtin_cpu_supports("avx2")) kernels.push_back(&kAvx2Kernels);
+#endif
+#ifdef VRP_SIMD_NEON
+    kernels.push_back(&kNeonKernels);
+#endif
+    kernels.push_back(&kScalarKernels);
+    return kernels;
+}
+
+// The kernel set in use, the best supported one unless changed by
+// selectSimdKernels()
+static const SimdKernels*& activeSimdKernels() {
+    static const SimdKernels* kernels = supportedSimdKernels()[0];
+    return kernels;
+}
+
+static const SimdKernels& simd() { return *activeSimdKernels(); }
+
+// Switch to the kernel set called name ("avx512", "avx2", "neon" or
+// "scalar"); false if this build or CPU cannot run it
+static bool selectSimdKernels(const string& name) {
+    for (const SimdKernels* kernels : supportedSimdKernels()) {
+        if (name == kernels->name) {
+            activeSimdKernels() = kernels;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Contraction hierarchy over the undirected road graph. Nodes are contracted
+// one at a time in order of edge difference; contracting a node adds shortcut
+// edges between its remaining neighbours unless a witness path makes them
+// redundant. Queries then run a bidirectional Dijkstra that only follows edges
+// towards higher-ranked nodes, and shortcuts are unpacked back into the
+// original nodes afterwards. All node numbers are CSRGraph dense indices.
+class ContractionHierarchy {
+public:
+    vector<int> rank;       // position of each node in the contraction order
+    vector<int> upOffsets;  // upward arcs of node i are [upOffsets[i], upOffsets[i + 1])
+    vector<int> upTargets;
+    vector<int> upWeights;
+    vector<int> upMiddle;   // node a shortcut bypasses, -1 for an original edge
+
+    int numNodes() const { return rank.size(); }
+    int numArcs() const { return upTargets.size(); }
+
+    void build(const CSRGraph& g) {
+        int n = g.numNodes();
+        vector<vector<CHEdge>> adj(n);  // edges to not-yet-contracted neighbours
+        for (int i = 0; i < n; i++) {
+            for (int e = g.offsets[i]; e < g.offsets[i + 1]; e++) {
+                if (g.targets[e] != i) {
+                    addOrImprove(adj[i], {g.targets[e], g.weights[e], -1});
+                }
+            }
+        }
+
+        WitnessSearch witness(n);
+        vector<int> deletedNeighbors(n, 0);
+        vector<int> depth(n, 0);  // longest chain of contracted nodes below
+        vector<char> contracted(n, 0);
+        vector<vector<CHEdge>> upward(n);
+        vector<Shortcut> shortcuts;
+        auto priority = [&](int v) {
+            findShortcuts(v, adj, witness, shortcuts);
+            return (int)shortcuts.size() - (int)adj[v].size() + deletedNeighbors[v] + depth[v];
+        };
+
+        // Queue entries whose priority no longer matches key[] are outdated
+        priority_queue<pair<int, int>, vector<pair<int, int>>, greater<pair<int, int>>> order;
+        vector<int> key(n);
+        for (int v = 0; v < n; v++) {
+            key[v] = priority(v);
+            order.push({key[v], v});
+        }
+
+        rank.assign(n, -1);
+        int level = 0;
+        while (!order.empty()) {
+            int v = order.top().second;
+            int entry = order.top().first;
+            order.pop();
+            if (contracted[v] || entry != key[v]) continue;
+
+            // Lazy update: re-evaluate and put back if no longer the minimum
+            int current = priority(v);
+            if (!order.empty() && current > order.top().first) {
+                key[v] = current;
+                order.push({current, v});
+                continue;
+            }
+
+            // shortcuts still holds the result of priority(v)
+            upward[v] = adj[v];
+            for (const CHEdge& edge : adj[v]) {
+                vector<CHEdge>& back = adj[edge.to];
+                back.erase(remove_if(back.begin(), back.end(),
+                                     [v](const CHEdge& other) { return other.to == v; }),
+                           back.end());
+                deletedNeighbors[edge.to]++;
+                depth[edge.to] = max(depth[edge.to], depth[v] + 1);
+            }
+            for (const Shortcut& sc : shortcuts) {
+                addOrImprove(adj[sc.from], {sc.to, sc.weight, v});
+                addOrImprove(adj[sc.to], {sc.from, sc.weight, v});
+            }
+            adj[v].clear();
+            adj[v].shrink_to_fit();
+            contracted[v] = 1;
+            rank[v] = level++;
+
+            for (const CHEdge& edge : upward[v]) {
+                key[edge.to] = priority(edge.to);
+                order.push({key[edge.to], edge.to});
+            }
+        }
+
+        upOffsets.assign(n + 1, 0);
+        upTargets.clear();
+        upWeights.clear();
+        upMiddle.clear();
+        for (int v = 0; v < n; v++) {
+            for (const CHEdge& edge : upward[v]) {
+                upTargets.push_back(edge.to);
+                upWeights.push_back(edge.weight);
+                upMiddle.push_back(edge.middle);
+            }
+            upOffsets[v + 1] = upTargets.size();
+        }
+    }
+
+    // Binary file: magic, node and arc counts, the node ids the hierarchy was
+    // built for (checked on load), then the rank and upward-arc arrays.
+    bool save(const string& filename, const CSRGraph& g) const {
+        ofstream out(filename, ios::binary);
+        if (!out) return false;
+        int32_t counts[2] = {numNodes(), numArcs()};
+        out.write(kMagic, sizeof(kMagic));
+        out.write((const char*)counts, sizeof(counts));
+        writeArray(out, vector<int>(g.nodeIds.begin(), g.nodeIds.end()));
+        writeArray(out, rank);
+        writeArray(out, upOffsets);
+        writeArray(out, upTargets);
+        writeArray(out, upWeights);
+        writeArray(out, upMiddle);
+        return (bool)out;
+    }
+
+    bool load(const string& filename, const CSRGraph& g) {
+        ifstream in(filename, ios::binary);
+        char magic[sizeof(kMagic)];
+        int32_t counts[2];
+        if (!in.read(magic, sizeof(magic)) || memcmp(magic, kMagic, sizeof(kMagic)) != 0) return false;
+        if (!in.read((char*)counts, sizeof(counts)) || counts[0] != g.numNodes()) return false;
+
+        vector<int> nodeIds;
+        if (!readArray(in, nodeIds, counts[0]) || !equal(nodeIds.begin(), nodeIds.end(), g.nodeIds.begin())) {
+            return false;
+        }
+        return readArray(in, rank, counts[0]) && readArray(in, upOffsets, counts[0] + 1) &&
+               readArray(in, upTargets, counts[1]) && readArray(in, upWeights, counts[1]) &&
+               readArray(in, upMiddle, counts[1]);
+    }
+
+    // Shortest path from s to t as dense indices (empty if unreachable).
+    // The path length is stored in *distance when given.
+    vector<int> query(int s, int t, int* distance = nullptr) const {
+        QueryWorkspace& ws = queryWorkspace(numNodes());
+        int best = INT_MAX;
+        int meet = -1;
+        ws.settle(0, s, 0, -1);
+        ws.settle(1, t, 0, -1);
+        VRP_STATS(SearchCounters counters);
+
+        while (true) {
+            // Advance the direction with the smaller key; stop once neither
+            // side can still improve on the best meeting point
+            int side = -1;
+            for (int d = 0; d < 2; d++) {
+                if (!ws.heap[d].empty() && ws.heap[d].front().first < best &&
+                    (side < 0 || ws.heap[d].front().first < ws.heap[side].front().first)) {
+                    side = d;
+                }
+            }
+            if (side < 0) break;
+
+            vector<pair<int, int>>& heap = ws.heap[side];
+            pop_heap(heap.begin(), heap.end(), greater<pair<int, int>>());
+            int nodeDist = heap.back().first;
+            int node = heap.back().second;
+            heap.pop_back();
+            VRP_STATS(counters.pops++);
+            if (nodeDist > ws.dist[side][node]) {
+                VRP_STATS(counters.stalePops++);
+                continue; // Stale entry
+            }
+            VRP_STATS(counters.settled++);
+
+            int other = ws.dist[1 - side][node];
+            if (other != INT_MAX && addDistances(nodeDist, other) < best) {
+                best = addDistances(nodeDist, other);
+                meet = node;
+            }
+
+            if (stalled(ws.dist[side], node, nodeDist)) continue;
+
+            VRP_STATS(counters.relaxed += upOffsets[node + 1] - upOffsets[node]);
+            for (int e = upOffsets[node]; e < upOffsets[node + 1]; e++) {
+                int next = upTargets[e];
+                int nextDist = addDistances(nodeDist, upWeights[e]);
+                if (nextDist < ws.dist[side][next]) {
+                    ws.settle(side, next, nextDist, e);
+                    ws.parentNode[side][next] = node;
+                    VRP_STATS(counters.pushes++);
+                }
+            }
+        }
+        VRP_STATS(recordSearch(counters));
+
+        vector<int> path;
+        if (meet >= 0) {
+            // Upward arcs from s to the meeting node, then back down to t
+            vector<int> forward;
+            for (int v = meet; v != s; v = ws.parentNode[0][v]) {
+                forward.push_back(v);
+            }
+            path.push_back(s);
+            int prev = s;
+            for (auto it = forward.rbegin(); it != forward.rend(); ++it) {
+                unpack(prev, *it, upMiddle[ws.parentArc[0][*it]], path);
+                prev = *it;
+            }
+            for (int v = meet; v != t; v = ws.parentNode[1][v]) {
+                int next = ws.parentNode[1][v];
+                unpack(v, next, upMiddle[ws.parentArc[1][v]], path);
+            }
+        }
+        if (distance != nullptr) {
+            *distance = best;
+        }
+        ws.clear();
+        return path;
+    }
+
+    // Bucket-based many-to-many table. An upward search from every target
+    // leaves (target, distance) entries in the buckets of the nodes it
+    // reaches; an upward search from every source then scans those buckets.
+    // Negative indices (unknown nodes) give unreachable rows/columns.
+    DistanceMatrix distanceTable(const vector<int>& sources, const vector<int>& targets,
+                                 ThreadPool* pool = nullptr) const {
+        vector<vector<BucketEntry>> reached(targets.size());
+        forEachIndex(pool, targets.size(), [&](int, int j) {
+            if (targets[j] < 0) return;
+            upwardSearch(targets[j], [&](int node, int d) {
+                reached[j].push_back({node, j, d});
+            });
+        });
+
+        vector<BucketEntry> buckets;
+        for (const vector<BucketEntry>& entries : reached) {
+            buckets.insert(buckets.end(), entries.begin(), entries.end());
+        }
+        reached.clear();
+        sort(buckets.begin(), buckets.end(),
+             [](const BucketEntry& a, const BucketEntry& b) { return a.node < b.node; });
+
+        DistanceMatrix table(sources.size(), targets.size());
+        forEachIndex(pool, sources.size(), [&](int, int i) {
+            DistanceMatrix::Value* row = table[i];
+            if (sources[i] < 0) return;
+            upwardSearch(sources[i], [&](int node, int d) {
+                auto it = lower_bound(buckets.begin(), buckets.end(), node,
+                                      [](const BucketEntry& entry, int n) { return entry.node < n; });
+                for (; it != buckets.end() && it->node == node; ++it) {
+                    row[it->target] = min<DistanceMatrix::Value>(row[it->target], addDistances(d, it->dist));
+                }
+            });
+        });
+        return table;
+    }
+
+private:
+    static constexpr char kMagic[8] = {'V', 'R', 'P', 'C', 'H', '0', '0', '1'};
+
+    struct CHEdge {
+        int to;
+        int weight;
+        int middle;
+    };
+
+    struct Shortcut {
+        int from;
+        int to;
+        int weight;
+    };
+
+    struct BucketEntry {
+        int node;
+        int target;
+        int dist;
+    };
+
+    // Bounded Dijkstra used during preprocessing to look for witness paths
+    struct WitnessSearch {
+        vector<int> dist;
+        vector<char> isTarget;
+        vector<int> touched;
+        vector<pair<int, int>> heap;
+
+        explicit WitnessSearch(int n) : dist(n, INT_MAX), isTarget(n, 0) {}
+    };
+
+    // Per-thread state of the bidirectional query; only touched entries are
+    // reset afterwards, so a query costs nothing proportional to the graph
+    struct QueryWorkspace {
+        vector<int> dist[2];
+        vector<int> parentNode[2];
+        vector<int> parentArc[2];
+        vector<pair<int, int>> heap[2];
+        vector<int> touched;
+
+        void settle(int side, int node, int d, int arc) {
+            if (dist[0][node] == INT_MAX && dist[1][node] == INT_MAX) {
+                touched.push_back(node);
+            }
+            dist[side][node] = d;
+            parentArc[side][node] = arc;
+            heap[side].push_back({d, node});
+            push_heap(heap[side].begin(), heap[side].end(), greater<pair<int, int>>());
+        }
+
+        void clear() {
+            for (int node : touched) {
+                dist[0][node] = dist[1][node] = INT_MAX;
+            }
+            touched.clear();
+            heap[0].clear();
+            heap[1].clear();
+        }
+    };
+
+    static QueryWorkspace& queryWorkspace(int n) {
+        thread_local QueryWorkspace ws;
+        if ((int)ws.dist[0].size() != n) {
+            for (int d = 0; d < 2; d++) {
+                ws.dist[d].assign(n, INT_MAX);
+                ws.parentNode[d].assign(n, -1);
+                ws.parentArc[d].assign(n, -1);
+            }
+        }
+        return ws;
+    }
+
+    // Stall-on-demand: the graph is undirected, so the upward arcs of node are
+    // also the arcs into it from higher nodes. If one of them reaches node more
+    // cheaply, nothing settled from here can be on a shortest path.
+    bool stalled(const vector<int>& dist, int node, int nodeDist) const {
+        for (int e = upOffsets[node]; e < upOffsets[node + 1]; e++) {
+            int higher = dist[upTargets[e]];
+            if (higher != INT_MAX && addDistances(higher, upWeights[e]) < nodeDist) return true;
+        }
+        return false;
+    }
+
+    // Exhaustive upward search from source; visit(node, dist) is called for
+    // every settled node that is not stalled
+    template <typename Visit>
+    void upwardSearch(int source, Visit visit) const {
+        QueryWorkspace& ws = queryWorkspace(numNodes());
+        vector<int>& dist = ws.dist[0];
+        vector<pair<int, int>>& heap = ws.heap[0];
+        ws.settle(0, source, 0, -1);
+        while (!heap.empty()) {
+            pop_heap(heap.begin(), heap.end(), greater<pair<int, int>>());
+            int nodeDist = heap.back().first;
+            int node = heap.back().second;
+            heap.pop_back();
+            if (nodeDist > dist[node] || stalled(dist, node, nodeDist)) continue;
+
+            visit(node, nodeDist);
+            for (int e = upOffsets[node]; e < upOffsets[node + 1]; e++) {
+                int nextDist = addDistances(nodeDist, upWeights[e]);
+                if (nextDist < dist[upTargets[e]]) {
+                    ws.settle(0, upTargets[e], nextDist, e);
+                }
+            }
+        }
+        ws.clear();
+    }
+
+    // Sum of two distances (shortcut weights included), done wide and capped
+    // just below INT_MAX, the unreachable marker: a route too long for an
+    // int stays a very long one instead of wrapping to a short one
+    static int addDistances(int a, int b) {
+        return (int)min<int64_t>((int64_t)a + b, INT_MAX - 1);
+    }
+
+    static void addOrImprove(vector<CHEdge>& edges, const CHEdge& edge) {
+        for (CHEdge& existing : edges) {
+            if (existing.to == edge.to) {
+                if (edge.weight < existing.weight) existing = edge;
+                return;
+            }
+        }
+        edges.push_back(edge);
+    }
+
+    // Shortcuts needed to contract v: for every pair of remaining neighbours
+    // (u, w), one is needed unless a path avoiding v is no longer than u-v-w
+    static void findShortcuts(int v, const vector<vector<CHEdge>>& adj, WitnessSearch& ws, vector<Shortcut>& out) {
+        const int kSettleLimit = 500;
+        out.clear();
+        const vector<CHEdge>& neighbors = adj[v];
+        int maxWeight = 0;
+        for (const CHEdge& edge : neighbors) {
+            maxWeight = max(maxWeight, edge.weight);
+        }
+
+        for (size_t i = 0; i + 1 < neighbors.size(); i++) {
+            int u = neighbors[i].to;
+            int limit = addDistances(neighbors[i].weight, maxWeight);
+            for (size_t j = i + 1; j < neighbors.size(); j++) {
+                ws.isTarget[neighbors[j].to] = 1;
+            }
+            int remaining = neighbors.size() - i - 1;
+
+            ws.dist[u] = 0;
+            ws.touched.push_back(u);
+            ws.heap.push_back({0, u});
+            int settled = 0;
+            while (!ws.heap.empty() && settled < kSettleLimit && remaining > 0) {
+                pop_heap(ws.heap.begin(), ws.heap.end(), greater<pair<int, int>>());
+                int nodeDist = ws.heap.back().first;
+                int node = ws.heap.back().second;
+                ws.heap.pop_back();
+                if (nodeDist > ws.dist[node]) continue;
+                if (nodeDist > limit) break;
+                settled++;
+                if (ws.isTarget[node]) {
+                    ws.isTarget[node] = 0;
+                    remaining--;
+                }
+                for (const CHEdge& edge : adj[node]) {
+                    if (edge.to == v) continue;
+                    int d = addDistances(nodeDist, edge.weight);
+                    if (d < ws.dist[edge.to]) {
+                        if (ws.dist[edge.to] == INT_MAX) ws.touched.push_back(edge.to);
+                        ws.dist[edge.to] = d;
+                        ws.heap.push_back({d, edge.to});
+                        push_heap(ws.heap.begin(), ws.heap.end(), greater<pair<int, int>>());
+                    }
+                }
+            }
+
+            for (size_t j = i + 1; j < neighbors.size(); j++) {
+                int via = addDistances(neighbors[i].weight, neighbors[j].weight);
+                if (ws.dist[neighbors[j].to] > via) {
+                    out.push_back({u, neighbors[j].to, via});
+                }
+                ws.isTarget[neighbors[j].to] = 0;
+            }
+
+            for (int node : ws.touched) {
+                ws.dist[node] = INT_MAX;
+            }
+            ws.touched.clear();
+            ws.heap.clear();
+        }
+    }
+
+    // Middle node of the hierarchy edge between a and b. The edge is stored
+    // at whichever endpoint was contracted first.
+    int middleOf(int a, int b) const {
+        int low = rank[a] < rank[b] ? a : b;
+        int high = low == a ? b : a;
+        for (int e = upOffsets[low]; e < upOffsets[low + 1]; e++) {
+            if (upTargets[e] == high) return upMiddle[e];
+        }
+        return -1;
+    }
+
+    // Append the original nodes of the edge from -> to, excluding from
+    void unpack(int from, int to, int middle, vector<int>& path) const {
+        if (middle < 0) {
+            path.push_back(to);
+            return;
+        }
+        unpack(from, middle, middleOf(from, middle), path);
+        unpack(middle, to, middleOf(middle, to), path);
+    }
+
+    template <typename T>
+    static void writeArray(ofstream& out, const vector<T>& values) {
+        out.write((const char*)values.data(), values.size() * sizeof(T));
+    }
+
+    template <typename T>
+    static bool readArray(ifstream& in, vector<T>& values, size_t count) {
+        values.resize(count);
+        return (bool)in.read((char*)values.data(), count * sizeof(T));
+    }
+};
+
+// Customizable contraction hierarchy (CCH) for graphs whose weights change
+// while the topology stays put, e.g. live traffic. Preprocessing works in two
+// phases:
+//   build()      metric-independent: a nested-dissection order (BFS level
+//                separators) and the chordal supergraph obtained by joining
+//                the higher neighbours of every node. Done once per topology.
+//   customize()  applies a set of weights: arcs are settled level by level
+//                of the elimination tree through their lower triangles. Nodes
+//                of one level touch disjoint arcs, so a level runs in parallel.
+// Queries walk the elimination tree upwards from both ends; there is no
+// priority queue. Node numbers outside are CSRGraph dense indices, inside the
+// arrays are in rank order.
+class CustomizableHierarchy {
+public:
+    int numNodes() const { return topology ? topology->order.size() : 0; }
+    int numArcs() const { return topology ? topology->upTargets.size() : 0; }
+    int numLevels() const { return topology ? (int)topology->levelOffsets.size() - 1 : 0; }
+
+    // Order the nodes and build the supergraph for g's topology. The weights
+    // are left unset until customize().
+    void build(const CSRGraph& g) {
+        shared_ptr<Topology> t = make_shared<Topology>();
+        int n = g.numNodes();
+        dissect(g, t->order);
+        t->rank.assign(n, 0);
+        for (int r = 0; r < n; r++) {
+            t->rank[t->order[r]] = r;
+        }
+
+        // Eliminate in rank order: a node's higher neighbours become a clique,
+        // which is passed on to the lowest of them (its elimination parent)
+        vector<vector<int>> pending(n);
+        t->upOffsets.assign(1, 0);
+        for (int r = 0; r < n; r++) {
+            vector<int>& up = pending[r];
+            int v = t->order[r];
+            for (int e = g.offsets[v]; e < g.offsets[v + 1]; e++) {
+                if (t->rank[g.targets[e]] > r) up.push_back(t->rank[g.targets[e]]);
+            }
+            sort(up.begin(), up.end());
+            up.erase(unique(up.begin(), up.end()), up.end());
+            t->upTargets.insert(t->upTargets.end(), up.begin(), up.end());
+            t->upOffsets.push_back(t->upTargets.size());
+            if (up.size() > 1) pending[up[0]].insert(pending[up[0]].end(), up.begin() + 1, up.end());
+            vector<int>().swap(up);
+        }
+
+        // The same arcs seen from their higher end, tails ascending
+        int m = t->upTargets.size();
+        t->downOffsets.assign(n + 1, 0);
+        for (int a = 0; a < m; a++) {
+            t->downOffsets[t->upTargets[a] + 1]++;
+        }
+        for (int r = 0; r < n; r++) {
+            t->downOffsets[r + 1] += t->downOffsets[r];
+        }
+        t->downTails.resize(m);
+        t->downArcs.resize(m);
+        vector<int> fill(t->downOffsets.begin(), t->downOffsets.end() - 1);
+        for (int r = 0; r < n; r++) {
+            for (int a = t->upOffsets[r]; a < t->upOffsets[r + 1]; a++) {
+                int slot = fill[t->upTargets[a]]++;
+                t->downTails[slot] = r;
+                t->downArcs[slot] = a;
+            }
+        }
+
+        // Supergraph arc carrying each input arc that points upwards
+        t->inputArc.assign(g.targets.size(), -1);
+        for (int v = 0; v < n; v++) {
+            int r = t->rank[v];
+            for (int e = g.offsets[v]; e < g.offsets[v + 1]; e++) {
+                if (t->rank[g.targets[e]] > r) t->inputArc[e] = t->findArc(r, t->rank[g.targets[e]]);
+            }
+        }
+
+        // Level = longest chain of lower neighbours below a node
+        vector<int> level(n, 0);
+        int numLevels = n > 0 ? 1 : 0;
+        for (int r = 0; r < n; r++) {
+            for (int k = t->downOffsets[r]; k < t->downOffsets[r + 1]; k++) {
+                level[r] = max(level[r], level[t->downTails[k]] + 1);
+            }
+            numLevels = max(numLevels, level[r] + 1);
+        }
+        t->levelOffsets.assign(numLevels + 1, 0);
+        for (int r = 0; r < n; r++) {
+            t->levelOffsets[level[r] + 1]++;
+        }
+        for (int l = 0; l < numLevels; l++) {
+            t->levelOffsets[l + 1] += t->levelOffsets[l];
+        }
+        t->levelRanks.resize(n);
+        fill.assign(t->levelOffsets.begin(), t->levelOffsets.end() - 1);
+        for (int r = 0; r < n; r++) {
+            t->levelRanks[fill[level[r]]++] = r;
+        }
+
+        topology = t;
+        weights.clear();
+        middle.clear();
+    }
+
+    // Set the arc weights from g, which must have the topology build() saw
+    void customize(const CSRGraph& g, ThreadPool* pool) {
+        const Topology& t = *topology;
+        weights.assign(t.upTargets.size(), INT_MAX);
+        middle.assign(t.upTargets.size(), -1);
+        for (int l = 0; l < numLevels(); l++) {
+            int begin = t.levelOffsets[l];
+            int count = t.levelOffsets[l + 1] - begin;
+            auto settle = [&](int, int i) { customizeNode(g, t.levelRanks[begin + i]); };
+            if (count >= kParallelLevel) {
+                forEachIndex(pool, count, settle);
+            } else {
+                for (int i = 0; i < count; i++) settle(0, i);
+            }
+        }
+    }
+
+    // Copy sharing this hierarchy's topology, customized for g's weights
+    shared_ptr<const CustomizableHierarchy> customized(const CSRGraph& g, ThreadPool* pool) const {
+        shared_ptr<CustomizableHierarchy> next = make_shared<CustomizableHierarchy>();
+        next->topology = topology;
+        next->customize(g, pool);
+        return next;
+    }
+
+    // Dense node path from s to t (empty if unreachable)
+    vector<int> query(int s, int t) const {
+        vector<int> path;
+        if (s == t) {
+            path.push_back(s);
+            return path;
+        }
+        const Topology& top = *topology;
+        QueryWorkspace& ws = queryWorkspace(numNodes());
+
+        // Upward sweep along the elimination tree; every arc out of a node
+        // leads to one of its ancestors, so the chain is all a side touches
+        const int ends[2] = {top.rank[s], top.rank[t]};
+        VRP_STATS(SearchCounters counters);
+        for (int side = 0; side < 2; side++) {
+            vector<int>& dist = ws.dist[side];
+            dist[ends[side]] = 0;
+            for (int r = ends[side]; r != -1; r = top.parentOf(r)) {
+                ws.chain[side].push_back(r);
+                if (dist[r] == INT_MAX) continue;
+                VRP_STATS(counters.settled++);
+                VRP_STATS(counters.relaxed += top.upOffsets[r + 1] - top.upOffsets[r]);
+                for (int a = top.upOffsets[r]; a < top.upOffsets[r + 1]; a++) {
+                    if (weights[a] == INT_MAX) continue;
+                    long long next = (long long)dist[r] + weights[a];
+                    int head = top.upTargets[a];
+                    if (next < dist[head]) {
+                        dist[head] = (int)next;
+                        ws.via[side][head] = r;
+                    }
+                }
+            }
+        }
+
+        VRP_STATS(recordSearch(counters));
+
+        long long best = LLONG_MAX;
+        int meet = -1;
+        for (int r : ws.chain[0]) {
+            if (ws.dist[0][r] != INT_MAX && ws.dist[1][r] != INT_MAX &&
+                (long long)ws.dist[0][r] + ws.dist[1][r] < best) {
+                best = (long long)ws.dist[0][r] + ws.dist[1][r];
+                meet = r;
+            }
+        }
+
+        if (meet >= 0) {
+            vector<int> up;  // meet back down to s, in rank order
+            for (int r = meet; r != -1; r = ws.via[0][r]) up.push_back(r);
+            path.push_back(s);
+            for (size_t k = up.size() - 1; k > 0; k--) unpack(up[k], up[k - 1], path);
+            for (int r = meet; ws.via[1][r] != -1; r = ws.via[1][r]) unpack(r, ws.via[1][r], path);
+        }
+
+        for (int side = 0; side < 2; side++) {
+            for (int r : ws.chain[side]) {
+                ws.dist[side][r] = INT_MAX;
+                ws.via[side][r] = -1;
+            }
+            ws.chain[side].clear();
+        }
+        return path;
+    }
+
+private:
+    static constexpr int kLeafCell = 8;         // Cells this small are not dissected further
+    static constexpr int kParallelLevel = 256;  // Smaller levels are customized inline
+
+    // Everything that depends only on the topology, shared by every
+    // customization of it
+    struct Topology {
+        vector<int> order;         // rank -> dense node
+        vector<int> rank;          // dense node -> rank
+        vector<int> upOffsets;     // arcs of rank r are [upOffsets[r], upOffsets[r + 1]), heads ascending
+        vector<int> upTargets;     // head rank of each arc
+        vector<int> downOffsets;   // arcs into rank r are [downOffsets[r], downOffsets[r + 1])
+        vector<int> downTails;     // tail rank of each such arc, ascending
+        vector<int> downArcs;      // its index in upTargets
+        vector<int> inputArc;      // CSR arc -> supergraph arc carrying it, -1 if it points down
+        vector<int> levelOffsets;  // ranks of level l are levelRanks[levelOffsets[l] .. levelOffsets[l + 1])
+        vector<int> levelRanks;
+
+        // Elimination tree parent: the lowest higher neighbour, -1 at a root
+        int parentOf(int r) const {
+            return upOffsets[r] == upOffsets[r + 1] ? -1 : upTargets[upOffsets[r]];
+        }
+
+        int findArc(int low, int high) const {
+            const int* first = upTargets.data() + upOffsets[low];
+            const int* last = upTargets.data() + upOffsets[low + 1];
+            const int* it = lower_bound(first, last, high);
+            return it != last && *it == high ? it - upTargets.data() : -1;
+        }
+    };
+
+    struct QueryWorkspace {
+        vector<int> dist[2];
+        vector<int> via[2];    // Rank the best arc into a node came from
+        vector<int> chain[2];  // Ranks visited by each side
+    };
+
+    static QueryWorkspace& queryWorkspace(int n) {
+        thread_local QueryWorkspace ws;
+        if ((int)ws.dist[0].size() != n) {
+            for (int side = 0; side < 2; side++) {
+                ws.dist[side].assign(n, INT_MAX);
+                ws.via[side].assign(n, -1);
+            }
+        }
+        return ws;
+    }
+
+    // Input weight of every arc out of rank r, then the cheapest way around
+    // through each lower triangle. Only reads arcs of lower levels.
+    void customizeNode(const CSRGraph& g, int r) {
+        const Topology& t = *topology;
+        int v = t.order[r];
+        for (int e = g.offsets[v]; e < g.offsets[v + 1]; e++) {
+            int a = t.inputArc[e];
+            if (a >= 0 && g.weights[e] < weights[a]) weights[a] = g.weights[e];
+        }
+
+        // Arc index of each head of r, so a triangle's third arc is one lookup
+        thread_local vector<int> arcTo;
+        if (arcTo.size() < t.order.size()) arcTo.resize(t.order.size());
+        for (int a = t.upOffsets[r]; a < t.upOffsets[r + 1]; a++) {
+            arcTo[t.upTargets[a]] = a;
+        }
+        // Triangles k < r < x: k's higher neighbours form a clique, so every
+        // head of k above r is also a head of r
+        for (int d = t.downOffsets[r]; d < t.downOffsets[r + 1]; d++) {
+            int toR = t.downArcs[d];
+            if (weights[toR] == INT_MAX) continue;
+            for (int b = toR + 1; b < t.upOffsets[t.downTails[d] + 1]; b++) {
+                if (weights[b] == INT_MAX) continue;
+                long long around = (long long)weights[toR] + weights[b];
+                int a = arcTo[t.upTargets[b]];
+                if (around < weights[a]) {
+                    weights[a] = around;
+                    middle[a] = t.downTails[d];
+                }
+            }
+        }
+    }
+
+    // Append the dense nodes of the arc from -> to (ranks), excluding from
+    void unpack(int from, int to, vector<int>& path) const {
+        const Topology& t = *topology;
+        int a = t.findArc(min(from, to), max(from, to));
+        if (middle[a] < 0) {
+            path.push_back(t.order[to]);
+            return;
+        }
+        unpack(from, middle[a], path);
+        unpack(middle[a], to, path);
+    }
+
+    // Nested dissection: split each cell by the middle level of a BFS from a
+    // peripheral node, give the separator the highest ranks of the cell and
+    // recurse into the two sides. Fills order (rank -> node).
+    static void dissect(const CSRGraph& g, vector<int>& order) {
+        int n = g.numNodes();
+        order.assign(n, -1);
+        vector<int> cellOf(n, 0);
+        vector<int> level(n, -1);
+        vector<int> bfs;
+        struct Cell {
+            vector<int> nodes;
+            int firstRank;
+        };
+        vector<Cell> cells;
+        cells.push_back({vector<int>(n), 0});
+        for (int v = 0; v < n; v++) cells[0].nodes[v] = v;
+        int nextCell = 0;
+
+        while (!cells.empty()) {
+            Cell cell = move(cells.back());
+            cells.pop_back();
+            vector<int>& nodes = cell.nodes;
+            int id = ++nextCell;
+            for (int v : nodes) cellOf[v] = id;
+            auto place = [&](const vector<int>& part, int firstRank) {
+                for (size_t k = 0; k < part.size(); k++) order[firstRank + k] = part[k];
+            };
+            if (nodes.size() <= (size_t)kLeafCell) {
+                place(nodes, cell.firstRank);
+                continue;
+            }
+
+            // Second BFS starts where the first one ended, near the periphery
+            int root = nodes[0];
+            for (int pass = 0; pass < 2; pass++) {
+                if (pass > 0) {
+                    for (int v : bfs) level[v] = -1;
+                }
+                bfs.clear();
+                bfs.push_back(root);
+                level[root] = 0;
+                for (size_t k = 0; k < bfs.size(); k++) {
+                    int v = bfs[k];
+                    for (int e = g.offsets[v]; e < g.offsets[v + 1]; e++) {
+                        int next = g.targets[e];
+                        if (cellOf[next] == id && level[next] < 0) {
+                            level[next] = level[v] + 1;
+                            bfs.push_back(next);
+                        }
+                    }
+                }
+                root = bfs.back();
+            }
+
+            vector<int> low, high, separator;
+            if (bfs.size() < nodes.size()) {
+                // Disconnected cell: split off the reached part, no separator
+                for (int v : nodes) (level[v] >= 0 ? low : high).push_back(v);
+            } else {
+                int maxLevel = level[bfs.back()];
+                if (maxLevel < 2) {
+                    // Too dense to separate by levels; keep as one block
+                    for (int v : bfs) level[v] = -1;
+                    place(nodes, cell.firstRank);
+                    continue;
+                }
+                // Thinnest level that leaves about a third on either side
+                vector<int> levelStart(maxLevel + 2, 0);
+                for (int v : bfs) levelStart[level[v] + 1]++;
+                for (int l = 0; l <= maxLevel; l++) levelStart[l + 1] += levelStart[l];
+                auto levelSize = [&](int l) { return levelStart[l + 1] - levelStart[l]; };
+                int cut = -1;
+                for (int l = max(level[bfs[bfs.size() / 3]], 1); l <= min(level[bfs[bfs.size() * 2 / 3]], maxLevel - 1); l++) {
+                    if (cut < 0 || levelSize(l) < levelSize(cut)) cut = l;
+                }
+                if (cut < 0) cut = min(max(level[bfs[bfs.size() / 2]], 1), maxLevel - 1);
+                for (int v : bfs) {
+                    if (level[v] < cut) {
+                        low.push_back(v);
+                    } else if (level[v] > cut) {
+                        high.push_back(v);
+                    } else {
+                        bool boundary = false;
+                        for (int e = g.offsets[v]; e < g.offsets[v + 1] && !boundary; e++) {
+                            boundary = cellOf[g.targets[e]] == id && level[g.targets[e]] == cut + 1;
+                        }
+                        (boundary ? separator : low).push_back(v);
+                    }
+                }
+            }
+            for (int v : bfs) level[v] = -1;
+            place(separator, cell.firstRank + low.size() + high.size());
+            int highRank = cell.firstRank + low.size();
+            cells.push_back({move(low), cell.firstRank});
+            cells.push_back({move(high), highRank});
+        }
+    }
+
+    shared_ptr<const Topology> topology;
+    vector<int> weights;  // per supergraph arc, INT_MAX = no path through it
+    vector<int> middle;   // lower node the arc's weight goes through, -1 = input edge
+};
+
+// Landmark distances for ALT queries (A*, landmarks, triangle inequality).
+// For each landmark L the exact distance d(L, v) to every node is stored; on
+// the undirected graph |d(L, t) - d(L, v)| is then a lower bound on d(v, t).
+// Landmarks are picked farthest-first, which puts them on the periphery where
+// the bounds are tightest. Preprocessing is one Dijkstra per landmark, so
+// unlike a CH it is cheap to redo after weight changes; while weights only
+// rise above the ones it was built on (congestion) it need not be redone at
+// all. The arrays live in vectors built here or directly in a mapped graph
+// file.
+class LandmarkIndex {
+public:
+    int numLandmarks() const { return landmarks.size(); }
+    ArrayView<int> landmarkNodes() const { return landmarks; }
+    ArrayView<int> distanceTable() const { return distances; }
+
+    void build(const CSRGraph& g, int count) {
+        int n = g.numNodes();
+        shared_ptr<pair<vector<int>, vector<int>>> owned = make_shared<pair<vector<int>, vector<int>>>();
+        vector<int>& chosen = owned->first;
+        vector<int>& table = owned->second;
+        count = min(count, n);
+
+        // Landmarks only help inside the component they sit in, so they all go
+        // into the largest one; queries elsewhere fall back to a plain
+        // bidirectional search. Start from the node farthest from some node of
+        // it, then keep adding the node farthest from all landmarks so far.
+        vector<int> dist;
+        vector<int> nearest;
+        if (n > 0) {
+            shortestDistances(g, largestComponentNode(g), dist);
+            nearest = dist;
+        }
+        for (int k = 0; k < count; k++) {
+            int next = -1;
+            for (int v = 0; v < n; v++) {
+                if (nearest[v] != INT_MAX && (next < 0 || nearest[v] > nearest[next])) next = v;
+            }
+            if (k > 0 && nearest[next] == 0) break; // Every node is a landmark
+            shortestDistances(g, next, dist);
+            chosen.push_back(next);
+            table.insert(table.end(), dist.begin(), dist.end());
+            for (int v = 0; v < n; v++) {
+                nearest[v] = k == 0 ? dist[v] : min(nearest[v], dist[v]);
+            }
+        }
+        assign(ArrayView<int>(chosen), ArrayView<int>(table), g.weights,
+               make_shared<pair<shared_ptr<const void>, shared_ptr<const void>>>(owned, g.storage));
+    }
+
+    // Use landmark arrays owned elsewhere (e.g. a mapped file); distances is
+    // landmark-major, numNodes entries per landmark, computed for the arc
+    // weights in weights
+    void assign(ArrayView<int> nodes, ArrayView<int> table, ArrayView<int> weights, shared_ptr<const void> owner) {
+        landmarks = nodes;
+        distances = table;
+        numNodes = nodes.size() == 0 ? 0 : table.size() / nodes.size();
+        baseWeights = weights;
+        storage = move(owner);
+    }
+
+    // Whether the distances were computed for exactly g's weights
+    bool builtFor(const CSRGraph& g) const {
+        return baseWeights.begin() == g.weights.begin();
+    }
+
+    // Whether the bounds still hold for g after the given arcs changed: they
+    // do as long as no arc became cheaper than when the landmarks were built
+    bool admissibleAfter(const CSRGraph& g, const vector<int>& changedArcs) const {
+        for (int e : changedArcs) {
+            if (g.weights[e] < baseWeights[e]) return false;
+        }
+        return true;
+    }
+
+    // Bidirectional A* from s to t with the average of the forward and
+    // backward landmark potentials, which keeps both searches consistent.
+    // Returns the dense node path (empty if unreachable).
+    vector<int> query(const CSRGraph& g, int s, int t) const {
+        vector<int> path;
+        if (s == t) {
+            path.push_back(s);
+            return path;
+        }
+        int n = g.numNodes();
+        QueryWorkspace& ws = queryWorkspace(n);
+
+        // Only the landmarks that bound d(s, t) best are consulted per node
+        vector<pair<int, int>> ranked;
+        for (int k = 0; k < numLandmarks(); k++) {
+            int ds = at(k, s), dt = at(k, t);
+            if (ds != INT_MAX && dt != INT_MAX) ranked.push_back({-abs(dt - ds), k});
+        }
+        sort(ranked.begin(), ranked.end());
+        vector<int>& active = ws.active;
+        active.clear();
+        for (size_t k = 0; k < ranked.size() && k < (size_t)kActive; k++) {
+            active.push_back(ranked[k].second);
+        }
+        const int ends[2] = {s, t};
+        auto potential = [&](int v) {
+            // pi_t(v) - pi_s(v); forward keys add it, backward keys subtract
+            if (ws.potential[v] == LLONG_MIN) {
+                long long towardT = 0, fromS = 0;
+                for (int k : active) {
+                    int dv = at(k, v);
+                    if (dv == INT_MAX) continue;
+                    towardT = max(towardT, (long long)abs(at(k, t) - dv));
+                    fromS = max(fromS, (long long)abs(at(k, s) - dv));
+                }
+                ws.potential[v] = towardT - fromS;
+            }
+            return ws.potential[v];
+        };
+        // Keys are doubled so the averaged potential stays integral
+        auto key = [&](int side, int v) {
+            return 2LL * ws.dist[side][v] + (side == 0 ? potential(v) : -potential(v));
+        };
+
+        long long best = LLONG_MAX;  // Shortest s-t distance found so far
+        int meet = -1;
+        for (int side = 0; side < 2; side++) {
+            ws.reach(side, ends[side], 0, -1);
+            ws.heap[side].push_back({key(side, ends[side]), ends[side]});
+        }
+        greater<pair<long long, int>> later;
+        VRP_STATS(SearchCounters counters);
+        while (!ws.heap[0].empty() && !ws.heap[1].empty()) {
+            if (best != LLONG_MAX && ws.heap[0].front().first + ws.heap[1].front().first >= 2 * best) break;
+            int side = ws.heap[0].front().first <= ws.heap[1].front().first ? 0 : 1;
+            vector<pair<long long, int>>& heap = ws.heap[side];
+            pop_heap(heap.begin(), heap.end(), later);
+            long long nodeKey = heap.back().first;
+            int node = heap.back().second;
+            heap.pop_back();
+            VRP_STATS(counters.pops++);
+            if (nodeKey > key(side, node)) {
+                VRP_STATS(counters.stalePops++);
+                continue; // Stale entry
+            }
+            VRP_STATS(counters.settled++);
+            VRP_STATS(counters.relaxed += g.offsets[node + 1] - g.offsets[node]);
+
+            vector<int>& dist = ws.dist[side];
+            const vector<int>& other = ws.dist[1 - side];
+            if (other[node] != INT_MAX && (long long)dist[node] + other[node] < best) {
+                best = (long long)dist[node] + other[node];
+                meet = node;
+            }
+            for (int e = g.offsets[node]; e < g.offsets[node + 1]; e++) {
+                int next = g.targets[e];
+                int nextDist = dist[node] + g.weights[e];
+                if (nextDist >= dist[next]) continue;
+                ws.reach(side, next, nextDist, node);
+                heap.push_back({key(side, next), next});
+                push_heap(heap.begin(), heap.end(), later);
+                VRP_STATS(counters.pushes++);
+                if (other[next] != INT_MAX && (long long)nextDist + other[next] < best) {
+                    best = (long long)nextDist + other[next];
+                    meet = next;
+                }
+            }
+        }
+
+        VRP_STATS(recordSearch(counters));
+
+        if (meet >= 0) {
+            for (int v = meet; v != -1; v = ws.parent[0][v]) path.push_back(v);
+            reverse(path.begin(), path.end());
+            for (int v = ws.parent[1][meet]; v != -1; v = ws.parent[1][v]) path.push_back(v);
+        }
+        ws.clear();
+        return path;
+    }
+
+private:
+    static constexpr int kActive = 4;  // Landmarks consulted per query
+
+    struct QueryWorkspace {
+        vector<int> dist[2];
+        vector<int> parent[2];
+        vector<long long> potential;  // LLONG_MIN = not computed yet
+        vector<pair<long long, int>> heap[2];
+        vector<int> touched;
+        vector<int> active;  // Landmarks used by the current query
+
+        void reach(int side, int node, int d, int from) {
+            if (dist[0][node] == INT_MAX && dist[1][node] == INT_MAX) {
+                touched.push_back(node);
+            }
+            dist[side][node] = d;
+            parent[side][node] = from;
+        }
+
+        void clear() {
+            for (int node : touched) {
+                dist[0][node] = dist[1][node] = INT_MAX;
+                parent[0][node] = parent[1][node] = -1;
+                potential[node] = LLONG_MIN;
+            }
+            touched.clear();
+            heap[0].clear();
+            heap[1].clear();
+        }
+    };
+
+    static QueryWorkspace& queryWorkspace(int n) {
+        thread_local QueryWorkspace ws;
+        if ((int)ws.potential.size() != n) {
+            for (int d = 0; d < 2; d++) {
+                ws.dist[d].assign(n, INT_MAX);
+                ws.parent[d].assign(n, -1);
+            }
+            ws.potential.assign(n, LLONG_MIN);
+        }
+        return ws;
+    }
+
+    int at(int landmark, int v) const { return distances[(size_t)landmark * numNodes + v]; }
+
+    // Some node of the largest connected component
+    static int largestComponentNode(const CSRGraph& g) {
+        int n = g.numNodes();
+        vector<char> seen(n, 0);
+        vector<int> stack;
+        int best = 0, bestSize = 0;
+        for (int root = 0; root < n; root++) {
+            if (seen[root]) continue;
+            int size = 0;
+            seen[root] = 1;
+            stack.push_back(root);
+            while (!stack.empty()) {
+                int node = stack.back();
+                stack.pop_back();
+                size++;
+                for (int e = g.offsets[node]; e < g.offsets[node + 1]; e++) {
+                    if (!seen[g.targets[e]]) {
+                        seen[g.targets[e]] = 1;
+                        stack.push_back(g.targets[e]);
+                    }
+                }
+            }
+            if (size > bestSize) {
+                best = root;
+                bestSize = size;
+            }
+        }
+        return best;
+    }
+
+    // Plain full Dijkstra from source, for preprocessing
+    static void shortestDistances(const CSRGraph& g, int source, vector<int>& dist) {
+        dist.assign(g.numNodes(), INT_MAX);
+        priority_queue<pair<int, int>, vector<pair<int, int>>, greater<pair<int, int>>> pq;
+        dist[source] = 0;
+        pq.push({0, source});
+        while (!pq.empty()) {
+            int nodeDist = pq.top().first;
+            int node = pq.top().second;
+            pq.pop();
+            if (nodeDist > dist[node]) continue;
+            for (int e = g.offsets[node]; e < g.offsets[node + 1]; e++) {
+                int next = g.targets[e];
+                if (nodeDist + g.weights[e] < dist[next]) {
+                    dist[next] = nodeDist + g.weights[e];
+                    pq.push({dist[next], next});
+                }
+            }
+        }
+    }
+
+    ArrayView<int> landmarks;  // Dense node index of each landmark
+    ArrayView<int> distances;  // distances[k * numNodes + v] = d(landmark k, v)
+    size_t numNodes = 0;
+    ArrayView<int> baseWeights;  // Arc weights the distances are exact for
+    shared_ptr<const void> storage;
+};
+
+// Piecewise-linear travel-time function over a periodic day: the travel time
+// of an edge, or of a whole route, by departure time. Points are (departure
+// time in [0, period), travel time) with ascending times; the function is
+// linear in between and wraps from the last point around to the first. No
+// points means unreachable. Used by the profile search, which computes one
+// function per target instead of one number per departure time.
+struct TravelTimeFunction {
+    double period = 86400;
+    vector<pair<double, double>> points;
+
+    static TravelTimeFunction constant(double period, double value) {
+        TravelTimeFunction f;
+        f.period = period;
+        f.points.push_back({0, value});
+        return f;
+    }
+
+    bool empty() const { return points.empty(); }
+
+    double at(double time) const {
+        if (points.size() == 1) return points[0].second;
+        time -= floor(time / period) * period;
+        size_t k = upper_bound(points.begin(), points.end(), make_pair(time, (double)INFINITY)) - points.begin();
+        pair<double, double> left = pointAt((long long)k - 1);
+        pair<double, double> right = pointAt(k);
+        if (right.first <= left.first) return left.second;
+        return left.second + (right.second - left.second) * (time - left.first) / (right.first - left.first);
+    }
+
+    double minimum() const {
+        double best = INFINITY;
+        for (const auto& p : points) best = min(best, p.second);
+        return best;
+    }
+
+    double maximum() const {
+        double worst = -INFINITY;
+        for (const auto& p : points) worst = max(worst, p.second);
+        return worst;
+    }
+
+    // Travel first along f, then along g: h(t) = f(t) + g(t + f(t)). The
+    // breakpoints of h are those of f plus the departure times at which the
+    // arrival t + f(t) (monotone for FIFO functions) hits a breakpoint of g.
+    static TravelTimeFunction link(const TravelTimeFunction& f, const TravelTimeFunction& g) {
+        TravelTimeFunction h;
+        h.period = f.period;
+        if (f.empty() || g.empty()) return h;
+        vector<double> times;
+        for (const auto& p : f.points) times.push_back(p.first);
+        if (g.points.size() > 1) {
+            // Walk f's pieces over one period, starting at time 0
+            vector<double> cuts(1, 0.0);
+            for (const auto& p : f.points) {
+                if (p.first > 0) cuts.push_back(p.first);
+            }
+            cuts.push_back(f.period);
+            for (size_t c = 0; c + 1 < cuts.size(); c++) {
+                double t1 = cuts[c], t2 = cuts[c + 1];
+                double a1 = t1 + f.at(t1), a2 = t2 + f.at(t2);
+                if (a2 <= a1) continue; // Constant arrival: no inner preimage
+                for (double base = floor(a1 / g.period) * g.period; base < a2; base += g.period) {
+                    for (const auto& p : g.points) {
+                        double s = base + p.first;
+                        if (s >= a1 && s < a2) times.push_back(t1 + (s - a1) * (t2 - t1) / (a2 - a1));
+                    }
+                }
+            }
+        }
+        sortTimes(times);
+        for (double t : times) {
+            double first = f.at(t);
+            h.points.push_back({t, first + g.at(t + first)});
+        }
+        h.simplify();
+        return h;
+    }
+
+    // Pointwise minimum of f and g. improved is set if g is below f anywhere.
+    static TravelTimeFunction merge(const TravelTimeFunction& f, const TravelTimeFunction& g, bool& improved) {
+        improved = false;
+        if (g.empty()) return f;
+        if (f.empty()) {
+            improved = true;
+            return g;
+        }
+        vector<double> times;
+        for (const auto& p : f.points) times.push_back(p.first);
+        for (const auto& p : g.points) times.push_back(p.first);
+        sortTimes(times);
+        // Both are linear between neighbouring times; add any crossing
+        size_t count = times.size();
+        for (size_t k = 0; k < count; k++) {
+            double t1 = times[k];
+            double t2 = k + 1 < count ? times[k + 1] : times[0] + f.period;
+            double d1 = f.at(t1) - g.at(t1), d2 = f.at(t2) - g.at(t2);
+            if ((d1 < 0 && d2 > 0) || (d1 > 0 && d2 < 0)) {
+                double t = t1 + (t2 - t1) * d1 / (d1 - d2);
+                times.push_back(t >= f.period ? t - f.period : t);
+            }
+        }
+        sortTimes(times);
+
+        TravelTimeFunction h;
+        h.period = f.period;
+        for (double t : times) {
+            double a = f.at(t), b = g.at(t);
+            if (b < a - kEpsilon) improved = true;
+            h.points.push_back({t, min(a, b)});
+        }
+        h.simplify();
+        return h;
+    }
+
+private:
+    static constexpr double kEpsilon = 1e-6;
+
+    // Point k of the periodic extension; k may be outside [0, size)
+    pair<double, double> pointAt(long long k) const {
+        long long n = points.size();
+        long long wraps = k >= 0 ? k / n : -((-k + n - 1) / n);
+        const pair<double, double>& p = points[k - wraps * n];
+        return {p.first + wraps * period, p.second};
+    }
+
+    // Sort breakpoint times, merging ones closer than kEpsilon
+    static void sortTimes(vector<double>& times) {
+        sort(times.begin(), times.end());
+        times.erase(unique(times.begin(), times.end(), [](double a, double b) { return b - a < kEpsilon; }), times.end());
+    }
+
+    // Drop points that lie on the line through their neighbours
+    void simplify() {
+        if (points.size() < 3) {
+            if (points.size() == 2 && fabs(points[0].second - points[1].second) < kEpsilon) points.pop_back();
+            return;
+        }
+        vector<pair<double, double>> kept;
+        long long n = points.size();
+        for (long long k = 0; k < n; k++) {
+            pair<double, double> left = pointAt(k - 1), p = points[k], right = pointAt(k + 1);
+            double expected = left.second + (right.second - left.second) * (p.first - left.first) / (right.first - left.first);
+            if (fabs(expected - p.second) > kEpsilon) kept.push_back(p);
+        }
+        if (kept.empty()) kept.push_back(points[0]); // Constant
+        points.swap(kept);
+    }
+};
+
+// Time-of-day travel times for the arcs of one CSRGraph. Distinct profiles
+// are stored once in a shared pool (most roads follow one of a few daily
+// patterns); arcs without a profile keep their static weight. Profiles must
+// be FIFO - leaving later never means arriving earlier, i.e. the travel time
+// drops by at most one unit per unit of time - which keeps time-dependent
+// Dijkstra exact. Times and travel times use the units of the edge weights.
+class TravelTimeProfiles {
+public:
+    explicit TravelTimeProfiles(int numArcs, int period = 86400) : periodLength(period), arcProfile(numArcs, -1) {}
+
+    int period() const { return periodLength; }
+    int numProfiles() const { return offsets.size() - 1; }
+
+    // Add a profile given as (time, travel time) points, times ascending in
+    // [0, period). Returns its id (an existing one for a repeated profile),
+    // or -1 if the points are not a valid FIFO profile.
+    int addProfile(const vector<pair<int, int>>& points) {
+        if (points.empty()) return -1;
+        for (size_t k = 0; k < points.size(); k++) {
+            const pair<int, int>& p = points[k];
+            const pair<int, int>& next = points[(k + 1) % points.size()];
+            long long span = (long long)next.first - p.first + (k + 1 == points.size() ? periodLength : 0);
+            if (p.first < 0 || p.first >= periodLength || p.second < 0) return -1;
+            if (k + 1 < points.size() && next.first <= p.first) return -1;
+            if (points.size() > 1 && (long long)next.second - p.second < -span) return -1; // Not FIFO
+        }
+        auto known = ids.find(points);
+        if (known != ids.end()) return known->second;
+        for (const pair<int, int>& p : points) {
+            times.push_back(p.first);
+            values.push_back(p.second);
+        }
+        offsets.push_back(times.size());
+        ids[points] = numProfiles() - 1;
+        return numProfiles() - 1;
+    }
+
+    void assign(int arc, int profile) { arcProfile[arc] = profile; }
+    int profileOf(int arc) const { return arcProfile[arc]; }
+
+    // Travel time of arc when entering it at time (any value; taken modulo
+    // the period). weight is the arc's static weight.
+    int travelTime(int arc, int weight, long long time) const {
+        int profile = arcProfile[arc];
+        if (profile < 0) return weight;
+        int first = offsets[profile], last = offsets[profile + 1];
+        if (last - first == 1) return values[first];
+        long long t = time % periodLength;
+        if (t < 0) t += periodLength;
+        int k = upper_bound(times.begin() + first, times.begin() + last, t) - times.begin();
+        // Neighbouring points, wrapping around the end of the day
+        long long leftTime, rightTime;
+        int leftValue, rightValue;
+        if (k == first) {
+            leftTime = times[last - 1] - periodLength;
+            leftValue = values[last - 1];
+        } else {
+            leftTime = times[k - 1];
+            leftValue = values[k - 1];
+        }
+        if (k == last) {
+            rightTime = times[first] + periodLength;
+            rightValue = values[first];
+        } else {
+            rightTime = times[k];
+            rightValue = values[k];
+        }
+        return (int)llround(leftValue + (double)(rightValue - leftValue) * (t - leftTime) / (rightTime - leftTime));
+    }
+
+    TravelTimeFunction function(int arc, int weight) const {
+        int profile = arcProfile[arc];
+        if (profile < 0) return TravelTimeFunction::constant(periodLength, weight);
+        TravelTimeFunction f;
+        f.period = periodLength;
+        for (int k = offsets[profile]; k < offsets[profile + 1]; k++) {
+            f.points.push_back({(double)times[k], (double)values[k]});
+        }
+        return f;
+    }
+
+private:
+    int periodLength;
+    vector<int> offsets = vector<int>(1, 0);  // points of profile p are [offsets[p], offsets[p + 1])
+    vector<int> times;
+    vector<int> values;
+    vector<int> arcProfile;  // profile id per arc, -1 = static weight
+    map<vector<pair<int, int>>, int> ids;
+};
+
+// Degrees in the 1e-7 fixed point of node positions; anything beyond
+// +-200 degrees is clamped there, which stays out of range
+static int fixedDegrees(double degrees) {
+    return (int)llround(max(-200.0, min(200.0, degrees)) * 1e7);
+}
+
+// Node positions plus a uniform grid over the edges, for snapping
+// coordinates onto the road network. Positions are (latitude, longitude)
+// pairs in 1e-7 degrees by dense node, latitude INT_MIN = unknown; like the
+// CSR arrays they live in a vector or directly in a mapped graph file. The
+// grid works in an equirectangular projection around the mean latitude,
+// accurate to well under a percent across a city or region. Cells hold
+// about two edges each and an edge is listed in every cell its segment
+// crosses, so a query scans rings of cells outwards from the point until no
+// unseen cell can hold anything nearer.
+class SpatialIndex {
+public:
+    // Nearest point on an edge; edge is -1 when no edge has both ends located
+    struct Snap {
+        int edge = -1;        // Arc from the lower to the higher dense index
+        int tail = -1;
+        int head = -1;
+        double fraction = 0;  // Position along the arc, 0 = tail, 1 = head
+        double distance = 0;  // Metres from the point to the edge
+    };
+
+    ArrayView<int> positions() const { return located; }
+    bool isLocated(int v) const { return located[2 * v] != INT_MIN; }
+
+    void build(const CSRGraph& g, ArrayView<int> latLon, shared_ptr<const void> owner) {
+        located = latLon;
+        baseTargets = g.targets;
+        storage = move(owner);
+        int n = g.numNodes();
+
+        double latitudeSum = 0;
+        int count = 0;
+        minLatitude = minLongitude = INT_MAX;
+        int maxLatitude = INT_MIN, maxLongitude = INT_MIN;
+        for (int v = 0; v < n; v++) {
+            if (!isLocated(v)) continue;
+            minLatitude = min(minLatitude, located[2 * v]);
+            maxLatitude = max(maxLatitude, located[2 * v]);
+            minLongitude = min(minLongitude, located[2 * v + 1]);
+            maxLongitude = max(maxLongitude, located[2 * v + 1]);
+            latitudeSum += located[2 * v];
+            count++;
+        }
+        tails.resize(g.targets.size());
+        long long items = 0;
+        for (int u = 0; u < n; u++) {
+            for (int e = g.offsets[u]; e < g.offsets[u + 1]; e++) {
+                tails[e] = u;
+                if (indexed(g, e)) items++;
+            }
+        }
+        if (items == 0) return;
+
+        const double kMetresPerUnit = 6371008.8 * 3.14159265358979323846 / 180 * 1e-7;
+        scaleY = kMetresPerUnit;
+        scaleX = kMetresPerUnit * cos(latitudeSum / count * 3.14159265358979323846 / 180 * 1e-7);
+        double width = (maxLongitude - (double)minLongitude) * scaleX;
+        double height = (maxLatitude - (double)minLatitude) * scaleY;
+        cellSize = max(1.0, sqrt(max(width * height, 1.0) / max(1.0, items / 2.0)));
+        // A long, thin extent would need far more cells than edges
+        while ((long long)(width / cellSize + 1) * (long long)(height / cellSize + 1) > 4 * items + 16) {
+            cellSize *= 1.5;
+        }
+        columns = (int)(width / cellSize) + 1;
+        rows = (int)(height / cellSize) + 1;
+
+        // Count, then fill, the edges of each cell
+        cellStart.assign((size_t)columns * rows + 1, 0);
+        for (size_t e = 0; e < tails.size(); e++) {
+            if (indexed(g, e)) forEachCell(g, e, [&](int cell) { cellStart[cell + 1]++; });
+        }
+        for (size_t c = 0; c + 1 < cellStart.size(); c++) {
+            cellStart[c + 1] += cellStart[c];
+        }
+        cellEdges.resize(cellStart.back());
+        vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+        for (size_t e = 0; e < tails.size(); e++) {
+            if (indexed(g, e)) forEachCell(g, e, [&](int cell) { cellEdges[fill[cell]++] = e; });
+        }
+    }
+
+    // Whether the index covers exactly g's arcs (weights may have changed)
+    bool builtFor(const CSRGraph& g) const {
+        return baseTargets.begin() == g.targets.begin();
+    }
+
+    // Nearest point on any located edge to (latitude, longitude) in degrees
+    Snap nearest(const CSRGraph& g, double latitude, double longitude) const {
+        Snap best;
+        if (columns == 0) return best;
+        best.distance = INFINITY;
+        double px = (longitude * 1e7 - minLongitude) * scaleX;
+        double py = (latitude * 1e7 - minLatitude) * scaleY;
+        int cx = column(px), cy = row(py);
+
+        auto scan = [&](int x, int y) {
+            int cell = y * columns + x;
+            for (int k = cellStart[cell]; k < cellStart[cell + 1]; k++) {
+                int e = cellEdges[k];
+                int u = tails[e], v = g.targets[e];
+                double ax = x0(u), ay = y0(u);
+                double dx = x0(v) - ax, dy = y0(v) - ay;
+                double length2 = dx * dx + dy * dy;
+                double t = length2 > 0 ? min(1.0, max(0.0, ((px - ax) * dx + (py - ay) * dy) / length2)) : 0;
+                double d = hypot(px - ax - t * dx, py - ay - t * dy);
+                if (d < best.distance || (d == best.distance && e < best.edge)) {
+                    best = {e, u, v, t, d};
+                }
+            }
+        };
+        for (int r = 0;; r++) {
+            for (int y = max(0, cy - r); y <= min(rows - 1, cy + r); y++) {
+                if (y == cy - r || y == cy + r) {
+                    for (int x = max(0, cx - r); x <= min(columns - 1, cx + r); x++) scan(x, y);
+                } else {
+                    if (cx - r >= 0) scan(cx - r, y);
+                    if (cx + r < columns) scan(cx + r, y);
+                }
+            }
+            // Cells beyond the (2r + 1)^2 block are at least reach away;
+            // sides at the border of the grid have nothing beyond them
+            double reach = INFINITY;
+            if (cx - r > 0) reach = min(reach, px - (cx - r) * cellSize);
+            if (cx + r < columns - 1) reach = min(reach, (cx + r + 1) * cellSize - px);
+            if (cy - r > 0) reach = min(reach, py - (cy - r) * cellSize);
+            if (cy + r < rows - 1) reach = min(reach, (cy + r + 1) * cellSize - py);
+            if (reach == INFINITY || best.distance <= reach) break;
+        }
+        return best;
+    }
+
+private:
+    // Each undirected edge once, from its lower dense index, if both ends
+    // are located
+    bool indexed(const CSRGraph& g, size_t e) const {
+        return tails[e] < g.targets[e] && isLocated(tails[e]) && isLocated(g.targets[e]);
+    }
+
+    double x0(int v) const { return (located[2 * v + 1] - (double)minLongitude) * scaleX; }
+    double y0(int v) const { return (located[2 * v] - (double)minLatitude) * scaleY; }
+    int column(double x) const { return (int)min((double)columns - 1, max(0.0, floor(x / cellSize))); }
+    int row(double y) const { return (int)min((double)rows - 1, max(0.0, floor(y / cellSize))); }
+
+    // Cells the segment of arc e passes through, column by column
+    template <typename Visit>
+    void forEachCell(const CSRGraph& g, size_t e, Visit visit) const {
+        double ax = x0(tails[e]), ay = y0(tails[e]);
+        double bx = x0(g.targets[e]), by = y0(g.targets[e]);
+        if (ax > bx) {
+            swap(ax, bx);
+            swap(ay, by);
+        }
+        for (int x = column(ax); x <= column(bx); x++) {
+            double ya = ay, yb = by;
+            if (bx > ax) {
+                double slope = (by - ay) / (bx - ax);
+                ya = ay + slope * (max(ax, x * cellSize) - ax);
+                yb = ay + slope * (min(bx, (x + 1) * cellSize) - ax);
+            }
+            for (int y = row(min(ya, yb)); y <= row(max(ya, yb)); y++) {
+                visit(y * columns + x);
+            }
+        }
+    }
+
+    ArrayView<int> located;
+    ArrayView<int> baseTargets;
+    shared_ptr<const void> storage;  // Owner of located; keeps baseTargets alive too
+    vector<int> tails;               // Tail of each arc
+    int minLatitude = 0;
+    int minLongitude = 0;
+    double scaleX = 0;               // Metres per 1e-7 degrees
+    double scaleY = 0;
+    double cellSize = 1;             // Metres
+    int columns = 0;
+    int rows = 0;
+    vector<int> cellStart;           // Edges of cell y * columns + x are [cellStart[c], cellStart[c + 1])
+    vector<int> cellEdges;
+};
+
+// Multilevel partitioning into cells of about equal size with few cut
+// edges, in the manner of METIS: recursive bisection, where each bisection
+// coarsens the graph by heavy-edge matching, splits the coarsest graph by
+// growing one side breadth-first, then projects the split back level by
+// level and moves boundary nodes by gain (a greedy Fiduccia-Mattheyses
+// pass) at each level. A coarse edge weighs as many original edges as it
+// stands for, so the cut that is kept small is the number of cut edges.
+class GraphPartitioner {
+public:
+    // Cell in [0, numCells) of every dense node of g; cells differ in size
+    // by a few percent at most (more for graphs much smaller than numCells)
+    static vector<int> partition(const CSRGraph& g, int numCells) {
+        int n = g.numNodes();
+        Level top;
+        top.nodeWeights.assign(n, 1);
+        top.targets.reserve(g.targets.size());
+        for (int u = 0; u < n; u++) {
+            for (int e = g.offsets[u]; e < g.offsets[u + 1]; e++) {
+                if (g.targets[e] != u) top.targets.push_back(g.targets[e]);
+            }
+            top.offsets.push_back(top.targets.size());
+        }
+        top.edgeWeights.assign(top.targets.size(), 1);
+        vector<int> ids(n);
+        for (int v = 0; v < n; v++) ids[v] = v;
+        vector<int> cellOf(n, 0);
+        mt19937 rng(12345); // Fixed seed: the same graph always gets the same cells
+        split(top, ids, 0, max(1, numCells), cellOf, rng);
+        return cellOf;
+    }
+
+private:
+    // One level of the coarsening; nodes and arcs carry weights
+    struct Level {
+        vector<int> offsets = vector<int>(1, 0);
+        vector<int> targets;
+        vector<int> edgeWeights;
+        vector<int> nodeWeights;
+
+        int numNodes() const { return nodeWeights.size(); }
+    };
+
+    static const int kCoarsest = 64;     // Nodes at which coarsening stops
+    static const int kGrowAttempts = 4;  // Initial bisections tried on the coarsest graph
+    static const int kRefinePasses = 8;
+
+    // Cells [firstCell, firstCell + numCells) for the nodes of graph, whose
+    // node v is node ids[v] of the input
+    static void split(const Level& graph, const vector<int>& ids, int firstCell, int numCells,
+                      vector<int>& cellOf, mt19937& rng) {
+        int n = graph.numNodes();
+        if (numCells <= 1 || n <= 1) {
+            for (int id : ids) cellOf[id] = firstCell;
+            return;
+        }
+        int left = numCells / 2;
+        long long total = accumulate(graph.nodeWeights.begin(), graph.nodeWeights.end(), 0LL);
+        vector<char> side = bisect(graph, total * left / numCells, rng);
+
+        // Recurse into the induced subgraph of each side, one at a time so
+        // that only one of them is held at each depth
+        vector<int> local(n);
+        int counts[2] = {0, 0};
+        for (int v = 0; v < n; v++) local[v] = counts[(int)side[v]]++;
+        for (int part = 0; part < 2; part++) {
+            Level sub;
+            vector<int> subIds;
+            subIds.reserve(counts[part]);
+            sub.nodeWeights.reserve(counts[part]);
+            for (int v = 0; v < n; v++) {
+                if (side[v] != part) continue;
+                subIds.push_back(ids[v]);
+                sub.nodeWeights.push_back(graph.nodeWeights[v]);
+                for (int e = graph.offsets[v]; e < graph.offsets[v + 1]; e++) {
+                    if (side[graph.targets[e]] != part) continue;
+                    sub.targets.push_back(local[graph.targets[e]]);
+                    sub.edgeWeights.push_back(graph.edgeWeights[e]);
+                }
+                sub.offsets.push_back(sub.targets.size());
+            }
+            if (part == 0) {
+                split(sub, subIds, firstCell, left, cellOf, rng);
+            } else {
+                split(sub, subIds, firstCell + left, numCells - left, cellOf, rng);
+            }
+        }
+    }
+
+    // Side (0 or 1) of each node, side 0 weighing about target
+    static vector<char> bisect(const Level& graph, long long target, mt19937& rng) {
+        long long total = accumulate(graph.nodeWeights.begin(), graph.nodeWeights.end(), 0LL);
+        int maxWeight = (int)max(1LL, min((long long)INT_MAX, 3 * total / (2 * kCoarsest)));
+        vector<Level> coarse;     // coarse[l] is level l + 1; level 0 is graph
+        vector<vector<int>> maps; // maps[l][v] = node of level l + 1 that v of level l went into
+        auto level = [&](size_t l) -> const Level& { return l == 0 ? graph : coarse[l - 1]; };
+        while (level(coarse.size()).numNodes() > kCoarsest) {
+            vector<int> map;
+            Level next = coarsen(level(coarse.size()), maxWeight, map, rng);
+            if (next.numNodes() > level(coarse.size()).numNodes() * 0.95) break; // Matching has stalled
+            coarse.push_back(move(next));
+            maps.push_back(move(map));
+        }
+
+        // Best of a few grown splits of the coarsest graph
+        const Level& coarsest = level(coarse.size());
+        vector<char> side;
+        long long bestCut = LLONG_MAX;
+        for (int attempt = 0; attempt < kGrowAttempts; attempt++) {
+            int start = attempt == 0 ? farthestNode(coarsest, 0) : (int)(rng() % coarsest.numNodes());
+            vector<char> grown = grow(coarsest, start, target);
+            refine(coarsest, grown, target);
+            long long cut = cutWeight(coarsest, grown);
+            if (cut < bestCut) {
+                bestCut = cut;
+                side = move(grown);
+            }
+        }
+
+        for (size_t l = coarse.size(); l-- > 0;) {
+            vector<char> finer(level(l).numNodes());
+            for (int v = 0; v < level(l).numNodes(); v++) finer[v] = side[maps[l][v]];
+            side = move(finer);
+            refine(level(l), side, target);
+        }
+        return side;
+    }
+
+    // Match every node with its unmatched neighbour over the heaviest edge
+    // (visiting nodes in random order) and merge the pairs
+    static Level coarsen(const Level& fine, int maxWeight, vector<int>& map, mt19937& rng) {
+        int n = fine.numNodes();
+        vector<int> order(n);
+        for (int v = 0; v < n; v++) order[v] = v;
+        shuffle(order.begin(), order.end(), rng);
+        map.assign(n, -1);
+        int count = 0;
+        for (int u : order) {
+            if (map[u] >= 0) continue;
+            int mate = -1;
+            for (int e = fine.offsets[u]; e < fine.offsets[u + 1]; e++) {
+                int v = fine.targets[e];
+                if (map[v] >= 0 || fine.nodeWeights[u] + fine.nodeWeights[v] > maxWeight) continue;
+                if (mate < 0 || fine.edgeWeights[e] > fine.edgeWeights[mate]) mate = e;
+            }
+            map[u] = count;
+            if (mate >= 0) map[fine.targets[mate]] = count;
+            count++;
+        }
+
+        // Members of each coarse node, then their arcs with parallel ones merged
+        vector<int> start(count + 1, 0);
+        for (int v = 0; v < n; v++) start[map[v] + 1]++;
+        for (int c = 0; c < count; c++) start[c + 1] += start[c];
+        vector<int> members(n);
+        vector<int> fill(start.begin(), start.end() - 1);
+        for (int v = 0; v < n; v++) members[fill[map[v]]++] = v;
+
+        Level next;
+        next.nodeWeights.assign(count, 0);
+        vector<int> slot(count, -1); // Arc of the current coarse node to each neighbour
+        for (int c = 0; c < count; c++) {
+            int first = next.targets.size();
+            for (int k = start[c]; k < start[c + 1]; k++) {
+                int v = members[k];
+                next.nodeWeights[c] += fine.nodeWeights[v];
+                for (int e = fine.offsets[v]; e < fine.offsets[v + 1]; e++) {
+                    int d = map[fine.targets[e]];
+                    if (d == c) continue;
+                    if (slot[d] >= first) {
+                        next.edgeWeights[slot[d]] += fine.edgeWeights[e];
+                    } else {
+                        slot[d] = next.targets.size();
+                        next.targets.push_back(d);
+                        next.edgeWeights.push_back(fine.edgeWeights[e]);
+                    }
+                }
+            }
+            next.offsets.push_back(next.targets.size());
+        }
+        return next;
+    }
+
+    // Last node reached by a BFS from start: near the periphery
+    static int farthestNode(const Level& graph, int start) {
+        vector<char> seen(graph.numNodes(), 0);
+        vector<int> queue(1, start);
+        seen[start] = 1;
+        for (size_t head = 0; head < queue.size(); head++) {
+            int u = queue[head];
+            for (int e = graph.offsets[u]; e < graph.offsets[u + 1]; e++) {
+                if (!seen[graph.targets[e]]) {
+                    seen[graph.targets[e]] = 1;
+                    queue.push_back(graph.targets[e]);
+                }
+            }
+        }
+        return queue.back();
+    }
+
+    // Side 0 grown breadth-first from start until it weighs target; other
+    // components are started on when one runs out
+    static vector<char> grow(const Level& graph, int start, long long target) {
+        int n = graph.numNodes();
+        vector<char> side(n, 1);
+        vector<char> queued(n, 0);
+        vector<int> queue(1, start);
+        queued[start] = 1;
+        long long weight = 0;
+        int next = 0;
+        for (size_t head = 0; weight < target; head++) {
+            if (head == queue.size()) {
+                while (next < n && queued[next]) next++;
+                if (next == n) break;
+                queue.push_back(next);
+                queued[next] = 1;
+            }
+            int u = queue[head];
+            side[u] = 0;
+            weight += graph.nodeWeights[u];
+            for (int e = graph.offsets[u]; e < graph.offsets[u + 1]; e++) {
+                if (!queued[graph.targets[e]]) {
+                    queued[graph.targets[e]] = 1;
+                    queue.push_back(graph.targets[e]);
+                }
+            }
+        }
+        return side;
+    }
+
+    static long long cutWeight(const Level& graph, const vector<char>& side) {
+        long long cut = 0;
+        for (int u = 0; u < graph.numNodes(); u++) {
+            for (int e = graph.offsets[u]; e < graph.offsets[u + 1]; e++) {
+                if (side[graph.targets[e]] != side[u]) cut += graph.edgeWeights[e];
+            }
+        }
+        return cut / 2;
+    }
+
+    // Move boundary nodes to the other side, best gain first, as long as
+    // that shrinks the cut and keeps side 0 within a few percent of target;
+    // a side that is too heavy gives up its best nodes whatever the gain
+    static void refine(const Level& graph, vector<char>& side, long long target) {
+        int n = graph.numNodes();
+        long long total = 0, weight = 0;
+        int heaviest = 0;
+        for (int v = 0; v < n; v++) {
+            total += graph.nodeWeights[v];
+            if (side[v] == 0) weight += graph.nodeWeights[v];
+            heaviest = max(heaviest, graph.nodeWeights[v]);
+        }
+        long long slack = max((long long)heaviest, total * 3 / 100);
+        auto gain = [&](int u) {
+            long long g = 0;
+            for (int e = graph.offsets[u]; e < graph.offsets[u + 1]; e++) {
+                g += side[graph.targets[e]] != side[u] ? graph.edgeWeights[e] : -graph.edgeWeights[e];
+            }
+            return g;
+        };
+
+        vector<pair<long long, int>> candidates;
+        for (int pass = 0; pass < kRefinePasses; pass++) {
+            candidates.clear();
+            for (int u = 0; u < n; u++) {
+                for (int e = graph.offsets[u]; e < graph.offsets[u + 1]; e++) {
+                    if (side[graph.targets[e]] != side[u]) {
+                        candidates.push_back({gain(u), u});
+                        break;
+                    }
+                }
+            }
+            sort(candidates.begin(), candidates.end(), greater<pair<long long, int>>());
+            int moved = 0;
+            for (const pair<long long, int>& candidate : candidates) {
+                int u = candidate.second;
+                long long after = weight + (side[u] == 0 ? -graph.nodeWeights[u] : graph.nodeWeights[u]);
+                bool rebalance = side[u] == 0 ? weight > target + slack : weight < target - slack;
+                bool balanced = after >= target - slack && after <= target + slack;
+                if (!rebalance && !(balanced && gain(u) > 0)) continue;
+                side[u] ^= 1;
+                weight = after;
+                moved++;
+            }
+            if (moved == 0) break;
+        }
+    }
+};
+
+// Minimal JSON document model, enough to read server requests
+struct JsonValue {
+    enum Type { Null, Bool, Number, String, Array, Object };
+
+    Type type = Null;
+    bool boolean = false;
+    double number = 0;
+    string str;
+    vector<JsonValue> items;                 // Array elements
+    vector<pair<string, JsonValue>> fields;  // Object members in document order
+
+    // Member of an object, or nullptr if absent
+    const JsonValue* get(const string& key) const {
+        for (const auto& field : fields) {
+            if (field.first == key) return &field.second;
+        }
+        return nullptr;
+    }
+
+    bool isInt() const {
+        return type == Number && number == floor(number) && fabs(number) <= INT_MAX;
+    }
+
+    // Parse a complete document; on failure returns false and sets error
+    static bool parse(const string& text, JsonValue& out, string& error) {
+        size_t pos = 0;
+        if (!parseValue(text, pos, out, error, 0)) return false;
+        skipSpace(text, pos);
+        if (pos != text.size()) {
+            return fail(error, "trailing characters", pos);
+        }
+        return true;
+    }
+
+private:
+    static void skipSpace(const string& text, size_t& pos) {
+        while (pos < text.size() && isspace((unsigned char)text[pos])) pos++;
+    }
+
+    static bool fail(string& error, const string& message, size_t pos) {
+        error = message + " at offset " + to_string(pos);
+        return false;
+    }
+
+    static bool parseValue(const string& text, size_t& pos, JsonValue& out, string& error, int depth) {
+        if (depth > 64) return fail(error, "document nested too deeply", pos);
+        skipSpace(text, pos);
+        if (pos >= text.size()) return fail(error, "unexpected end of input", pos);
+
+        char c = text[pos];
+        if (c == '{') {
+            out.type = Object;
+            pos++;
+            skipSpace(text, pos);
+            if (pos < text.size() && text[pos] == '}') {
+                pos++;
+                return true;
+            }
+            while (true) {
+                skipSpace(text, pos);
+                string key;
+                if (pos >= text.size() || text[pos] != '"') return fail(error, "expected member name", pos);
+                if (!parseString(text, pos, key, error)) return false;
+                skipSpace(text, pos);
+                if (pos >= text.size() || text[pos] != ':') return fail(error, "expected ':'", pos);
+                pos++;
+                out.fields.push_back({key, JsonValue()});
+                if (!parseValue(text, pos, out.fields.back().second, error, depth + 1)) return false;
+                skipSpace(text, pos);
+                if (pos < text.size() && text[pos] == ',') {
+                    pos++;
+                } else if (pos < text.size() && text[pos] == '}') {
+                    pos++;
+                    return true;
+                } else {
+                    return fail(error, "expected ',' or '}'", pos);
+                }
+            }
+        }
+        if (c == '[') {
+            out.type = Array;
+            pos++;
+            skipSpace(text, pos);
+            if (pos < text.size() && text[pos] == ']') {
+                pos++;
+                return true;
+            }
+            while (true) {
+                out.items.push_back(JsonValue());
+                if (!parseValue(text, pos, out.items.back(), error, depth + 1)) return false;
+                skipSpace(text, pos);
+                if (pos < text.size() && text[pos] == ',') {
+                    pos++;
+                } else if (pos < text.size() && text[pos] == ']') {
+                    pos++;
+                    return true;
+                } else {
+                    return fail(error, "expected ',' or ']'", pos);
+                }
+            }
+        }
+        if (c == '"') {
+            out.type = String;
+            return parseString(text, pos, out.str, error);
+        }
+        if (text.compare(pos, 4, "true") == 0 || text.compare(pos, 5, "false") == 0) {
+            out.type = Bool;
+            out.boolean = c == 't';
+            pos += out.boolean ? 4 : 5;
+            return true;
+        }
+        if (text.compare(pos, 4, "null") == 0) {
+            out.type = Null;
+            pos += 4;
+            return true;
+        }
+
+        const char* begin = text.c_str() + pos;
+        char* end = nullptr;
+        out.number = strtod(begin, &end);
+        if (end == begin) return fail(error, "unexpected character", pos);
+        out.type = Number;
+        pos += end - begin;
+        return true;
+    }
+
+    static bool parseHex4(const string& text, size_t pos, unsigned& code) {
+        if (pos + 4 > text.size()) return false;
+        code = 0;
+        for (size_t i = pos; i < pos + 4; i++) {
+            if (!isxdigit((unsigned char)text[i])) return false;
+            code = code * 16 + (isdigit((unsigned char)text[i]) ? text[i] - '0' : (tolower(text[i]) - 'a' + 10));
+        }
+        return true;
+    }
+
+    static void appendUtf8(string& out, unsigned code) {
+        if (code < 0x80) {
+            out += (char)code;
+        } else if (code < 0x800) {
+            out += (char)(0xC0 | (code >> 6));
+            out += (char)(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            out += (char)(0xE0 | (code >> 12));
+            out += (char)(0x80 | ((code >> 6) & 0x3F));
+            out += (char)(0x80 | (code & 0x3F));
+        } else {
+            out += (char)(0xF0 | (code >> 18));
+            out += (char)(0x80 | ((code >> 12) & 0x3F));
+            out += (char)(0x80 | ((code >> 6) & 0x3F));
+            out += (char)(0x80 | (code & 0x3F));
+        }
+    }
+
+    static bool parseString(const string& text, size_t& pos, string& out, string& error) {
+        pos++; // Opening quote
+        while (pos < text.size()) {
+            char c = text[pos++];
+            if (c == '"') return true;
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos >= text.size()) break;
+            char esc = text[pos++];
+            switch (esc) {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    unsigned code;
+                    if (!parseHex4(text, pos, code)) return fail(error, "bad unicode escape", pos);
+                    pos += 4;
+                    // Combine a surrogate pair into one code point
+                    unsigned low;
+                    if (code >= 0xD800 && code < 0xDC00 && text.compare(pos, 2, "\\u") == 0 &&
+                        parseHex4(text, pos + 2, low) && low >= 0xDC00 && low < 0xE000) {
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        pos += 6;
+                    }
+                    appendUtf8(out, code);
+                    break;
+                }
+                default:
+                    return fail(error, "bad escape", pos - 1);
+            }
+        }
+        return fail(error, "unterminated string", pos);
+    }
+};
+
+// Buffered JSON emitter. Text is appended to a byte buffer that is reused for
+// the writer's lifetime and handed to the output file in large chunks, so no
+// write ever flushes a line at a time. A string target is written into
+// directly. Structure (brackets, separators, indentation) is emitted by the
+// caller with raw(); str() takes care of quoting and escaping.
+//
+// File output can be gzip-compressed on the fly when built with
+// -DVRP_WITH_ZLIB (and linked with -lz).
+class JsonWriter {
+public:
+    // Stream to an already open stdio file (e.g. stdout); nullptr = use open()
+    explicit JsonWriter(FILE* stream = nullptr) : file(stream), out(&buffer) {
+        buffer.reserve(kChunkSize + 256);
+    }
+
+    // Append to a caller-owned string instead of a file
+    explicit JsonWriter(string* target) : out(target) {}
+
+    ~JsonWriter() { close(); }
+
+    JsonWriter(const JsonWriter&) = delete;
+    JsonWriter& operator=(const JsonWriter&) = delete;
+
+    // Create filename, optionally gzip-compressed. Fails for gzip when the
+    // build has no zlib.
+    bool open(const string& filename, bool gzip) {
+#ifndef VRP_WITH_ZLIB
+        if (gzip) return false;
+#endif
+        file = fopen(filename.c_str(), "wb");
+        ownsFile = file != nullptr;
+#ifdef VRP_WITH_ZLIB
+        if (file != nullptr && gzip) {
+            zip = {};
+            // windowBits 15 + 16 selects the gzip container
+            compress = deflateInit2(&zip, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+            ok = compress;
+        }
+#endif
+        return file != nullptr && ok;
+    }
+
+    JsonWriter& raw(char c) {
+        out->push_back(c);
+        return drain();
+    }
+
+    JsonWriter& raw(const char* text) { return raw(text, strlen(text)); }
+
+    JsonWriter& raw(const char* text, size_t length) {
+        out->append(text, length);
+        return drain();
+    }
+
+    // Quoted, escaped string
+    JsonWriter& str(const string& value) {
+        out->push_back('"');
+        for (unsigned char c : value) {
+            switch (c) {
+                case '"': out->append("\\\""); break;
+                case '\\': out->append("\\\\"); break;
+                case '\n': out->append("\\n"); break;
+                case '\r': out->append("\\r"); break;
+                case '\t': out->append("\\t"); break;
+                default:
+                    if (c < 0x20) {
+                        static const char hex[] = "0123456789abcdef";
+                        out->append("\\u00");
+                        out->push_back(hex[c >> 4]);
+                        out->push_back(hex[c & 15]);
+                    } else {
+                        out->push_back(c);
+                    }
+            }
+        }
+        out->push_back('"');
+        return drain();
+    }
+
+    JsonWriter& number(long long value) {
+        char digits[24];
+        char* end = to_chars(digits, digits + sizeof(digits), value).ptr;
+        out->append(digits, end - digits);
+        return drain();
+    }
+
+    // Real number with a fixed number of decimals
+    JsonWriter& fixed(double value, int decimals) {
+        char digits[64];
+        int length = snprintf(digits, sizeof(digits), "%.*f", decimals, value);
+        out->append(digits, min(length, (int)sizeof(digits) - 1));
+        return drain();
+    }
+
+    // Coordinate in 1e-7 degrees, written as degrees with all 7 decimals
+    JsonWriter& degrees(int fixed) {
+        if (fixed < 0) out->push_back('-');
+        unsigned magnitude = fixed < 0 ? 0u - (unsigned)fixed : (unsigned)fixed;
+        char digits[24];
+        int length = snprintf(digits, sizeof(digits), "%u.%07u", magnitude / 10000000, magnitude % 10000000);
+        out->append(digits, length);
+        return drain();
+    }
+
+    // Integer array on one line, e.g. "[1, 2, 3]"
+    JsonWriter& intArray(const vector<int>& values) {
+        out->push_back('[');
+        for (size_t i = 0; i < values.size(); i++) {
+            if (i > 0) out->append(", ");
+            number(values[i]);
+        }
+        return raw(']');
+    }
+
+    // Push buffered text to the file
+    void flush() {
+        if (file == nullptr || buffer.empty()) return;
+        emit(buffer.data(), buffer.size(), false);
+        buffer.clear();
+        fflush(file);
+    }
+
+    // Flush, finish the gzip stream and close a file opened by open().
+    // Returns false if anything failed to write.
+    bool close() {
+        if (file == nullptr) return ok;
+        emit(buffer.data(), buffer.size(), true);
+        buffer.clear();
+#ifdef VRP_WITH_ZLIB
+        if (compress) {
+            deflateEnd(&zip);
+            compress = false;
+        }
+#endif
+        if (ownsFile) {
+            ok = fclose(file) == 0 && ok;
+        } else {
+            ok = fflush(file) == 0 && ok;
+        }
+        file = nullptr;
+        return ok;
+    }
+
+private:
+    static const size_t kChunkSize = 1 << 16;
+
+    JsonWriter& drain() {
+        if (file != nullptr && buffer.size() >= kChunkSize) {
+            emit(buffer.data(), buffer.size(), false);
+            buffer.clear();
+        }
+        return *this;
+    }
+
+    void emit(const char* data, size_t length, bool finish) {
+#ifdef VRP_WITH_ZLIB
+        if (compress) {
+            char packed[kChunkSize];
+            zip.next_in = (Bytef*)data;
+            zip.avail_in = length;
+            int status;
+            do {
+                zip.next_out = (Bytef*)packed;
+                zip.avail_out = sizeof(packed);
+                status = deflate(&zip, finish ? Z_FINISH : Z_NO_FLUSH);
+                size_t produced = sizeof(packed) - zip.avail_out;
+                if (fwrite(packed, 1, produced, file) != produced) ok = false;
+            } while (zip.avail_out == 0 || (finish && status != Z_STREAM_END && status != Z_STREAM_ERROR));
+            return;
+        }
+#endif
+        (void)finish;
+        if (length > 0 && fwrite(data, 1, length, file) != length) ok = false;
+    }
+
+    FILE* file = nullptr;
+    bool ownsFile = false;
+    bool ok = true;
+    string buffer;
+    string* out;
+#ifdef VRP_WITH_ZLIB
+    z_stream zip = {};
+    bool compress = false;
+#endif
+};
+
+// Local search for open tours that start at index 0 and may end anywhere, as
+// produced by Graph::solveTSP. Moves are 2-opt (reverse a stretch) and Or-opt
+// (move a run of up to three stops, optionally reversed). Only moves that join
+// a stop to one of its k nearest stops are tried. Don't-look bits keep
+// unchanged parts of the tour from being re-scanned, so one pass over a few
+// thousand stops takes milliseconds. Assumes a symmetric matrix, which holds
+// for the undirected road graph; unreachable entries (kUnreachable) are just
+// very long edges.
+class TourImprover {
+public:
+    static constexpr int kNeighbors = 8;
+
+    TourImprover(const DistanceMatrix& distances, const vector<vector<int>>& neighbors)
+        : d(distances), nearest(neighbors), t(requestMemory()), pos(requestMemory()), active(requestMemory()) {}
+
+    // Improve tour in place until no move helps or budgetMs runs out
+    // (negative = no limit). tour[0] stays first. With focus only those
+    // stops are scanned at first, for repairing a tour around a few changes.
+    void improve(vector<int>& tour, double budgetMs, const vector<int>* focus = nullptr) {
+        int n = tour.size();
+        if (n < 3) return;
+        auto deadline = chrono::steady_clock::now() + chrono::duration<double, milli>(budgetMs);
+        t.assign(tour.begin(), tour.end());
+        pos.assign(n, 0);
+        for (int i = 0; i < n; i++) pos[t[i]] = i;
+        active.assign(n, focus == nullptr);
+        pmr::deque<int> work(requestMemory());
+        if (focus == nullptr) {
+            work.assign(t.begin(), t.end());
+        } else {
+            for (int v : *focus) {
+                if (!active[v]) {
+                    active[v] = 1;
+                    work.push_back(v);
+                }
+            }
+        }
+        pmr::vector<int> touched(requestMemory());
+
+        long long initial = length();
+        int steps = 0;
+        VRP_STATS(long long scans = 0);
+        VRP_STATS(long long moves = 0);
+        while (!work.empty()) {
+            if (budgetMs >= 0 && ++steps % 64 == 0 && chrono::steady_clock::now() > deadline) break;
+            int a = work.front();
+            work.pop_front();
+            active[a] = 0;
+            VRP_STATS(scans++);
+            touched.clear();
+            if (twoOpt(a, touched) || orOpt(a, touched)) {
+                VRP_STATS(moves++);
+                for (int v : touched) {
+                    if (v >= 0 && !active[v]) {
+                        active[v] = 1;
+                        work.push_back(v);
+                    }
+                }
+                if (!active[a]) {
+                    active[a] = 1;
+                    work.push_back(a);
+                }
+            }
+        }
+        if (length() < initial) tour.assign(t.begin(), t.end());
+        VRP_STATS(addStat(&QueryStats::tourScans, scans));
+        VRP_STATS(addStat(&QueryStats::tourMoves, moves));
+    }
+
+    // k nearest other stops of every stop, nearest first (ties by index)
+    static vector<vector<int>> nearestNeighbors(const DistanceMatrix& distances, int k) {
+        int n = distances.size();
+        vector<vector<int>> result(n);
+        vector<int> order;
+        for (int a = 0; a < n; a++) {
+            order.clear();
+            for (int b = 0; b < n; b++) {
+                if (b != a) order.push_back(b);
+            }
+            auto closer = [&](int x, int y) {
+                return make_pair(distances[a][x], x) < make_pair(distances[a][y], y);
+            };
+            int count = min(k, (int)order.size());
+            partial_sort(order.begin(), order.begin() + count, order.end(), closer);
+            result[a].assign(order.begin(), order.begin() + count);
+        }
+        return result;
+    }
+
+private:
+    // Edge cost; -1 stands for the open end after the last stop
+    long long cost(int a, int b) const {
+        return a < 0 || b < 0 ? 0 : d[a][b];
+    }
+
+    int at(int i) const { return i < (int)t.size() ? t[i] : -1; }
+
+    long long length() const {
+        long long total = 0;
+        for (size_t i = 1; i < t.size(); i++) total += cost(t[i - 1], t[i]);
+        return total;
+    }
+
+    // Replace edges (t[i], t[i+1]) and (t[j], t[j+1]) with (t[i], t[j]) and
+    // (t[i+1], t[j+1]) by reversing t[i+1..j]
+    long long twoOptGain(int i, int j) const {
+        return cost(t[i], t[i + 1]) + cost(t[j], at(j + 1)) - cost(t[i], t[j]) - cost(t[i + 1], at(j + 1));
+    }
+
+    void reverseRange(int from, int to) {
+        reverse(t.begin() + from, t.begin() + to + 1);
+        for (int k = from; k <= to; k++) pos[t[k]] = k;
+    }
+
+    bool twoOpt(int a, pmr::vector<int>& touched) {
+        int pa = pos[a];
+        for (int c : nearest[a]) {
+            int pc = pos[c];
+            long long ac = cost(a, c);
+            // a and c become neighbours through their successors' edges...
+            int i = min(pa, pc), j = max(pa, pc);
+            if (ac < cost(a, at(pa + 1)) || ac < cost(c, at(pc + 1))) {
+                if (j > i + 1 && twoOptGain(i, j) > 0) {
+                    touched = {t[i], t[i + 1], t[j], at(j + 1)};
+                    reverseRange(i + 1, j);
+                    return true;
+                }
+            }
+            // ...or through their predecessors' edges
+            if (i >= 1 && j > i + 1 && (ac < cost(t[pa - 1], a) || ac < cost(t[pc - 1], c))) {
+                if (twoOptGain(i - 1, j - 1) > 0) {
+                    touched = {t[i - 1], t[i], t[j - 1], t[j]};
+                    reverseRange(i, j - 1);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Move t[s..e] (s >= 1) between x and y = successor of x, a is the end of
+    // the run that ends up next to c
+    bool orOpt(int a, pmr::vector<int>& touched) {
+        int n = t.size();
+        int pa = pos[a];
+        for (int length = 1; length <= 3; length++) {
+            for (int s = max(1, pa - length + 1); s <= pa && s + length - 1 < n; s++) {
+                int e = s + length - 1;
+                if (pa != s && pa != e) continue;
+                int before = t[s - 1], after = at(e + 1);
+                long long removeGain = cost(before, t[s]) + cost(t[e], after) - cost(before, after);
+                if (removeGain <= 0) continue;
+                for (int c : nearest[a]) {
+                    int pc = pos[c];
+                    if (pc >= s && pc <= e) continue;
+                    // Insert with a adjacent to c, c on either side of the run
+                    for (int side = 0; side < 2; side++) {
+                        int x = side == 0 ? c : (pc >= 1 ? t[pc - 1] : -2);
+                        if (x == -2) continue;
+                        int y = side == 0 ? at(pc + 1) : c;
+                        if (x == before || (x >= 0 && pos[x] >= s && pos[x] <= e)) continue;
+                        if (y >= 0 && pos[y] >= s && pos[y] <= e) continue;
+                        // Orientation: a next to c
+                        bool reversed = side == 0 ? a != t[s] : a != t[e];
+                        int first = reversed ? t[e] : t[s];
+                        int last = reversed ? t[s] : t[e];
+                        long long insertCost = cost(x, first) + cost(last, y) - cost(x, y);
+                        if (insertCost >= removeGain) continue;
+                        touched = {before, after, x, y, t[s], t[e]};
+                        moveRun(s, e, x, reversed);
+                        return true;
+                    }
+                }
+            }
+        }
+        return false;
+    }
+
+    // Cut t[s..e] out and re-insert it right after stop x
+    void moveRun(int s, int e, int x, bool reversed) {
+        pmr::vector<int> run(t.begin() + s, t.begin() + e + 1, requestMemory());
+        if (reversed) reverse(run.begin(), run.end());
+        t.erase(t.begin() + s, t.begin() + e + 1);
+        int insertAt = find(t.begin(), t.end(), x) - t.begin() + 1;
+        t.insert(t.begin() + insertAt, run.begin(), run.end());
+        for (int k = 0; k < (int)t.size(); k++) pos[t[k]] = k;
+    }
+
+    const DistanceMatrix& d;
+    const vector<vector<int>>& nearest;
+    pmr::vector<int> t;       // Tour being improved
+    pmr::vector<int> pos;     // Position of each stop in t
+    pmr::vector<char> active; // Don't-look bits (1 = still to be scanned)
+};
+
+// Solution of a pickup-and-delivery problem over a stop matrix laid out as
+// 0 = vehicle start, 2k + 1 = pickup of request k, 2k + 2 = its delivery.
+struct PickupDeliveryPlan {
+    vector<int> order;       // Stops in visiting order, starting with 0 (and ending with 0 if the vehicle returns)
+    vector<int> unassigned;  // Requests that cannot be served within the capacity
+    long long distance = 0;  // Route length
+};
+
+// Single-vehicle pickup and delivery with capacity. Every delivery follows its
+// pickup, and the load (sum of demands picked up and not yet delivered) never
+// exceeds the capacity. A cheapest-insertion construction is improved by large
+// neighbourhood search: remove a few requests, either at random or a cluster
+// of related ones, re-insert them greedily and keep the result if it is better
+// than the current route, or within a slowly shrinking margin of the best.
+class PickupDeliverySolver {
+public:
+    PickupDeliverySolver(const DistanceMatrix& distances, const vector<int>& demands, int capacity, bool returnToStart)
+        : d(distances), demand(demands), capacity(capacity), closed(returnToStart) {}
+
+    // budgetMs: LNS time limit; negative = a fixed number of iterations,
+    // 0 = construction only
+    PickupDeliveryPlan solve(double budgetMs) {
+        int numRequests = demand.size();
+        auto start = chrono::steady_clock::now();
+        PickupDeliveryPlan plan;
+
+        // Farthest requests first: they shape the route, the rest fit in
+        vector<int> order;
+        for (int k = 0; k < numRequests; k++) {
+            if (demand[k] <= capacity) {
+                order.push_back(k);
+            } else {
+                plan.unassigned.push_back(k);
+            }
+        }
+        stable_sort(order.begin(), order.end(), [&](int a, int b) {
+            return cost(0, pickup(a)) + cost(pickup(a), delivery(a)) > cost(0, pickup(b)) + cost(pickup(b), delivery(b));
+        });
+        vector<int> route;
+        insertAll(route, order);
+
+        vector<int> best = route;
+        long long bestCost = length(route);
+        long long currentCost = bestCost;
+        int served = order.size();
+        if (served > 1 && budgetMs != 0) {
+            mt19937 rng(1);
+            int iterations = budgetMs < 0 ? kIterations : INT_MAX;
+            auto deadline = start + chrono::duration<double, milli>(budgetMs);
+            long long margin = bestCost / 50;  // Accept up to 2% worse at first
+            for (int it = 0; it < iterations; it++) {
+                double progress = (double)it / iterations;
+                if (budgetMs > 0) {
+                    auto now = chrono::steady_clock::now();
+                    if (now > deadline) break;
+                    progress = chrono::duration<double, milli>(now - start).count() / budgetMs;
+                }
+                int maxRemove = max(2, min(served / 3, 10));
+                int count = 1 + rng() % min(maxRemove, served);
+                vector<int> removed = (it % 2 == 0) ? randomRequests(route, count, rng) : relatedRequests(route, count, rng);
+                vector<int> candidate = withoutRequests(route, removed);
+                shuffle(removed.begin(), removed.end(), rng);
+                insertAll(candidate, removed);
+                long long candidateCost = length(candidate);
+
+                long long allowed = (long long)(margin * (1 - progress));
+                if (candidateCost < currentCost || candidateCost <= bestCost + allowed) {
+                    route.swap(candidate);
+                    currentCost = candidateCost;
+                    if (currentCost < bestCost) {
+                        best = route;
+                        bestCost = currentCost;
+                    }
+                }
+            }
+        }
+
+        plan.order.push_back(0);
+        plan.order.insert(plan.order.end(), best.begin(), best.end());
+        if (closed) plan.order.push_back(0);
+        plan.distance = bestCost;
+        return plan;
+    }
+
+private:
+    static constexpr int kIterations = 2000;
+
+    static int pickup(int k) { return 2 * k + 1; }
+    static int delivery(int k) { return 2 * k + 2; }
+    static int requestOf(int stop) { return (stop - 1) / 2; }
+    static bool isPickup(int stop) { return stop % 2 == 1; }
+
+    // -1 stands for the end of the route, which costs nothing on open routes
+    long long cost(int a, int b) const {
+        if (b < 0) return closed ? d[a][0] : 0;
+        return d[a][b];
+    }
+
+    long long length(const vector<int>& route) const {
+        long long total = 0;
+        int prev = 0;
+        for (int stop : route) {
+            total += cost(prev, stop);
+            prev = stop;
+        }
+        return total + cost(prev, -1);
+    }
+
+    // Insert each request at its cheapest feasible position, in the given
+    // order. The cost of the pickup and of the delivery in every gap is
+    // computed up front; for a pickup gap i the best delivery gap is then the
+    // cheapest one from i + 1 up to where the capacity runs out. Both ends of
+    // that window only move right, so a queue of candidates in increasing
+    // cost (earliest first on ties) finds it in linear time overall.
+    void insertAll(vector<int>& route, const vector<int>& requests) const {
+        vector<long long> loadAfter, leg, pickupIn, pickupOut, deliveryIn, deliveryOut, pickupDelta, deliveryDelta;
+        vector<int> window;
+        for (int k : requests) {
+            int L = route.size();
+            loadAfter.resize(L);
+            long long load = 0;
+            for (int x = 0; x < L; x++) {
+                load += isPickup(route[x]) ? demand[requestOf(route[x])] : -demand[requestOf(route[x])];
+                loadAfter[x] = load;
+            }
+            int p = pickup(k), q = delivery(k);
+            // Gap g lies before route[g]; gap L is the end of the route
+            for (vector<long long>* costs : {&leg, &pickupIn, &pickupOut, &deliveryIn, &deliveryOut, &pickupDelta, &deliveryDelta}) {
+                costs->resize(L + 1);
+            }
+            for (int g = 0; g <= L; g++) {
+                int prev = g == 0 ? 0 : route[g - 1];
+                int next = g == L ? -1 : route[g];
+                leg[g] = cost(prev, next);
+                pickupIn[g] = cost(prev, p);
+                pickupOut[g] = cost(p, next);
+                deliveryIn[g] = cost(prev, q);
+                deliveryOut[g] = cost(q, next);
+            }
+            simd().gapDeltas(pickupIn.data(), pickupOut.data(), leg.data(), L + 1, pickupDelta.data());
+            simd().gapDeltas(deliveryIn.data(), deliveryOut.data(), leg.data(), L + 1, deliveryDelta.data());
+
+            long long between = cost(p, q);
+            long long bestDelta = LLONG_MAX;
+            int bestI = 0, bestJ = 0;
+            int limit = 0;  // First delivery gap past i that would overload the vehicle
+            int queued = 0; // Delivery gaps below this have entered the window
+            size_t front = 0;
+            window.clear();
+            for (int i = 0; i <= L; i++) {
+                // Pickup goes before route[i], delivery before route[j] (j >= i)
+                if ((i == 0 ? 0 : loadAfter[i - 1]) + demand[k] > capacity) continue;
+                // Both stops in the same gap
+                long long delta = pickupIn[i] + between + deliveryOut[i] - leg[i];
+                if (delta < bestDelta) {
+                    bestDelta = delta;
+                    bestI = i;
+                    bestJ = i;
+                }
+                // The load carried between the two stops grows by demand
+                if (limit <= i) {
+                    limit = i + 1;
+                    while (limit <= L && loadAfter[limit - 1] + demand[k] <= capacity) limit++;
+                }
+                for (queued = max(queued, i + 1); queued < limit; queued++) {
+                    while (window.size() > front && deliveryDelta[window.back()] > deliveryDelta[queued]) window.pop_back();
+                    window.push_back(queued);
+                }
+                while (front < window.size() && window[front] <= i) front++;
+                if (front < window.size() && pickupDelta[i] + deliveryDelta[window[front]] < bestDelta) {
+                    bestDelta = pickupDelta[i] + deliveryDelta[window[front]];
+                    bestI = i;
+                    bestJ = window[front];
+                }
+            }
+            route.insert(route.begin() + bestJ, q);
+            route.insert(route.begin() + bestI, p);
+        }
+    }
+
+    static vector<int> randomRequests(const vector<int>& route, int count, mt19937& rng) {
+        vector<int> requests;
+        for (int stop : route) {
+            if (isPickup(stop)) requests.push_back(requestOf(stop));
+        }
+        shuffle(requests.begin(), requests.end(), rng);
+        requests.resize(count);
+        return requests;
+    }
+
+    // A random request plus the ones whose stops lie closest to its stops
+    vector<int> relatedRequests(const vector<int>& route, int count, mt19937& rng) const {
+        vector<int> requests;
+        for (int stop : route) {
+            if (isPickup(stop)) requests.push_back(requestOf(stop));
+        }
+        int seed = requests[rng() % requests.size()];
+        auto relatedness = [&](int k) {
+            return cost(pickup(seed), pickup(k)) + cost(delivery(seed), delivery(k));
+        };
+        partial_sort(requests.begin(), requests.begin() + count, requests.end(), [&](int a, int b) {
+            return relatedness(a) < relatedness(b);
+        });
+        requests.resize(count);
+        return requests;
+    }
+
+    vector<int> withoutRequests(const vector<int>& route, const vector<int>& requests) const {
+        vector<char> drop(demand.size(), 0);
+        for (int k : requests) drop[k] = 1;
+        vector<int> remaining;
+        for (int stop : route) {
+            if (!drop[requestOf(stop)]) remaining.push_back(stop);
+        }
+        return remaining;
+    }
+
+    const DistanceMatrix& d;
+    const vector<int>& demand;
+    long long capacity;
+    bool closed;
+};
+
+// One vehicle of a FleetPlan; stops are matrix indices of customers
+struct VehicleRoute {
+    int depot = 0;
+    vector<int> stops;
+    long long load = 0;
+    long long distance = 0;  // depot -> stops -> depot
+};
+
+// Solution of a capacitated, multi-depot vehicle routing problem over a
+// matrix laid out as 0..numDepots-1 = depots, then one row per customer
+struct FleetPlan {
+    vector<VehicleRoute> routes;
+    vector<int> unassigned;  // Customers (matrix indices) whose demand exceeds the capacity
+    long long distance = 0;
+};
+
+// Capacitated VRP with multiple depots and as many identical vehicles as
+// needed. Customers start at their nearest depot, where Clarke-Wright savings
+// (restricted to each customer's nearest neighbours) build the routes. Local
+// search then applies the best improving move until none is left: 2-opt
+// within a route, or exchanging segments of up to three stops between two
+// routes (which covers relocate, swap and cross-exchange). The best move of
+// every route pair is cached; after a move only the pairs involving the two
+// changed routes are re-evaluated, in parallel on the thread pool. Assumes a
+// symmetric matrix.
+class FleetSolver {
+public:
+    FleetSolver(const DistanceMatrix& distances, int numDepots, const vector<int>& demands, int capacity)
+        : d(distances), numDepots(numDepots), demand(demands), capacity(capacity) {}
+
+    // budgetMs: local search time limit; negative = until a local optimum,
+    // 0 = savings construction only
+    FleetPlan solve(double budgetMs, ThreadPool* pool) {
+        FleetPlan plan;
+        auto start = chrono::steady_clock::now();
+        routes.clear();
+        vector<vector<int>> groups(numDepots);
+        for (int c = 0; c < (int)demand.size(); c++) {
+            int stop = numDepots + c;
+            if (demand[c] > capacity) {
+                plan.unassigned.push_back(stop);
+                continue;
+            }
+            int nearest = 0;
+            for (int depot = 1; depot < numDepots; depot++) {
+                if (roundTrip(depot, stop) < roundTrip(nearest, stop)) nearest = depot;
+            }
+            groups[nearest].push_back(stop);
+        }
+        for (int depot = 0; depot < numDepots; depot++) {
+            buildSavingsRoutes(depot, groups[depot]);
+        }
+        if (budgetMs != 0) {
+            improve(budgetMs, start, pool);
+        }
+
+        for (VehicleRoute& route : routes) {
+            if (route.stops.empty()) continue;
+            route.distance = length(route);
+            plan.distance += route.distance;
+            plan.routes.push_back(move(route));
+        }
+        return plan;
+    }
+
+private:
+    static constexpr int kSavingsNeighbors = 32;
+    static constexpr int kMaxSegment = 3;
+
+    // Best move found for a pair of routes (a == b: within route a)
+    struct Move {
+        long long gain = 0;
+        int i = 0, segmentA = 0, j = 0, segmentB = 0;
+    };
+
+    long long roundTrip(int depot, int stop) const {
+        return (long long)d[depot][stop] + d[stop][depot];
+    }
+
+    long long stopDemand(int stop) const { return demand[stop - numDepots]; }
+
+    long long length(const VehicleRoute& route) const {
+        if (route.stops.empty()) return 0;
+        long long total = d[route.depot][route.stops[0]] + (long long)d[route.stops.back()][route.depot];
+        for (size_t k = 1; k < route.stops.size(); k++) total += d[route.stops[k - 1]][route.stops[k]];
+        return total;
+    }
+
+    void buildSavingsRoutes(int depot, const vector<int>& stops) {
+        int first = routes.size();
+        unordered_map<int, int> routeOf;  // stop -> index into routes
+        for (int stop : stops) {
+            VehicleRoute route;
+            route.depot = depot;
+            route.stops.push_back(stop);
+            route.load = stopDemand(stop);
+            routeOf[stop] = routes.size();
+            routes.push_back(route);
+        }
+
+        // Savings of joining i and j directly instead of via the depot
+        struct Saving {
+            long long value;
+            int i, j;
+        };
+        vector<Saving> savings;
+        vector<int> others;
+        for (int i : stops) {
+            others.clear();
+            for (int j : stops) {
+                if (j != i) others.push_back(j);
+            }
+            int count = min(kSavingsNeighbors, (int)others.size());
+            partial_sort(others.begin(), others.begin() + count, others.end(), [&](int x, int y) {
+                return make_pair(d[i][x], x) < make_pair(d[i][y], y);
+            });
+            for (int k = 0; k < count; k++) {
+                int j = others[k];
+                if (i < j) savings.push_back({(long long)d[i][depot] + d[depot][j] - d[i][j], i, j});
+            }
+        }
+        sort(savings.begin(), savings.end(), [](const Saving& a, const Saving& b) {
+            return a.value != b.value ? a.value > b.value : make_pair(a.i, a.j) < make_pair(b.i, b.j);
+        });
+
+        for (const Saving& s : savings) {
+            if (s.value <= 0) break;
+            int a = routeOf[s.i], b = routeOf[s.j];
+            if (a == b || routes[a].load + routes[b].load > capacity) continue;
+            vector<int>& ra = routes[a].stops;
+            vector<int>& rb = routes[b].stops;
+            // Both must be route ends; orient as ...i + j...
+            if (ra.back() != s.i) {
+                if (ra.front() != s.i) continue;
+                reverse(ra.begin(), ra.end());
+            }
+            if (rb.front() != s.j) {
+                if (rb.back() != s.j) continue;
+                reverse(rb.begin(), rb.end());
+            }
+            for (int stop : rb) routeOf[stop] = a;
+            ra.insert(ra.end(), rb.begin(), rb.end());
+            routes[a].load += routes[b].load;
+            rb.clear();
+            routes[b].load = 0;
+        }
+
+        // Drop the routes emptied by merges
+        routes.erase(remove_if(routes.begin() + first, routes.end(),
+                               [](const VehicleRoute& r) { return r.stops.empty(); }),
+                     routes.end());
+    }
+
+    // Cost of linking prev -> stops[from..from+count) -> next, or prev -> next
+    long long attach(int prev, const vector<int>& stops, int from, int count, int next) const {
+        if (count == 0) return d[prev][next];
+        return (long long)d[prev][stops[from]] + d[stops[from + count - 1]][next];
+    }
+
+    long long segmentLoad(const vector<int>& stops, int from, int count) const {
+        long long load = 0;
+        for (int k = from; k < from + count; k++) load += stopDemand(stops[k]);
+        return load;
+    }
+
+    Move bestMove(int a, int b) const {
+        Move best;
+        const VehicleRoute& A = routes[a];
+        const vector<int>& sa = A.stops;
+        int la = sa.size();
+        if (a == b) {
+            // 2-opt: reverse stops[i..j]
+            for (int i = 0; i < la; i++) {
+                int prev = i == 0 ? A.depot : sa[i - 1];
+                for (int j = i + 1; j < la; j++) {
+                    int next = j + 1 == la ? A.depot : sa[j + 1];
+                    long long gain = (long long)d[prev][sa[i]] + d[sa[j]][next] - d[prev][sa[j]] - d[sa[i]][next];
+                    if (gain > best.gain) best = {gain, i, 0, j, 0};
+                }
+            }
+            return best;
+        }
+
+        const VehicleRoute& B = routes[b];
+        const vector<int>& sb = B.stops;
+        int lb = sb.size();
+        for (int i = 0; i <= la; i++) {
+            int prevA = i == 0 ? A.depot : sa[i - 1];
+            for (int na = 0; na <= kMaxSegment && i + na <= la; na++) {
+                int nextA = i + na == la ? A.depot : sa[i + na];
+                long long loadA = segmentLoad(sa, i, na);
+                long long oldA = attach(prevA, sa, i, na, nextA);
+                for (int j = 0; j <= lb; j++) {
+                    int prevB = j == 0 ? B.depot : sb[j - 1];
+                    for (int nb = 0; nb <= kMaxSegment && j + nb <= lb; nb++) {
+                        if (na == 0 && nb == 0) continue;
+                        long long loadB = segmentLoad(sb, j, nb);
+                        if (A.load - loadA + loadB > capacity || B.load - loadB + loadA > capacity) continue;
+                        int nextB = j + nb == lb ? B.depot : sb[j + nb];
+                        long long gain = oldA + attach(prevB, sb, j, nb, nextB)
+                                       - attach(prevA, sb, j, nb, nextA) - attach(prevB, sa, i, na, nextB);
+                        if (gain > best.gain) best = {gain, i, na, j, nb};
+                    }
+                }
+            }
+        }
+        return best;
+    }
+
+    void apply(int a, int b, const Move& m) {
+        vector<int>& sa = routes[a].stops;
+        if (a == b) {
+            reverse(sa.begin() + m.i, sa.begin() + m.j + 1);
+            return;
+        }
+        vector<int>& sb = routes[b].stops;
+        vector<int> fromA(sa.begin() + m.i, sa.begin() + m.i + m.segmentA);
+        vector<int> fromB(sb.begin() + m.j, sb.begin() + m.j + m.segmentB);
+        long long loadA = segmentLoad(sa, m.i, m.segmentA);
+        long long loadB = segmentLoad(sb, m.j, m.segmentB);
+        sa.erase(sa.begin() + m.i, sa.begin() + m.i + m.segmentA);
+        sa.insert(sa.begin() + m.i, fromB.begin(), fromB.end());
+        sb.erase(sb.begin() + m.j, sb.begin() + m.j + m.segmentB);
+        sb.insert(sb.begin() + m.j, fromA.begin(), fromA.end());
+        routes[a].load += loadB - loadA;
+        routes[b].load += loadA - loadB;
+    }
+
+    void improve(double budgetMs, chrono::steady_clock::time_point start, ThreadPool* pool) {
+        auto deadline = start + chrono::duration<double, milli>(budgetMs);
+        int n = routes.size();
+        if (n == 0) return;
+        // best[a * n + b] for a <= b
+        vector<Move> best((size_t)n * n);
+        vector<pair<int, int>> stale;
+        for (int a = 0; a < n; a++) {
+            for (int b = a; b < n; b++) stale.push_back({a, b});
+        }
+        while (true) {
+            forEachIndex(pool, stale.size(), [&](int, int k) {
+                best[(size_t)stale[k].first * n + stale[k].second] = bestMove(stale[k].first, stale[k].second);
+            });
+            stale.clear();
+            if (budgetMs > 0 && chrono::steady_clock::now() > deadline) break;
+
+            int bestA = -1, bestB = -1;
+            long long bestGain = 0;
+            for (int a = 0; a < n; a++) {
+                for (int b = a; b < n; b++) {
+                    if (best[(size_t)a * n + b].gain > bestGain) {
+                        bestGain = best[(size_t)a * n + b].gain;
+                        bestA = a;
+                        bestB = b;
+                    }
+                }
+            }
+            if (bestA < 0) break; // Local optimum
+            apply(bestA, bestB, best[(size_t)bestA * n + bestB]);
+
+            for (int other = 0; other < n; other++) {
+                stale.push_back({min(bestA, other), max(bestA, other)});
+                if (bestB != bestA && other != bestA) {
+                    stale.push_back({min(bestB, other), max(bestB, other)});
+                }
+            }
+        }
+    }
+
+    const DistanceMatrix& d;
+    int numDepots;
+    const vector<int>& demand;  // Per customer (matrix index - numDepots)
+    long long capacity;
+    vector<VehicleRoute> routes;
+};
+
+class Graph {
+public:
+    struct Arc {
+        int from;
+        int to;
+        int weight;
+    };
+
+    unordered_map<int, UserInfo> users;
+
+    void addEdge(int u, int v, int weight) {
+        pendingArcs.push_back({u, v, weight});
+        pendingArcs.push_back({v, u, weight}); // Assuming undirected graph
+        frozen = false;
+    }
+
+    void addUser(int nodeId, const string& name, const string& pickup, const string& destination) {
+        users[nodeId] = {name, pickup, destination};
+    }
+
+    // User registered at a node, or nullptr (never inserts, safe to share)
+    const UserInfo* findUser(int nodeId) const {
+        auto it = users.find(nodeId);
+        return it == users.end() ? nullptr : &it->second;
+    }
+
+    // Build the CSR arrays from every edge added so far. Called lazily by the
+    // queries, so edges may still be added after the graph has been frozen.
+    void freeze() {
+        if (frozen) return;
+
+        // Carry over the arcs of a previous freeze, then append the new ones
+        vector<Arc> arcs;
+        arcs.reserve(graph.targets.size() + pendingArcs.size());
+        for (int i = 0; i < graph.numNodes(); i++) {
+            for (int e = graph.offsets[i]; e < graph.offsets[i + 1]; e++) {
+                arcs.push_back({graph.nodeIds[i], graph.nodeIds[graph.targets[e]], graph.weights[e]});
+            }
+        }
+        arcs.insert(arcs.end(), pendingArcs.begin(), pendingArcs.end());
+        pendingArcs.clear();
+        pendingArcs.shrink_to_fit();
+
+        shared_ptr<CSRArrays> built = make_shared<CSRArrays>();
+        for (const Arc& arc : arcs) {
+            built->nodeIds.push_back(arc.from);
+            built->nodeIds.push_back(arc.to);
+        }
+        sort(built->nodeIds.begin(), built->nodeIds.end());
+        built->nodeIds.erase(unique(built->nodeIds.begin(), built->nodeIds.end()), built->nodeIds.end());
+        int n = built->nodeIds.size();
+        unordered_map<int, int> indexOf;
+        indexOf.reserve(n);
+        for (int i = 0; i < n; i++) {
+            indexOf[built->nodeIds[i]] = i;
+        }
+
+        // Counting sort by tail; stable, so each node keeps its insertion order
+        built->offsets.assign(n + 1, 0);
+        vector<int> tails(arcs.size());
+        for (size_t k = 0; k < arcs.size(); k++) {
+            tails[k] = indexOf[arcs[k].from];
+            built->offsets[tails[k] + 1]++;
+        }
+        for (int i = 0; i < n; i++) {
+            built->offsets[i + 1] += built->offsets[i];
+        }
+        built->targets.resize(arcs.size());
+        built->weights.resize(arcs.size());
+        vector<int> fill(built->offsets.begin(), built->offsets.end() - 1);
+        for (size_t k = 0; k < arcs.size(); k++) {
+            int slot = fill[tails[k]]++;
+            built->targets[slot] = indexOf[arcs[k].to];
+            built->weights[slot] = arcs[k].weight;
+        }
+
+        install(built);
+    }
+
+    // Replace the graph with the given undirected edges, as if each had been
+    // passed to addEdge on an empty graph (including the arc order), for
+    // importers that produce millions of edges. Node ids are made dense
+    // through a sorted id array instead of a hash map, and the edge list is
+    // rewritten in place, so the peak is the edges plus the CSR arrays. With
+    // largestComponent only the biggest connected component is kept; the
+    // graph is undirected, so that is also its largest strongly connected
+    // component. edges is left empty.
+    void assignEdges(vector<Arc>& edges, bool largestComponent) {
+        shared_ptr<CSRArrays> built = make_shared<CSRArrays>();
+        vector<int>& ids = built->nodeIds;
+        ids.reserve(edges.size() * 2);
+        for (const Arc& edge : edges) {
+            ids.push_back(edge.from);
+            ids.push_back(edge.to);
+        }
+        sort(ids.begin(), ids.end());
+        ids.erase(unique(ids.begin(), ids.end()), ids.end());
+        ids.shrink_to_fit();
+        auto dense = [&ids](int id) { return (int)(lower_bound(ids.begin(), ids.end(), id) - ids.begin()); };
+        for (Arc& edge : edges) {
+            edge.from = dense(edge.from);
+            edge.to = dense(edge.to);
+        }
+
+        if (largestComponent && !ids.empty()) {
+            // Union-find with path halving; then renumber the kept nodes
+            vector<int> parent(ids.size());
+            for (size_t v = 0; v < parent.size(); v++) parent[v] = v;
+            auto root = [&parent](int v) {
+                while (parent[v] != v) v = parent[v] = parent[parent[v]];
+                return v;
+            };
+            for (const Arc& edge : edges) {
+                int a = root(edge.from), b = root(edge.to);
+                if (a != b) parent[max(a, b)] = min(a, b);
+            }
+            vector<int> size(ids.size(), 0);
+            for (size_t v = 0; v < ids.size(); v++) size[root(v)]++;
+            int largest = max_element(size.begin(), size.end()) - size.begin();
+            vector<int> renumbered(ids.size(), -1);
+            int kept = 0;
+            for (size_t v = 0; v < ids.size(); v++) {
+                if (root(v) == largest) {
+                    renumbered[v] = kept;
+                    ids[kept++] = ids[v];
+                }
+            }
+            ids.resize(kept);
+            ids.shrink_to_fit();
+            size_t out = 0;
+            for (const Arc& edge : edges) {
+                if (renumbered[edge.from] < 0) continue;
+                edges[out++] = {renumbered[edge.from], renumbered[edge.to], edge.weight};
+            }
+            edges.resize(out);
+        }
+
+        int n = ids.size();
+        built->offsets.assign(n + 1, 0);
+        for (const Arc& edge : edges) {
+            built->offsets[edge.from + 1]++;
+            built->offsets[edge.to + 1]++;
+        }
+        for (int i = 0; i < n; i++) {
+            built->offsets[i + 1] += built->offsets[i];
+        }
+        built->targets.resize(built->offsets[n]);
+        built->weights.resize(built->offsets[n]);
+        vector<int> fill(built->offsets.begin(), built->offsets.end() - 1);
+        for (const Arc& edge : edges) {
+            int slot = fill[edge.from]++;
+            built->targets[slot] = edge.to;
+            built->weights[slot] = edge.weight;
+            slot = fill[edge.to]++;
+            built->targets[slot] = edge.from;
+            built->weights[slot] = edge.weight;
+        }
+        vector<Arc>().swap(edges);
+        pendingArcs.clear();
+        install(built);
+    }
+
+    // Renumber the dense indices in breadth-first (Cuthill-McKee) order: each
+    // component is laid out level by level from a peripheral node, found as
+    // the last node reached from an arbitrary one. Neighbours then sit close
+    // together in memory, so a search touches far fewer cache lines per
+    // relaxation. External ids do not change: index() translates them
+    // through the byId permutation, which saveBinary stores. Indices built on
+    // the old numbering are dropped; adding edges returns to id order.
+    void reorderNodes() {
+        const CSRGraph& g = csr();
+        int n = g.numNodes();
+        vector<int> order;  // New index -> old index
+        order.reserve(n);
+        vector<int> seen(n, -1);  // Component whose first BFS reached the node
+        vector<char> placed(n, 0);
+        vector<int> queue;
+        queue.reserve(n);
+        for (int start = 0; start < n; start++) {
+            if (placed[start]) continue;
+            queue.assign(1, start);
+            seen[start] = start;
+            for (size_t head = 0; head < queue.size(); head++) {
+                for (int e = g.offsets[queue[head]]; e < g.offsets[queue[head] + 1]; e++) {
+                    int next = g.targets[e];
+                    if (seen[next] == start) continue;
+                    seen[next] = start;
+                    queue.push_back(next);
+                }
+            }
+            int peripheral = queue.back();
+            size_t first = order.size();
+            order.push_back(peripheral);
+            placed[peripheral] = 1;
+            for (size_t head = first; head < order.size(); head++) {
+                for (int e = g.offsets[order[head]]; e < g.offsets[order[head] + 1]; e++) {
+                    int next = g.targets[e];
+                    if (placed[next]) continue;
+                    placed[next] = 1;
+                    order.push_back(next);
+                }
+            }
+        }
+
+        vector<int> rank(n);
+        for (int v = 0; v < n; v++) rank[order[v]] = v;
+        shared_ptr<CSRArrays> built = make_shared<CSRArrays>();
+        built->offsets.assign(n + 1, 0);
+        built->targets.reserve(g.targets.size());
+        built->weights.reserve(g.targets.size());
+        built->nodeIds.resize(n);
+        built->byId.resize(n);
+        for (int v = 0; v < n; v++) {
+            int old = order[v];
+            built->nodeIds[v] = g.nodeIds[old];
+            for (int e = g.offsets[old]; e < g.offsets[old + 1]; e++) {
+                built->targets.push_back(rank[g.targets[e]]);
+                built->weights.push_back(g.weights[e]);
+            }
+            built->offsets[v + 1] = built->targets.size();
+            built->byId[v] = rank[g.byRank(v)];
+        }
+        install(built);
+    }
+
+    // Drop every node outside the largest connected component
+    void keepLargestComponent() {
+        const CSRGraph& g = csr();
+        vector<Arc> edges;
+        for (int u = 0; u < g.numNodes(); u++) {
+            for (int e = g.offsets[u]; e < g.offsets[u + 1]; e++) {
+                if (u < g.targets[e]) edges.push_back({g.nodeIds[u], g.nodeIds[g.targets[e]], g.weights[e]});
+            }
+        }
+        assignEdges(edges, true);
+    }
+
+    // Where a point lies on the road network: node is the end of the nearest
+    // edge closer to the snapped position, offset the edge weight between
+    // the two and distance the metres from the point to the edge. node is
+    // -1 if the graph has no located edge.
+    struct SnappedPoint {
+        int node = -1;
+        int offset = 0;
+        double distance = 0;
+        int from = -1;        // The nearest edge, as external ids
+        int to = -1;
+        double fraction = 0;  // Position along it, 0 = from, 1 = to
+    };
+
+    // Set node positions, in 1e-7 degrees, and rebuild the spatial index.
+    // Nodes not listed keep their position; positions follow their ids
+    // when edges are added or the nodes reordered, and saveBinary stores
+    // them. Returns false, changing nothing, for an unknown id or a
+    // coordinate out of range.
+    bool setNodeLocations(const vector<int>& nodeIds, const vector<int>& latitudes, const vector<int>& longitudes) {
+        const CSRGraph& g = csr();
+        if (latitudes.size() != nodeIds.size() || longitudes.size() != nodeIds.size()) return false;
+        vector<int> positions;
+        if (spatial) {
+            positions.assign(spatial->positions().begin(), spatial->positions().end());
+        } else {
+            positions.assign(2 * g.numNodes(), INT_MIN);
+        }
+        for (size_t k = 0; k < nodeIds.size(); k++) {
+            int v = g.index(nodeIds[k]);
+            if (v < 0 || llabs(latitudes[k]) > 900000000LL || llabs(longitudes[k]) > 1800000000LL) return false;
+            positions[2 * v] = latitudes[k];
+            positions[2 * v + 1] = longitudes[k];
+        }
+        locate(move(positions));
+        return true;
+    }
+
+    void clearNodeLocations() {
+        spatial.reset();
+    }
+
+    const SpatialIndex* spatialIndex() const {
+        return spatial.get();
+    }
+
+    // Snap (longitude, latitude) points in degrees onto the nearest edges,
+    // in parallel on the thread pool
+    vector<SnappedPoint> snapPoints(const vector<pair<double, double>>& points) {
+        const CSRGraph& g = csr();
+        vector<SnappedPoint> snapped(points.size());
+        if (!spatial) return snapped;
+        const int kChunk = 256;
+        forEachIndex(pool, (points.size() + kChunk - 1) / kChunk, [&](int, int chunk) {
+            size_t end = min(points.size(), (size_t)(chunk + 1) * kChunk);
+            for (size_t k = (size_t)chunk * kChunk; k < end; k++) {
+                SpatialIndex::Snap snap = spatial->nearest(g, points[k].second, points[k].first);
+                if (snap.edge < 0) continue;
+                SnappedPoint& point = snapped[k];
+                bool nearTail = snap.fraction <= 0.5;
+                point.node = g.nodeIds[nearTail ? snap.tail : snap.head];
+                point.offset = (int)llround(g.weights[snap.edge] * (nearTail ? snap.fraction : 1 - snap.fraction));
+                point.distance = snap.distance;
+                point.from = g.nodeIds[snap.tail];
+                point.to = g.nodeIds[snap.head];
+                point.fraction = snap.fraction;
+            }
+        });
+        return snapped;
+    }
+
+    // Write the CSR arrays and the user table as a binary graph file, plus
+    // any extra (kind, payload) sections
+    bool saveBinary(const string& filename,
+                    const vector<pair<uint32_t, pair<const char*, uint64_t>>>& extraSections = {}) {
+        const CSRGraph& g = csr();
+
+        // User strings go into one blob, in ascending node id order
+        vector<int> userNodes;
+        for (const auto& entry : users) {
+            userNodes.push_back(entry.first);
+        }
+        sort(userNodes.begin(), userNodes.end());
+        vector<GraphFileUser> userRows;
+        string strings;
+        auto slice = [&](const string& value, uint32_t* where) {
+            where[0] = strings.size();
+            where[1] = value.size();
+            strings += value;
+        };
+        for (int node : userNodes) {
+            const UserInfo& info = users.at(node);
+            GraphFileUser row;
+            row.nodeId = node;
+            slice(info.name, row.name);
+            slice(info.pickup, row.pickup);
+            slice(info.destination, row.destination);
+            userRows.push_back(row);
+        }
+
+        vector<pair<uint32_t, pair<const char*, uint64_t>>> sections = {
+            {kSectionOffsets, {(const char*)g.offsets.begin(), g.offsets.size() * sizeof(int)}},
+            {kSectionTargets, {(const char*)g.targets.begin(), g.targets.size() * sizeof(int)}},
+            {kSectionWeights, {(const char*)g.weights.begin(), g.weights.size() * sizeof(int)}},
+            {kSectionNodeIds, {(const char*)g.nodeIds.begin(), g.nodeIds.size() * sizeof(int)}},
+            {kSectionUsers, {(const char*)userRows.data(), userRows.size() * sizeof(GraphFileUser)}},
+            {kSectionStrings, {strings.data(), strings.size()}},
+        };
+        if (g.byId.size() != 0) {
+            sections.push_back({kSectionNodeOrder, {(const char*)g.byId.begin(), g.byId.size() * sizeof(int)}});
+        }
+        if (landmarks && landmarks->builtFor(g)) {
+            ArrayView<int> nodes = landmarks->landmarkNodes();
+            ArrayView<int> table = landmarks->distanceTable();
+            sections.push_back({kSectionLandmarks, {(const char*)nodes.begin(), nodes.size() * sizeof(int)}});
+            sections.push_back({kSectionLandmarkDistances, {(const char*)table.begin(), table.size() * sizeof(int)}});
+        }
+        if (spatial && spatial->builtFor(g)) {
+            ArrayView<int> positions = spatial->positions();
+            sections.push_back({kSectionLocations, {(const char*)positions.begin(), positions.size() * sizeof(int)}});
+        }
+        sections.insert(sections.end(), extraSections.begin(), extraSections.end());
+        return writeGraphFile(filename, g, sections);
+    }
+
+    // Map a binary graph file written by saveBinary. The CSR arrays are used
+    // in place; only the (small) user table is copied out.
+    bool loadBinary(const string& filename) {
+        GraphFileReader reader;
+        if (!reader.open(filename)) return false;
+        const shared_ptr<MappedFile>& file = reader.file;
+        const GraphFileHeader& header = reader.header;
+        auto section = [&reader](uint32_t kind, uint64_t expectedBytes, const char*& where, uint64_t& bytes) {
+            return reader.section(kind, expectedBytes, where, bytes);
+        };
+
+        uint64_t n = header.numNodes;
+        uint64_t m = header.numArcs;
+        const char* offsets;
+        const char* targets;
+        const char* weights;
+        const char* nodeIds;
+        const char* userRows;
+        const char* strings;
+        uint64_t bytes;
+        uint64_t userBytes;
+        uint64_t stringBytes;
+        if (!section(kSectionOffsets, (n + 1) * sizeof(int), offsets, bytes) ||
+            !section(kSectionTargets, m * sizeof(int), targets, bytes) ||
+            !section(kSectionWeights, m * sizeof(int), weights, bytes) ||
+            !section(kSectionNodeIds, n * sizeof(int), nodeIds, bytes) ||
+            !section(kSectionUsers, UINT64_MAX, userRows, userBytes) ||
+            !section(kSectionStrings, UINT64_MAX, strings, stringBytes) ||
+            userBytes % sizeof(GraphFileUser) != 0) {
+            return false;
+        }
+
+        CSRGraph mapped;
+        mapped.offsets = ArrayView<int>((const int*)offsets, n + 1);
+        mapped.targets = ArrayView<int>((const int*)targets, m);
+        mapped.weights = ArrayView<int>((const int*)weights, m);
+        mapped.nodeIds = ArrayView<int>((const int*)nodeIds, n);
+        mapped.storage = file;
+        // The searches index with these arrays unchecked, so a corrupt or
+        // truncated file has to be refused here rather than read past later
+        if (mapped.offsets[0] != 0 || (uint64_t)mapped.offsets[n] != m) return false;
+        for (uint64_t v = 0; v < n; v++) {
+            if (mapped.offsets[v] > mapped.offsets[v + 1]) return false;
+        }
+        for (uint64_t e = 0; e < m; e++) {
+            if (mapped.targets[e] < 0 || (uint64_t)mapped.targets[e] >= n || mapped.weights[e] < 0) return false;
+        }
+
+        // Reordered graphs carry the permutation that index() searches
+        const char* byId;
+        if (header.version >= 2 && section(kSectionNodeOrder, n * sizeof(int), byId, bytes)) {
+            mapped.byId = ArrayView<int>((const int*)byId, n);
+            for (uint64_t k = 0; k < n; k++) {
+                if (mapped.byId[k] < 0 || (uint64_t)mapped.byId[k] >= n ||
+                    (k > 0 && mapped.nodeIds[mapped.byId[k - 1]] >= mapped.nodeIds[mapped.byId[k]])) {
+                    return false;
+                }
+            }
+        } else {
+            // Without it index() binary-searches nodeIds directly
+            for (uint64_t v = 1; v < n; v++) {
+                if (mapped.nodeIds[v - 1] >= mapped.nodeIds[v]) return false;
+            }
+        }
+
+        // Landmarks are optional; when present they are used in place too
+        shared_ptr<LandmarkIndex> loadedLandmarks;
+        const char* landmarkNodes;
+        const char* landmarkTable;
+        uint64_t landmarkBytes;
+        if (section(kSectionLandmarks, UINT64_MAX, landmarkNodes, landmarkBytes)) {
+            uint64_t k = landmarkBytes / sizeof(int);
+            if (landmarkBytes % sizeof(int) != 0 || k > n ||
+                !section(kSectionLandmarkDistances, k * n * sizeof(int), landmarkTable, bytes)) {
+                return false;
+            }
+            ArrayView<int> nodes((const int*)landmarkNodes, k);
+            for (int node : nodes) {
+                if (node < 0 || (uint64_t)node >= n) return false;
+            }
+            loadedLandmarks.reset(new LandmarkIndex());
+            loadedLandmarks->assign(nodes, ArrayView<int>((const int*)landmarkTable, k * n), mapped.weights, file);
+        }
+
+        // Node locations too; the grid over them is rebuilt
+        const char* locations;
+        ArrayView<int> positions;
+        if (section(kSectionLocations, 2 * n * sizeof(int), locations, bytes)) {
+            positions = ArrayView<int>((const int*)locations, 2 * n);
+            for (uint64_t k = 0; k < n; k++) {
+                if (positions[2 * k] != INT_MIN &&
+                    (llabs(positions[2 * k]) > 900000000LL || llabs(positions[2 * k + 1]) > 1800000000LL)) {
+                    return false;
+                }
+            }
+        }
+
+        unordered_map<int, UserInfo> loadedUsers;
+        const GraphFileUser* rows = (const GraphFileUser*)userRows;
+        auto text = [&](const uint32_t* where) {
+            if (where[0] > stringBytes || where[1] > stringBytes - where[0]) return string();
+            return string(strings + where[0], where[1]);
+        };
+        for (size_t u = 0; u < userBytes / sizeof(GraphFileUser); u++) {
+            loadedUsers[rows[u].nodeId] = {text(rows[u].name), text(rows[u].pickup), text(rows[u].destination)};
+        }
+
+        graph = move(mapped);
+        topologyStorage = file;
+        users = move(loadedUsers);
+        pendingArcs.clear();
+        ch.reset();
+        cch.reset();
+        landmarks = move(loadedLandmarks);
+        travelTimeProfiles.reset();
+        spatial.reset();
+        if (positions.size() != 0) {
+            shared_ptr<SpatialIndex> index = make_shared<SpatialIndex>();
+            index->build(graph, positions, file);
+            spatial = index;
+        }
+        if (routeCache != nullptr) routeCache->clear();
+        frozen = true;
+        return true;
+    }
+
+    // Read a graph in the format exportToJson writes (e.g. graph_data.json)
+    bool loadJson(const string& filename) {
+        ifstream in(filename, ios::binary);
+        if (!in) return false;
+        stringstream text;
+        text << in.rdbuf();
+        JsonValue doc;
+        string error;
+        if (!JsonValue::parse(text.str(), doc, error)) return false;
+        const JsonValue* nodes = doc.get("nodes");
+        const JsonValue* edges = doc.get("edges");
+        if (nodes == nullptr || edges == nullptr) return false;
+
+        for (const JsonValue& edge : edges->items) {
+            const JsonValue* source = edge.get("source");
+            const JsonValue* target = edge.get("target");
+            const JsonValue* weight = edge.get("weight");
+            if (!source || !target || !weight || !source->isInt() || !target->isInt() || !weight->isInt()) {
+                return false;
+            }
+            addEdge(source->number, target->number, weight->number);
+        }
+        vector<int> locatedIds, latitudes, longitudes;
+        for (const JsonValue& node : nodes->items) {
+            const JsonValue* id = node.get("id");
+            if (id == nullptr || !id->isInt()) return false;
+            const JsonValue* lon = node.get("lon");
+            const JsonValue* lat = node.get("lat");
+            if (lon != nullptr && lat != nullptr && lon->type == JsonValue::Number && lat->type == JsonValue::Number) {
+                locatedIds.push_back(id->number);
+                latitudes.push_back(fixedDegrees(lat->number));
+                longitudes.push_back(fixedDegrees(lon->number));
+            }
+            string fields[3];
+            const char* keys[3] = {"user", "pickup", "destination"};
+            for (int k = 0; k < 3; k++) {
+                const JsonValue* value = node.get(keys[k]);
+                if (value != nullptr && value->type == JsonValue::String) fields[k] = value->str;
+            }
+            // Nodes without a user are exported with empty strings
+            if (!fields[0].empty() || !fields[1].empty() || !fields[2].empty()) {
+                addUser(id->number, fields[0], fields[1], fields[2]);
+            }
+        }
+        return locatedIds.empty() || setNodeLocations(locatedIds, latitudes, longitudes);
+    }
+
+    const CSRGraph& csr() {
+        freeze();
+        return graph;
+    }
+
+    // Preprocess a contraction hierarchy; dijkstra() answers point-to-point
+    // queries with it until edges are added again
+    void buildContractionHierarchy() {
+        const CSRGraph& g = csr();
+        shared_ptr<ContractionHierarchy> built = make_shared<ContractionHierarchy>();
+        built->build(g);
+        ch = built;
+    }
+
+    bool saveContractionHierarchy(const string& filename) {
+        if (!ch) buildContractionHierarchy();
+        return ch->save(filename, csr());
+    }
+
+    // Load a hierarchy written by saveContractionHierarchy for this graph
+    bool loadContractionHierarchy(const string& filename) {
+        unique_ptr<ContractionHierarchy> loaded(new ContractionHierarchy());
+        if (!loaded->load(filename, csr())) return false;
+        ch = move(loaded);
+        return true;
+    }
+
+    const ContractionHierarchy* contractionHierarchy() const {
+        return ch.get();
+    }
+
+    // Pick count landmarks and precompute their distance arrays; dijkstra()
+    // then runs goal-directed bidirectional A* searches. Much cheaper to
+    // build than a hierarchy, so it suits graphs whose weights change often.
+    // Dropped when edges are added, kept by saveBinary/loadBinary.
+    void buildLandmarks(int count = 16) {
+        const CSRGraph& g = csr();
+        shared_ptr<LandmarkIndex> built = make_shared<LandmarkIndex>();
+        built->build(g, count);
+        landmarks = built;
+    }
+
+    const LandmarkIndex* landmarkIndex() const {
+        return landmarks.get();
+    }
+
+    // Order the nodes and customize a CCH for the current weights; dijkstra()
+    // answers point-to-point queries with it, and updateEdgeWeights only has
+    // to re-customize it. Dropped when edges are added.
+    void buildCustomizableHierarchy() {
+        const CSRGraph& g = csr();
+        shared_ptr<CustomizableHierarchy> built = make_shared<CustomizableHierarchy>();
+        built->build(g);
+        built->customize(g, pool);
+        cch = built;
+    }
+
+    const CustomizableHierarchy* customizableHierarchy() const {
+        return cch.get();
+    }
+
+    // Set the weight of existing edges (both directions, and every parallel
+    // edge between the same nodes); later entries win. The node arrays are
+    // kept, only the weights are copied, and a CCH is re-customized on the
+    // thread pool. A CH is dropped (its shortcuts depend on the old weights),
+    // landmarks only if some arc became cheaper than they were built for.
+    // Returns false, changing nothing, if an edge is unknown or a weight is
+    // negative. Copies of the graph made before the call are unaffected.
+    bool updateEdgeWeights(const vector<Arc>& changes) {
+        const CSRGraph& g = csr();
+        vector<int> arcs;
+        vector<int> arcWeights;
+        for (const Arc& change : changes) {
+            int u = g.index(change.from);
+            int v = g.index(change.to);
+            if (u < 0 || v < 0 || change.weight < 0) return false;
+            size_t before = arcs.size();
+            for (int side = 0; side < 2; side++) {
+                int tail = side == 0 ? u : v;
+                int head = side == 0 ? v : u;
+                for (int e = g.offsets[tail]; e < g.offsets[tail + 1]; e++) {
+                    if (g.targets[e] != head) continue;
+                    arcs.push_back(e);
+                    arcWeights.push_back(change.weight);
+                }
+            }
+            if (arcs.size() == before) return false; // No such edge
+        }
+
+        shared_ptr<vector<int>> weights = make_shared<vector<int>>(g.weights.begin(), g.weights.end());
+        for (size_t k = 0; k < arcs.size(); k++) {
+            (*weights)[arcs[k]] = arcWeights[k];
+        }
+        CSRGraph updated = g;
+        updated.weights = *weights;
+        updated.storage = make_shared<pair<shared_ptr<const void>, shared_ptr<const vector<int>>>>(topologyStorage, weights);
+        graph = move(updated);
+
+        ch.reset();
+        if (cch) cch = cch->customized(graph, pool);
+        if (landmarks && !landmarks->admissibleAfter(graph, arcs)) landmarks.reset();
+        if (routeCache != nullptr) routeCache->clear();
+        return true;
+    }
+
+    vector<int> dijkstra(int src, int dest) {
+        const CSRGraph& g = csr();
+        vector<int> path;
+        int s = g.index(src);
+        int t = g.index(dest);
+        if (s < 0 || t < 0) {
+            return path; // Unknown node
+        }
+
+        vector<int> dense;
+        if (routeCache != nullptr && routeCache->path(s, t, dense)) {
+            for (int node : dense) {
+                path.push_back(g.nodeIds[node]);
+            }
+            return path;
+        }
+
+        if (ch) {
+            dense = ch->query(s, t);
+            for (int node : dense) {
+                path.push_back(g.nodeIds[node]);
+            }
+            if (routeCache != nullptr && !dense.empty()) {
+                routeCache->storeTree(PathTree::fromPath(dense), false);
+            }
+            return path;
+        }
+
+        if (cch) {
+            dense = cch->query(s, t);
+            for (int node : dense) {
+                path.push_back(g.nodeIds[node]);
+            }
+            if (routeCache != nullptr && !dense.empty()) {
+                routeCache->storeTree(PathTree::fromPath(dense), false);
+            }
+            return path;
+        }
+
+        if (landmarks) {
+            dense = landmarks->query(g, s, t);
+            for (int node : dense) {
+                path.push_back(g.nodeIds[node]);
+            }
+            if (routeCache != nullptr && !dense.empty()) {
+                routeCache->storeTree(PathTree::fromPath(dense), false);
+            }
+            return path;
+        }
+
+        SearchWorkspace& ws = localWorkspace();
+        dijkstraOneToMany(src, vector<int>(1, dest), ws);
+        if (routeCache != nullptr) {
+            routeCache->storeDistance(s, t, ws.dist(t));
+            routeCache->storeTree(PathTree::fromSearch(s, vector<int>(1, t), ws), false);
+        }
+
+        // Handle case where there is no path
+        if (ws.dist(t) == INT_MAX) {
+            return path; // Empty path
+        }
+
+        for (int current = t; current != s; current = ws.parent(current)) {
+            path.push_back(g.nodeIds[current]);
+        }
+        path.push_back(src);
+        reverse(path.begin(), path.end());
+        return path;
+    }
+
+    // Answer many (src, dest) queries at once. Queries are grouped by source
+    // and each group is one search towards all of its destinations, with the
+    // groups spread over the thread pool; a source asked only once goes
+    // through dijkstra() and so still uses the cache and hierarchies.
+    // emit(k, path, distance) is called once per query k, as soon as its
+    // group is done - from several threads at once and in no particular
+    // order. An unknown node or a missing path gives an empty path and
+    // distance INT_MAX. Without withPaths, grouped queries skip tracing
+    // their paths and may emit empty ones.
+    void shortestPaths(const vector<pair<int, int>>& queries,
+                       const function<void(size_t, const vector<int>&, int)>& emit, bool withPaths = true) {
+        freeze(); // Groups run concurrently; build the CSR arrays up front
+        const CSRGraph& g = graph;
+        unordered_map<int, int> groupOf;
+        vector<vector<size_t>> groups;
+        for (size_t k = 0; k < queries.size(); k++) {
+            auto inserted = groupOf.emplace(queries[k].first, groups.size());
+            if (inserted.second) groups.emplace_back();
+            groups[inserted.first->second].push_back(k);
+        }
+
+        forEachIndex(pool, groups.size(), [&](int, int i) {
+            const vector<size_t>& group = groups[i];
+            int src = queries[group[0]].first;
+            vector<int> path;
+            if (group.size() == 1) {
+                path = dijkstra(src, queries[group[0]].second);
+                emit(group[0], path, pathWeight(path));
+                return;
+            }
+
+            vector<int> dests;
+            for (size_t k : group) dests.push_back(queries[k].second);
+            SearchWorkspace& ws = localWorkspace();
+            vector<int> distances = dijkstraOneToMany(src, dests, ws);
+            int s = g.index(src);
+            for (size_t j = 0; j < group.size(); j++) {
+                path.clear();
+                if (distances[j] != INT_MAX && withPaths) {
+                    for (int current = g.index(dests[j]); current != s; current = ws.parent(current)) {
+                        path.push_back(g.nodeIds[current]);
+                    }
+                    path.push_back(src);
+                    reverse(path.begin(), path.end());
+                }
+                emit(group[j], path, distances[j]);
+            }
+            if (routeCache != nullptr && s >= 0) {
+                vector<int> indices;
+                for (int dest : dests) indices.push_back(g.index(dest));
+                for (size_t j = 0; j < dests.size(); j++) {
+                    if (indices[j] >= 0) routeCache->storeDistance(s, indices[j], distances[j]);
+                }
+                routeCache->storeTree(PathTree::fromSearch(s, indices, ws));
+            }
+        });
+    }
+
+    // Total weight of a path given as node ids (INT_MAX if empty); parallel
+    // edges count with their lightest weight
+    int pathWeight(const vector<int>& path) {
+        const CSRGraph& g = csr();
+        if (path.empty()) return INT_MAX;
+        long long total = 0;
+        for (size_t k = 1; k < path.size(); k++) {
+            int u = g.index(path[k - 1]), v = g.index(path[k]);
+            int best = INT_MAX;
+            for (int e = g.offsets[u]; e < g.offsets[u + 1]; e++) {
+                if (g.targets[e] == v) best = min(best, g.weights[e]);
+            }
+            total += best;
+        }
+        return (int)min<long long>(total, INT_MAX);
+    }
+
+    // Time-of-day travel times for the current arcs (nullptr = static
+    // weights only). Used by the departure-time queries; dropped when edges
+    // are added, since arc numbers change.
+    void setTravelTimes(shared_ptr<const TravelTimeProfiles> profiles) {
+        travelTimeProfiles = move(profiles);
+    }
+
+    const TravelTimeProfiles* travelTimes() const {
+        return travelTimeProfiles.get();
+    }
+
+    // Read travel-time profiles, one edge per line:
+    //   u v time:travel_time time:travel_time ...
+    // with times in [0, period). Both directions of the edge get the profile.
+    // Blank lines and lines starting with '#' are skipped. Returns false,
+    // changing nothing, on a malformed line, an unknown edge or a profile
+    // that is not FIFO.
+    bool loadTravelTimes(const string& filename, int period = 86400) {
+        const CSRGraph& g = csr();
+        ifstream in(filename);
+        if (!in || period <= 0) return false;
+        shared_ptr<TravelTimeProfiles> loaded = make_shared<TravelTimeProfiles>(g.targets.size(), period);
+        string line;
+        while (getline(in, line)) {
+            istringstream fields(line);
+            int from, to;
+            if (line.empty() || line[0] == '#' || line.find_first_not_of(" \t\r") == string::npos) continue;
+            if (!(fields >> from >> to)) return false;
+            vector<pair<int, int>> points;
+            string point;
+            while (fields >> point) {
+                size_t colon = point.find(':');
+                if (colon == string::npos) return false;
+                points.push_back({atoi(point.c_str()), atoi(point.c_str() + colon + 1)});
+            }
+            int profile = loaded->addProfile(points);
+            int u = g.index(from), v = g.index(to);
+            if (profile < 0 || u < 0 || v < 0) return false;
+            bool found = false;
+            for (int side = 0; side < 2; side++) {
+                int tail = side == 0 ? u : v;
+                int head = side == 0 ? v : u;
+                for (int e = g.offsets[tail]; e < g.offsets[tail + 1]; e++) {
+                    if (g.targets[e] != head) continue;
+                    loaded->assign(e, profile);
+                    found = true;
+                }
+            }
+            if (!found) return false;
+        }
+        travelTimeProfiles = loaded;
+        return true;
+    }
+
+    // Fastest path from src to dest leaving at time departure, using the
+    // travel-time profiles (static weights where an arc has none). Bypasses
+    // the cache and hierarchies, which only know static weights. travelTime,
+    // if given, receives the travel time (INT_MAX if unreachable).
+    vector<int> dijkstra(int src, int dest, int departure, int* travelTime = nullptr) {
+        const CSRGraph& g = csr();
+        vector<int> path;
+        SearchWorkspace& ws = localWorkspace();
+        int found = dijkstraOneToMany(src, vector<int>(1, dest), departure, ws)[0];
+        if (travelTime != nullptr) *travelTime = found;
+        if (found == INT_MAX) {
+            return path; // Unknown node or no path
+        }
+        int s = g.index(src);
+        for (int current = g.index(dest); current != s; current = ws.parent(current)) {
+            path.push_back(g.nodeIds[current]);
+        }
+        path.push_back(src);
+        reverse(path.begin(), path.end());
+        return path;
+    }
+
+    // Travel-time functions from src to each target, for every departure
+    // time at once: a label-correcting search whose labels are whole
+    // functions, linked along arcs and merged by pointwise minimum. The
+    // result is empty where a target is unknown or unreachable. One pass
+    // replaces a search per departure time when a matrix row is needed over
+    // the whole day.
+    vector<TravelTimeFunction> profileSearch(int src, const vector<int>& targets) {
+        const CSRGraph& g = csr();
+        const TravelTimeProfiles* times = travelTimeProfiles.get();
+        double period = times != nullptr ? times->period() : 86400;
+        vector<TravelTimeFunction> result(targets.size());
+        for (TravelTimeFunction& f : result) f.period = period;
+        int s = g.index(src);
+        if (s < 0) return result;
+
+        unordered_map<int, TravelTimeFunction> labels;  // Only nodes reached so far
+        unordered_map<int, char> dirty;  // Label changed since the node was last scanned
+        vector<int> targetIndex;
+        for (int target : targets) targetIndex.push_back(g.index(target));
+        // Popped keys are lower bounds on anything still to be improved, so
+        // once they pass the slowest target function every target is final
+        auto targetBound = [&]() {
+            double bound = -INFINITY;
+            for (int t : targetIndex) {
+                if (t < 0) continue;
+                auto it = labels.find(t);
+                if (it == labels.end()) return (double)INFINITY;
+                bound = max(bound, it->second.maximum());
+            }
+            return bound;
+        };
+
+        typedef pair<double, int> Entry;
+        priority_queue<Entry, vector<Entry>, greater<Entry>> queue;
+        labels[s] = TravelTimeFunction::constant(period, 0);
+        dirty[s] = 1;
+        queue.push({0, s});
+        double bound = targetBound();
+        while (!queue.empty() && queue.top().first <= bound) {
+            int node = queue.top().second;
+            queue.pop();
+            if (!dirty[node]) continue; // Already scanned with this label
+            dirty[node] = 0;
+            TravelTimeFunction label = labels[node];
+            bool targetChanged = false;
+            for (int e = g.offsets[node]; e < g.offsets[node + 1]; e++) {
+                int next = g.targets[e];
+                TravelTimeFunction arc = times != nullptr ? times->function(e, g.weights[e])
+                                                          : TravelTimeFunction::constant(period, g.weights[e]);
+                bool improved;
+                TravelTimeFunction merged = TravelTimeFunction::merge(labels[next], TravelTimeFunction::link(label, arc), improved);
+                if (!improved) continue;
+                labels[next] = move(merged);
+                dirty[next] = 1;
+                queue.push({labels[next].minimum(), next});
+                if (find(targetIndex.begin(), targetIndex.end(), next) != targetIndex.end()) targetChanged = true;
+            }
+            if (targetChanged) bound = targetBound();
+        }
+
+        for (size_t k = 0; k < targets.size(); k++) {
+            if (targetIndex[k] >= 0 && labels.count(targetIndex[k])) result[k] = labels[targetIndex[k]];
+        }
+        return result;
+    }
+
+    // Share distances and search trees through cache (nullptr = no caching).
+    // The graph clears it whenever its arcs change.
+    void setRouteCache(RouteCache* cache) {
+        routeCache = cache;
+    }
+
+    RouteCache* cache() const {
+        return routeCache;
+    }
+
+    // Run calculateDistanceMatrix rows on a thread pool (nullptr = sequential)
+    void setThreadPool(ThreadPool* threadPool) {
+        pool = threadPool;
+    }
+
+    ThreadPool* threadPool() const {
+        return pool;
+    }
+
+    // Single-source search towards a set of targets. Returns the distance to
+    // each target (INT_MAX if unreachable or unknown) and stops as soon as
+    // every reachable target has been settled.
+    vector<int> dijkstraOneToMany(int src, ArrayView<int> targets) {
+        return dijkstraOneToMany(src, targets, localWorkspace());
+    }
+
+    vector<int> dijkstraOneToMany(int src, ArrayView<int> targets, SearchWorkspace& ws) {
+        const CSRGraph& g = csr();
+        auto weight = [&g](int e, int) { return g.weights[e]; };
+        switch (queueKind) {
+            case QueueKind::Dary: return dijkstraOneToMany(src, targets, ws, ws.daryQueue, weight);
+            case QueueKind::Radix: return dijkstraOneToMany(src, targets, ws, ws.radixQueue, weight);
+            default: return dijkstraOneToMany(src, targets, ws, ws.binaryQueue, weight);
+        }
+    }
+
+    // Time-dependent variant leaving src at time departure: each arc costs
+    // its travel time at the moment it is entered. Returns travel times (not
+    // arrival times); exact because the profiles are FIFO, which also keeps
+    // the keys monotone for every queue kind.
+    vector<int> dijkstraOneToMany(int src, ArrayView<int> targets, int departure, SearchWorkspace& ws) {
+        const CSRGraph& g = csr();
+        const TravelTimeProfiles* times = travelTimeProfiles.get();
+        if (times == nullptr) return dijkstraOneToMany(src, targets, ws);
+        auto travelTime = [&g, times, departure](int e, int elapsed) {
+            return times->travelTime(e, g.weights[e], (long long)departure + elapsed);
+        };
+        switch (queueKind) {
+            case QueueKind::Dary: return dijkstraOneToMany(src, targets, ws, ws.daryQueue, travelTime);
+            case QueueKind::Radix: return dijkstraOneToMany(src, targets, ws, ws.radixQueue, travelTime);
+            default: return dijkstraOneToMany(src, targets, ws, ws.binaryQueue, travelTime);
+        }
+    }
+
+    // The search itself, for any queue with the BinaryHeapQueue interface;
+    // arcCost(arc, distance of its tail) gives the cost of an arc. Leaves
+    // distances and the shortest-path tree in ws.
+    template<typename Queue, typename ArcCost>
+    vector<int> dijkstraOneToMany(int src, ArrayView<int> targets, SearchWorkspace& ws, Queue& queue,
+                                  ArcCost arcCost) {
+        const CSRGraph& g = csr();
+        vector<int> result(targets.size(), INT_MAX);
+        int s = g.index(src);
+        if (s < 0) {
+            return result;
+        }
+
+        ws.reset(g.numNodes());
+        queue.reset(g.numNodes());
+        int remaining = 0;
+        for (int target : targets) {
+            int t = g.index(target);
+            if (t >= 0 && !ws.isTarget(t)) {
+                ws.markTarget(t);
+                remaining++;
+            }
+        }
+        ws.reach(s, 0, -1);
+        queue.push(s, 0);
+        VRP_STATS(SearchCounters counters);
+
+        while (!queue.empty() && remaining > 0) {
+            int node, nodeDist;
+            queue.pop(node, nodeDist);
+            VRP_STATS(counters.pops++);
+            if (nodeDist > ws.dist(node)) {
+                VRP_STATS(counters.stalePops++);
+                continue; // Stale entry
+            }
+            ws.settled++;
+
+            if (ws.isTarget(node)) {
+                ws.clearTarget(node);
+                if (--remaining == 0) break; // Last target settled
+            }
+
+            VRP_STATS(counters.relaxed += g.offsets[node + 1] - g.offsets[node]);
+            for (int e = g.offsets[node]; e < g.offsets[node + 1]; e++) {
+                int nextNode = g.targets[e];
+                int nextDist = nodeDist + arcCost(e, nodeDist);
+                if (nextDist < ws.dist(nextNode)) {
+                    ws.reach(nextNode, nextDist, node);
+                    queue.push(nextNode, nextDist);
+                    VRP_STATS(counters.pushes++);
+                }
+            }
+        }
+        VRP_STATS(counters.settled = ws.settled);
+        VRP_STATS(recordSearch(counters));
+
+        for (size_t k = 0; k < targets.size(); k++) {
+            int t = g.index(targets[k]);
+            if (t >= 0) {
+                result[k] = ws.dist(t);
+            }
+        }
+        return result;
+    }
+
+    // Queue used by dijkstra() and distance-matrix rows without a CH
+    void setQueueKind(QueueKind kind) {
+        queueKind = kind;
+    }
+
+    // Calculate distance matrix between multiple nodes. If trees is given it
+    // receives each row's search tree (nullptr where there is none, e.g. with
+    // a CH), so expandRoute can stitch the route without searching again.
+    DistanceMatrix calculateDistanceMatrix(ArrayView<int> nodes,
+                                           vector<shared_ptr<const PathTree>>* trees = nullptr) {
+        VRP_STATS(StatsTimer timer(&QueryStats::matrixNanos));
+        int n = nodes.size();
+        DistanceMatrix distances(n);
+        if (trees != nullptr) trees->assign(n, nullptr);
+        freeze(); // Rows may run concurrently; build the CSR arrays up front
+        
+        vector<int> indices;
+        for (int node : nodes) {
+            indices.push_back(graph.index(node));
+        }
+        // A row is only taken from the cache when every entry is there
+        auto cachedRow = [&](int i) {
+            if (routeCache == nullptr || indices[i] < 0) return false;
+            for (int j = 0; j < n; j++) {
+                int distance = 0;
+                if (i != j && (indices[j] < 0 || !routeCache->distance(indices[i], indices[j], distance))) return false;
+                distances.setDistance(i, j, distance);
+            }
+            return true;
+        };
+        auto storeRow = [&](int i) {
+            if (routeCache == nullptr || indices[i] < 0) return;
+            for (int j = 0; j < n; j++) {
+                if (indices[j] >= 0) routeCache->storeDistance(indices[i], indices[j], distances.distance(i, j));
+            }
+        };
+        
+        if (ch) {
+            bool cached = true;
+            for (int i = 0; i < n && cached; i++) {
+                cached = cachedRow(i);
+            }
+            if (cached) return distances;
+
+            // Many-to-many bucket search over the hierarchy
+            distances = ch->distanceTable(indices, indices, pool);
+            for (int i = 0; i < n; i++) {
+                distances[i][i] = 0;
+                storeRow(i);
+            }
+            return distances;
+        }
+
+        // One search per source fills a whole row
+        forEachIndex(pool, n, [&](int, int i) {
+            if (cachedRow(i)) return;
+            SearchWorkspace& ws = localWorkspace();
+            distances.setRow(i, dijkstraOneToMany(nodes[i], nodes, ws));
+            distances[i][i] = 0;
+            if (indices[i] < 0 || (routeCache == nullptr && trees == nullptr)) return;
+            // Keep the paths so stitching the route needs no new search
+            shared_ptr<const PathTree> tree = PathTree::fromSearch(indices[i], indices, ws);
+            if (trees != nullptr) (*trees)[i] = tree;
+            if (routeCache != nullptr) {
+                storeRow(i);
+                routeCache->storeTree(tree);
+            }
+        });
+        return distances;
+    }
+
+    // Travel-time matrix for leaving every node at time departure. Not
+    // symmetric: each row is its own time-dependent search, and the cache
+    // (which holds static distances) is neither read nor filled.
+    DistanceMatrix calculateDistanceMatrix(const vector<int>& nodes, int departure) {
+        VRP_STATS(StatsTimer timer(&QueryStats::matrixNanos));
+        int n = nodes.size();
+        DistanceMatrix distances(n);
+        freeze();
+        forEachIndex(pool, n, [&](int, int i) {
+            distances.setRow(i, dijkstraOneToMany(nodes[i], nodes, departure, localWorkspace()));
+            distances[i][i] = 0;
+        });
+        return distances;
+    }
+
+    // Distances from node to each of nodes (INT_MAX = unreachable): one row
+    // of calculateDistanceMatrix, for growing a matrix by a stop without
+    // recomputing it. On the undirected graph it is also the new column.
+    vector<int> distancesFrom(int node, ArrayView<int> nodes) {
+        freeze();
+        int s = graph.index(node);
+        vector<int> indices;
+        for (int other : nodes) indices.push_back(graph.index(other));
+        vector<int> result(nodes.size(), INT_MAX);
+        bool cached = routeCache != nullptr && s >= 0;
+        for (size_t j = 0; j < nodes.size() && cached; j++) {
+            cached = indices[j] >= 0 && routeCache->distance(s, indices[j], result[j]);
+        }
+        if (cached) return result;
+        if (ch) {
+            DistanceMatrix row = ch->distanceTable(vector<int>(1, s), indices, nullptr);
+            for (size_t j = 0; j < nodes.size(); j++) result[j] = row.distance(0, j);
+        } else {
+            result = dijkstraOneToMany(node, nodes, localWorkspace());
+        }
+        if (routeCache != nullptr && s >= 0) {
+            for (size_t j = 0; j < nodes.size(); j++) {
+                if (indices[j] >= 0) routeCache->storeDistance(s, indices[j], result[j]);
+            }
+        }
+        return result;
+    }
+
+    // Travel-time functions between every pair of nodes, one profile search
+    // per row; entry [i][j] gives the travel time from nodes[i] to nodes[j]
+    // for any departure. The diagonal is the constant 0.
+    vector<vector<TravelTimeFunction>> calculateProfileMatrix(const vector<int>& nodes) {
+        int n = nodes.size();
+        vector<vector<TravelTimeFunction>> profiles(n);
+        freeze();
+        forEachIndex(pool, n, [&](int, int i) {
+            profiles[i] = profileSearch(nodes[i], nodes);
+            profiles[i][i] = TravelTimeFunction::constant(profiles[i][i].period, 0);
+        });
+        return profiles;
+    }
+
+    // Nearest neighbor algorithm for TSP, followed by 2-opt/Or-opt local
+    // search (see setTspTimeBudget)
+    vector<int> solveTSP(const DistanceMatrix& distances) {
+        VRP_STATS(StatsTimer timer(&QueryStats::tspNanos));
+        int n = distances.size();
+        pmr::vector<char> visited(n, 0, requestMemory());
+        vector<int> tour;
+        if (n == 0) return tour;
+        tour.reserve(n);
+        vector<vector<int>> nearest = TourImprover::nearestNeighbors(distances, TourImprover::kNeighbors);
+        
+        // Start from the first node
+        int currentNode = 0;
+        tour.push_back(currentNode);
+        visited[currentNode] = true;
+        
+        // Visit all nodes
+        for (int i = 1; i < n; i++) {
+            int nextNode = -1;
+            
+            // Candidates are sorted, so the first unvisited one is the
+            // nearest; only scan the whole row once they are all used up
+            bool scanRow = true;
+            for (int j : nearest[currentNode]) {
+                if (!visited[j]) {
+                    if (distances.reachable(currentNode, j)) nextNode = j;
+                    scanRow = false;
+                    break;
+                }
+            }
+            if (scanRow) nextNode = simd().maskedArgmin(distances[currentNode], visited.data(), n);
+            // Only unreachable nodes are left; take the next one in order
+            for (int j = 0; nextNode == -1; j++) {
+                if (!visited[j]) nextNode = j;
+            }
+            
+            tour.push_back(nextNode);
+            visited[nextNode] = true;
+            currentNode = nextNode;
+        }
+        
+        if (tspTimeBudget != 0) {
+            TourImprover(distances, nearest).improve(tour, tspTimeBudget);
+        }
+        return tour;
+    }
+
+    // Time limit in milliseconds for the local search in solveTSP; negative
+    // runs it to a local optimum, 0 keeps the plain nearest-neighbor tour
+    void setTspTimeBudget(double milliseconds) {
+        tspTimeBudget = milliseconds;
+    }
+
+    double tspTimeBudgetMs() const {
+        return tspTimeBudget;
+    }
+
+    // Plan optimal multi-user route (TSP solution)
+    vector<int> planMultiUserRoute(const vector<int>& userIds) {
+        // Scratch lists live in the request's arena, if there is one
+        pmr::memory_resource* memory = requestMemory();
+        pmr::vector<int> pickupNodes(memory);
+        pmr::vector<int> destinationNodes(memory);
+        
+        // Extract pickup and destination nodes
+        for (int userId : userIds) {
+            pickupNodes.push_back(userId);  // Using the user node as pickup point
+        }
+        
+        // Calculate distance matrix for pickup nodes
+        vector<shared_ptr<const PathTree>> trees;
+        auto pickupDistances = calculateDistanceMatrix(pickupNodes, &trees);
+        
+        // Solve TSP for pickup route
+        auto pickupOrder = solveTSP(pickupDistances);
+        
+        // Create vector of pickup nodes in TSP order
+        pmr::vector<int> orderedPickups(memory);
+        for (int idx : pickupOrder) {
+            orderedPickups.push_back(pickupNodes[idx]);
+        }
+        
+        // Extract destinations for each user (in the same order as the optimized pickup)
+        for (int idx : pickupOrder) {
+            int userId = pickupNodes[idx];
+            // In a real system, you would get the destination node id
+            // For this demo, we'll use the user node id + 20 to simulate destination nodes
+            destinationNodes.push_back(userId);  // Using the same node for simplicity
+        }
+        
+        // Calculate distance matrix for destination nodes
+        auto destDistances = calculateDistanceMatrix(destinationNodes);
+        
+        // Solve TSP for destination route
+        auto destOrder = solveTSP(destDistances);
+        
+        // Combine results into a single route: pickups, then destinations
+        // in TSP order
+        pmr::vector<int> stops(orderedPickups.begin(), orderedPickups.end(), memory);
+        for (int idx : destOrder) {
+            stops.push_back(destinationNodes[idx]);
+        }
+        return expandRoute(stops, trees);
+    }
+
+    // Node sequence through the given stops, stitched from the shortest path
+    // of every leg (legs without a path add nothing). Legs covered by one of
+    // the search trees from calculateDistanceMatrix are a walk up that tree;
+    // only the rest need a search.
+    vector<int> expandRoute(ArrayView<int> stops, const vector<shared_ptr<const PathTree>>& trees = {}) {
+        VRP_STATS(StatsTimer timer(&QueryStats::stitchNanos));
+        vector<int> fullRoute;
+        if (stops.size() == 0) return fullRoute;
+        const CSRGraph& g = csr();
+        pmr::unordered_map<int, const PathTree*> treeOf(requestMemory());
+        for (const shared_ptr<const PathTree>& tree : trees) {
+            if (tree) treeOf.emplace(tree->source, tree.get());
+        }
+        vector<int> dense;
+        fullRoute.push_back(stops[0]);
+        for (size_t i = 1; i < stops.size(); i++) {
+            // Add all but the first node of each leg (to avoid duplication)
+            int s = g.index(stops[i-1]), t = g.index(stops[i]);
+            auto tree = treeOf.find(s);
+            if (s >= 0 && t >= 0 && tree != treeOf.end() && tree->second->path(t, dense)) {
+                for (size_t j = 1; j < dense.size(); j++) {
+                    fullRoute.push_back(g.nodeIds[dense[j]]);
+                }
+            } else {
+                vector<int> subpath = dijkstra(stops[i-1], stops[i]);
+                if (subpath.size() > 1) fullRoute.insert(fullRoute.end(), subpath.begin() + 1, subpath.end());
+            }
+        }
+        return fullRoute;
+    }
+
+    // Vehicle routes serving customers from the given depots; demands has one
+    // entry per customer. Stop indices in the plan follow the FleetPlan
+    // layout: depots first, then customers. The local search honours
+    // setTspTimeBudget and runs on the thread pool.
+    FleetPlan planFleet(const vector<int>& depots, const vector<int>& customers,
+                        const vector<int>& demands, int capacity,
+                        vector<shared_ptr<const PathTree>>* trees = nullptr) {
+        vector<int> stops = depots;
+        stops.insert(stops.end(), customers.begin(), customers.end());
+        DistanceMatrix distances = calculateDistanceMatrix(stops, trees);
+        return FleetSolver(distances, depots.size(), demands, capacity).solve(tspTimeBudget, pool);
+    }
+
+    // Pickup and delivery for one vehicle. stops holds the start node followed
+    // by the pickup and delivery node of each request (see
+    // PickupDeliveryPlan); demands has one entry per request. The LNS stage
+    // honours setTspTimeBudget.
+    PickupDeliveryPlan planPickupDelivery(const vector<int>& stops, const vector<int>& demands,
+                                          int capacity, bool returnToStart,
+                                          vector<shared_ptr<const PathTree>>* trees = nullptr) {
+        DistanceMatrix distances = calculateDistanceMatrix(stops, trees);
+        return PickupDeliverySolver(distances, demands, capacity, returnToStart).solve(tspTimeBudget);
+    }
+
+    // Generate enhanced JSON with user information, gzip-compressed if asked
+    bool exportToJson(const string& filename, bool gzip = false) {
+        JsonWriter out;
+        if (!out.open(filename, gzip)) return false;
+        out.raw("{\n  \"nodes\": [\n");
+        
+        // Nodes in ascending id order, whatever the dense order
+        const CSRGraph& g = csr();
+        const ArrayView<int>& nodes = g.nodeIds;
+        static const UserInfo noUser;
+        
+        // Write nodes with user info
+        for (size_t k = 0; k < nodes.size(); k++) {
+            int i = g.byRank(k);
+            int node = nodes[i];
+            const UserInfo* info = findUser(node);
+            if (info == nullptr) info = &noUser;
+            out.raw("    {\n");
+            out.raw("      \"id\": ").number(node).raw(",\n");
+            out.raw("      \"user\": ").str(info->name).raw(",\n");
+            out.raw("      \"pickup\": ").str(info->pickup).raw(",\n");
+            out.raw("      \"destination\": ").str(info->destination);
+            if (spatial && spatial->isLocated(i)) {
+                ArrayView<int> positions = spatial->positions();
+                out.raw(",\n      \"lon\": ").degrees(positions[2 * i + 1])
+                   .raw(",\n      \"lat\": ").degrees(positions[2 * i]);
+            }
+            out.raw("\n    }");
+            if (k < nodes.size() - 1) out.raw(',');
+            out.raw('\n');
+        }
+        
+        out.raw("  ],\n  \"edges\": [\n");
+        
+        // Write edges
+        bool firstEdge = true;
+        for (size_t k = 0; k < nodes.size(); k++) {
+            int i = g.byRank(k);
+            int node = nodes[i];
+            for (int e = g.offsets[i]; e < g.offsets[i + 1]; e++) {
+                int neighbor = nodes[g.targets[e]];
+                // Only write each edge once (where node < neighbor)
+                if (node < neighbor) {
+                    if (!firstEdge) out.raw(",\n");
+                    out.raw("    {\"source\": ").number(node)
+                       .raw(", \"target\": ").number(neighbor)
+                       .raw(", \"weight\": ").number(g.weights[e]).raw('}');
+                    firstEdge = false;
+                }
+            }
+        }
+        
+        out.raw("\n  ]\n}");
+        return out.close();
+    }
+
+private:
+    // Backing storage of a CSRGraph built in memory
+    struct CSRArrays {
+        vector<int> offsets;
+        vector<int> targets;
+        vector<int> weights;
+        vector<int> nodeIds;
+        vector<int> byId;
+    };
+
+    // Lay out header, section table and 64-byte aligned payloads
+    static bool writeGraphFile(const string& filename, const CSRGraph& g,
+                               const vector<pair<uint32_t, pair<const char*, uint64_t>>>& sections) {
+        GraphFileHeader header = {};
+        memcpy(header.magic, "VRPGRAPH", 8);
+        header.version = g.byId.size() != 0 ? kGraphFileVersion : 1;
+        header.numSections = sections.size();
+        header.numNodes = g.numNodes();
+        header.numArcs = g.targets.size();
+
+        auto align = [](uint64_t offset) { return (offset + 63) / 64 * 64; };
+        vector<GraphFileSection> table;
+        uint64_t offset = align(sizeof(header) + sections.size() * sizeof(GraphFileSection));
+        for (const auto& section : sections) {
+            table.push_back({section.first, 0, offset, section.second.second});
+            offset = align(offset + section.second.second);
+        }
+
+        ofstream out(filename, ios::binary | ios::trunc);
+        if (!out) return false;
+        out.write((const char*)&header, sizeof(header));
+        out.write((const char*)table.data(), table.size() * sizeof(GraphFileSection));
+        static const char padding[64] = {};
+        uint64_t written = sizeof(header) + table.size() * sizeof(GraphFileSection);
+        for (size_t s = 0; s < sections.size(); s++) {
+            out.write(padding, table[s].offset - written);
+            out.write(sections[s].second.first, sections[s].second.second);
+            written = table[s].offset + table[s].bytes;
+        }
+        out.write(padding, align(written) - written);
+        return (bool)out;
+    }
+
+    // Make freshly built CSR arrays the graph; everything derived from the
+    // old topology is dropped
+    void install(const shared_ptr<CSRArrays>& built) {
+        CSRGraph previous = move(graph);
+        graph = CSRGraph();
+        graph.offsets = built->offsets;
+        graph.targets = built->targets;
+        graph.weights = built->weights;
+        graph.nodeIds = built->nodeIds;
+        graph.byId = built->byId;
+        graph.storage = built;
+        topologyStorage = built;
+        ch.reset(); // Built for the old topology
+        cch.reset();
+        landmarks.reset();
+        travelTimeProfiles.reset();
+        if (routeCache != nullptr) routeCache->clear();
+        frozen = true;
+
+        // Node locations are kept by id across the renumbering
+        if (spatial) {
+            ArrayView<int> old = spatial->positions();
+            vector<int> positions(2 * graph.numNodes(), INT_MIN);
+            for (int v = 0; v < previous.numNodes(); v++) {
+                int moved = graph.index(previous.nodeIds[v]);
+                if (moved < 0) continue;
+                positions[2 * moved] = old[2 * v];
+                positions[2 * moved + 1] = old[2 * v + 1];
+            }
+            locate(move(positions));
+        }
+    }
+
+    // Index positions (by dense node of the current graph)
+    void locate(vector<int> positions) {
+        shared_ptr<vector<int>> owned = make_shared<vector<int>>(move(positions));
+        shared_ptr<SpatialIndex> built = make_shared<SpatialIndex>();
+        built->build(graph, *owned, make_shared<pair<shared_ptr<const void>, shared_ptr<const void>>>(owned, graph.storage));
+        spatial = built;
+    }
+
+    vector<Arc> pendingArcs;  // Arcs added since the last freeze()
+    CSRGraph graph;
+    bool frozen = false;
+    ThreadPool* pool = nullptr;
+    QueueKind queueKind = QueueKind::Binary;
+    double tspTimeBudget = -1;
+    RouteCache* routeCache = nullptr;
+    shared_ptr<const void> topologyStorage;  // Owner of offsets, targets, nodeIds and byId
+    shared_ptr<const ContractionHierarchy> ch;
+    shared_ptr<const CustomizableHierarchy> cch;
+    shared_ptr<const LandmarkIndex> landmarks;
+    shared_ptr<const TravelTimeProfiles> travelTimeProfiles;
+    shared_ptr<const SpatialIndex> spatial;
+};
+
+// Streaming graph importers. Both decode their input in bounded batches on
+// the graph's thread pool and hand one flat edge list to
+// Graph::assignEdges, so no per-node adjacency is built on the way.
+
+// One edge list line; 1 = edge, 0 = nothing on it, -1 = malformed
+static int parseEdgeLine(const char* p, const char* end, Graph::Arc& edge) {
+    auto separator = [](char c) { return c == ',' || c == ';' || c == '\t' || c == ' ' || c == '\r'; };
+    while (p < end && separator(*p)) p++;
+    if (p == end || *p == '#') return 0;
+    int* fields[3] = {&edge.from, &edge.to, &edge.weight};
+    for (int k = 0; k < 3; k++) {
+        while (p < end && separator(*p)) p++;
+        from_chars_result parsed = from_chars(p, end, *fields[k]);
+        if (parsed.ec != errc() || (parsed.ptr < end && !separator(*parsed.ptr))) return -1;
+        p = parsed.ptr;
+    }
+    while (p < end && separator(*p)) p++;
+    return p == end && edge.weight >= 0 ? 1 : -1;
+}
+
+// Edge list text: one edge per line as "u v weight", separated by commas,
+// tabs or spaces (CSV, TSV or plain). Blank lines, lines starting with '#'
+// and a header line before the first edge are skipped. The file is read in
+// 16 MB chunks whose lines are parsed in parallel.
+static bool importEdgeList(Graph& g, const string& filename, bool largestComponent, string& error) {
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == nullptr) {
+        error = "cannot open " + filename;
+        return false;
+    }
+    const size_t kChunkBytes = 16 << 20;
+    ThreadPool* pool = g.threadPool();
+    int numParts = pool != nullptr ? pool->size() * 4 : 1;
+    vector<Graph::Arc> edges;
+    vector<vector<Graph::Arc>> parsed(numParts);
+    vector<string> badLines(numParts);
+    vector<char> buffer(kChunkBytes);
+    string chunk;  // Unparsed text: the last partial line plus what was just read
+    bool header = true;  // Still before the first edge
+    bool more = true;
+    while (more) {
+        size_t got = fread(buffer.data(), 1, buffer.size(), file);
+        more = got == buffer.size();
+        chunk.append(buffer.data(), got);
+        size_t complete = more ? chunk.rfind('\n') + 1 : chunk.size();  // 0 if no line is complete yet
+        size_t begin = 0;
+        while (header && begin < complete) {
+            size_t lineEnd = chunk.find('\n', begin);
+            lineEnd = lineEnd == string::npos ? complete : lineEnd;
+            Graph::Arc edge;
+            int kind = parseEdgeLine(chunk.data() + begin, chunk.data() + lineEnd, edge);
+            if (kind != 0) {
+                header = false;
+                if (kind > 0) break; // The first edge, parsed again below
+            }
+            begin = min(lineEnd + 1, complete);
+        }
+
+        // Split at line ends so every part holds whole lines
+        vector<size_t> bounds(numParts + 1, complete);
+        bounds[0] = begin;
+        for (int part = 1; part < numParts; part++) {
+            size_t at = max(bounds[part - 1], begin + (complete - begin) * part / numParts);
+            size_t lineEnd = at == 0 ? 0 : chunk.find('\n', at - 1);
+            bounds[part] = lineEnd == string::npos || lineEnd >= complete ? complete : lineEnd + 1;
+        }
+        forEachIndex(pool, numParts, [&](int, int part) {
+            const char* p = chunk.data() + bounds[part];
+            const char* end = chunk.data() + bounds[part + 1];
+            while (p < end) {
+                const char* lineEnd = find(p, end, '\n');
+                Graph::Arc edge;
+                int kind = parseEdgeLine(p, lineEnd, edge);
+                if (kind < 0) {
+                    badLines[part] = string(p, lineEnd);
+                    return;
+                }
+                if (kind > 0) parsed[part].push_back(edge);
+                p = lineEnd + (lineEnd < end);
+            }
+        });
+        for (int part = 0; part < numParts; part++) {
+            if (!badLines[part].empty()) {
+                fclose(file);
+                error = "malformed edge line: " + badLines[part];
+                return false;
+            }
+            edges.insert(edges.end(), parsed[part].begin(), parsed[part].end());
+            parsed[part].clear();
+        }
+        chunk.erase(0, complete);
+    }
+    bool failed = ferror(file);
+    fclose(file);
+    if (failed) {
+        error = "cannot read " + filename;
+        return false;
+    }
+    g.clearNodeLocations(); // Edge lists carry none
+    g.assignEdges(edges, largestComponent);
+    return true;
+}
+
+// Reader for the protocol buffer wire format, just enough for the OSM PBF
+// messages. Truncated or malformed input throws runtime_error.
+class ProtoReader {
+public:
+    ProtoReader(const uint8_t* begin, const uint8_t* end) : p(begin), end(end) {}
+
+    uint32_t field = 0;
+    uint32_t wireType = 0;
+
+    // Move to the next field of the message; false at its end
+    bool next() {
+        if (p >= end) return false;
+        uint64_t key = varint();
+        field = key >> 3;
+        wireType = key & 7;
+        return true;
+    }
+
+    bool atEnd() const { return p >= end; }
+    const uint8_t* data() const { return p; }
+    size_t size() const { return end - p; }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (p >= end) throw runtime_error("truncated varint");
+            uint8_t byte = *p++;
+            value |= (uint64_t)(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) return value;
+        }
+        throw runtime_error("overlong varint");
+    }
+
+    // Zigzag-encoded sint32/sint64
+    int64_t svarint() {
+        uint64_t value = varint();
+        return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+    }
+
+    // Length-delimited payload: a sub-message, a string or a packed array
+    ProtoReader bytes() {
+        uint64_t length = varint();
+        if (length > (uint64_t)(end - p)) throw runtime_error("truncated field");
+        ProtoReader inner(p, p + length);
+        p += length;
+        return inner;
+    }
+
+    string str() {
+        ProtoReader inner = bytes();
+        return string((const char*)inner.p, inner.end - inner.p);
+    }
+
+    void skip() {
+        switch (wireType) {
+            case 0: varint(); break;
+            case 1: advance(8); break;
+            case 2: bytes(); break;
+            case 5: advance(4); break;
+            default: throw runtime_error("unsupported wire type");
+        }
+    }
+
+private:
+    void advance(size_t bytes) {
+        if (bytes > (size_t)(end - p)) throw runtime_error("truncated field");
+        p += bytes;
+    }
+
+    const uint8_t* p;
+    const uint8_t* end;
+};
+
+// OpenStreetMap PBF importer. The file is a sequence of blobs, each a
+// (usually zlib-compressed) block of nodes or ways; a batch of blobs is read
+// and then decoded in parallel on the thread pool, so only a few blocks are
+// in memory at once. Two passes keep the rest to what the road graph needs:
+// the first collects the segments of routable ways (car-accessible highway=*
+// values), the second the coordinates of just the nodes on them, which give
+// every edge its length in metres. OSM ids no longer fit in an int, so nodes
+// are numbered 1..n in ascending OSM id order and osmIds receives the
+// original ids. Compressed blobs need a -DVRP_WITH_ZLIB build.
+class OsmPbfReader {
+public:
+    explicit OsmPbfReader(ThreadPool* threadPool) : pool(threadPool) {}
+
+    bool read(const string& filename, vector<Graph::Arc>& edges, vector<long long>& osmIds, string& error) {
+        try {
+            // Pass 1: way segments, as pairs of OSM node ids
+            vector<pair<long long, long long>> segments;
+            vector<vector<pair<long long, long long>>> found;
+            forEachBlock(filename, [&](int count) { found.assign(count, {}); },
+                         [&](int slot, ProtoReader block) { readWays(block, found[slot]); },
+                         [&](int count) {
+                             for (int slot = 0; slot < count; slot++) {
+                                 segments.insert(segments.end(), found[slot].begin(), found[slot].end());
+                             }
+                         });
+
+            osmIds.clear();
+            osmIds.reserve(segments.size() * 2);
+            for (const pair<long long, long long>& segment : segments) {
+                osmIds.push_back(segment.first);
+                osmIds.push_back(segment.second);
+            }
+            sort(osmIds.begin(), osmIds.end());
+            osmIds.erase(unique(osmIds.begin(), osmIds.end()), osmIds.end());
+            osmIds.shrink_to_fit();
+            if (osmIds.size() >= (size_t)INT_MAX) throw runtime_error("too many nodes");
+            auto dense = [&osmIds](long long id) { return (int)(lower_bound(osmIds.begin(), osmIds.end(), id) - osmIds.begin()); };
+            edges.clear();
+            edges.reserve(segments.size());
+            for (const pair<long long, long long>& segment : segments) {
+                edges.push_back({dense(segment.first), dense(segment.second), 0});
+            }
+            vector<pair<long long, long long>>().swap(segments);
+
+            // Pass 2: coordinates of the nodes on those ways (1e-7 degrees)
+            latitudes.assign(osmIds.size(), INT_MIN);
+            longitudes.assign(osmIds.size(), INT_MIN);
+            forEachBlock(filename, [](int) {},
+                         [&](int, ProtoReader block) { readNodes(block, osmIds); },
+                         [](int) {});
+
+            size_t kept = 0;
+            for (const Graph::Arc& edge : edges) {
+                if (edge.from == edge.to || latitudes[edge.from] == INT_MIN || latitudes[edge.to] == INT_MIN) {
+                    continue; // Repeated node, or a node missing from the extract
+                }
+                int metres = (int)min(llround(distanceMetres(edge.from, edge.to)), (long long)INT_MAX / 4);
+                edges[kept++] = {edge.from + 1, edge.to + 1, max(1, metres)};
+            }
+            edges.resize(kept);
+        } catch (const exception& e) {
+            error = e.what();
+            return false;
+        }
+        return true;
+    }
+
+    // Position of a node (dense index = id - 1) after read(), 1e-7 degrees
+    int latitude(int node) const { return latitudes[node]; }
+    int longitude(int node) const { return longitudes[node]; }
+
+private:
+    // Read the file blob by blob. Per batch of OSMData blocks: begin(count),
+    // then decode(slot, block) for each in parallel, then end(count).
+    void forEachBlock(const string& filename, const function<void(int)>& begin,
+                      const function<void(int, ProtoReader)>& decode, const function<void(int)>& end) {
+        unique_ptr<FILE, int (*)(FILE*)> file(fopen(filename.c_str(), "rb"), fclose);
+        if (!file) throw runtime_error("cannot open file");
+        int batchSize = (pool != nullptr ? pool->size() : 1) * 4;
+        vector<vector<uint8_t>> blobs;
+        bool more = true;
+        while (more) {
+            blobs.clear();
+            while ((int)blobs.size() < batchSize && (more = readBlob(file.get(), blobs))) {}
+            begin(blobs.size());
+            forEachIndex(pool, blobs.size(), [&](int, int slot) {
+                vector<uint8_t> block = unpack(blobs[slot]);
+                vector<uint8_t>().swap(blobs[slot]);
+                decode(slot, ProtoReader(block.data(), block.data() + block.size()));
+            });
+            end(blobs.size());
+        }
+    }
+
+    // Append the next OSMData blob (still packed) to blobs; header blobs are
+    // skipped. False at the end of the file.
+    static bool readBlob(FILE* file, vector<vector<uint8_t>>& blobs) {
+        while (true) {
+            uint8_t length[4];
+            size_t got = fread(length, 1, 4, file);
+            if (got == 0 && feof(file)) return false;
+            if (got != 4) throw runtime_error("truncated blob header");
+            uint32_t headerBytes = (uint32_t)length[0] << 24 | length[1] << 16 | length[2] << 8 | length[3];
+            if (headerBytes > (64 << 10)) throw runtime_error("blob header too large");
+            vector<uint8_t> header(headerBytes);
+            if (fread(header.data(), 1, headerBytes, file) != headerBytes) throw runtime_error("truncated blob header");
+            string type;
+            uint64_t dataBytes = 0;
+            ProtoReader fields(header.data(), header.data() + header.size());
+            while (fields.next()) {
+                if (fields.field == 1 && fields.wireType == 2) {
+                    type = fields.str();
+                } else if (fields.field == 3 && fields.wireType == 0) {
+                    dataBytes = fields.varint();
+                } else {
+                    fields.skip();
+                }
+            }
+            if (dataBytes > (32 << 20)) throw runtime_error("blob too large");
+            vector<uint8_t> blob(dataBytes);
+            if (fread(blob.data(), 1, dataBytes, file) != dataBytes) throw runtime_error("truncated blob");
+            if (type == "OSMData") {
+                blobs.push_back(move(blob));
+                return true;
+            }
+        }
+    }
+
+    // Block bytes of a Blob message
+    static vector<uint8_t> unpack(const vector<uint8_t>& blob) {
+        ProtoReader fields(blob.data(), blob.data() + blob.size());
+        uint64_t rawSize = 0;
+        ProtoReader raw(nullptr, nullptr);
+        ProtoReader zlibData(nullptr, nullptr);
+        bool isRaw = false;
+        bool isZlib = false;
+        while (fields.next()) {
+            if (fields.field == 1 && fields.wireType == 2) {
+                raw = fields.bytes();
+                isRaw = true;
+            } else if (fields.field == 2 && fields.wireType == 0) {
+                rawSize = fields.varint();
+            } else if (fields.field == 3 && fields.wireType == 2) {
+                zlibData = fields.bytes();
+                isZlib = true;
+            } else if (fields.field >= 4 && fields.field <= 7) {
+                throw runtime_error("unsupported blob compression (only zlib is)");
+            } else {
+                fields.skip();
+            }
+        }
+        if (isRaw) return vector<uint8_t>(raw.data(), raw.data() + raw.size());
+        if (!isZlib) throw runtime_error("empty blob");
+#ifdef VRP_WITH_ZLIB
+        if (rawSize > (32 << 20)) throw runtime_error("blob too large");
+        vector<uint8_t> block(rawSize);
+        uLongf size = rawSize;
+        if (uncompress(block.data(), &size, zlibData.data(), zlibData.size()) != Z_OK || size != rawSize) {
+            throw runtime_error("corrupt zlib blob");
+        }
+        return block;
+#else
+        (void)rawSize;
+        throw runtime_error("compressed blocks need a -DVRP_WITH_ZLIB build");
+#endif
+    }
+
+    // Coordinate encoding of one PrimitiveBlock
+    struct BlockGeometry {
+        long long granularity = 100;  // Nanodegrees per unit
+        long long latOffset = 0;      // Nanodegrees
+        long long lonOffset = 0;
+    };
+
+    // Split a PrimitiveBlock into its string table (if strings is given),
+    // its groups and its coordinate encoding, which follows the groups
+    static void splitBlock(ProtoReader block, vector<string>* strings, vector<ProtoReader>& groups,
+                           BlockGeometry& geometry) {
+        while (block.next()) {
+            if (block.field == 1 && block.wireType == 2 && strings != nullptr) {
+                ProtoReader table = block.bytes();
+                while (table.next()) {
+                    if (table.field == 1 && table.wireType == 2) {
+                        strings->push_back(table.str());
+                    } else {
+                        table.skip();
+                    }
+                }
+            } else if (block.field == 2 && block.wireType == 2) {
+                groups.push_back(block.bytes());
+            } else if (block.field == 17 && block.wireType == 0) {
+                geometry.granularity = block.varint();
+            } else if (block.field == 19 && block.wireType == 0) {
+                geometry.latOffset = (long long)block.varint();
+            } else if (block.field == 20 && block.wireType == 0) {
+                geometry.lonOffset = (long long)block.varint();
+            } else {
+                block.skip();
+            }
+        }
+    }
+
+    // highway=* values that cars may drive on
+    static bool isRoutableHighway(const string& value) {
+        static const char* const kRoads[] = {
+            "motorway", "trunk", "primary", "secondary", "tertiary", "unclassified", "residential",
+            "service", "living_street", "road", "motorway_link", "trunk_link", "primary_link",
+            "secondary_link", "tertiary_link",
+        };
+        for (const char* road : kRoads) {
+            if (value == road) return true;
+        }
+        return false;
+    }
+
+    static void readPacked(ProtoReader packed, vector<uint32_t>& values) {
+        while (!packed.atEnd()) values.push_back(packed.varint());
+    }
+
+    // Delta-coded sint64 array, decoded to absolute values
+    static void readDeltas(ProtoReader packed, vector<long long>& values) {
+        long long value = 0;
+        while (!packed.atEnd()) {
+            value += packed.svarint();
+            values.push_back(value);
+        }
+    }
+
+    // Segments between consecutive nodes of the routable ways in a block
+    static void readWays(ProtoReader block, vector<pair<long long, long long>>& segments) {
+        vector<string> strings;
+        vector<ProtoReader> groups;
+        BlockGeometry geometry;
+        splitBlock(block, &strings, groups, geometry);
+        uint32_t highway = UINT32_MAX;
+        vector<char> routable(strings.size());
+        for (size_t k = 0; k < strings.size(); k++) {
+            if (strings[k] == "highway") highway = k;
+            routable[k] = isRoutableHighway(strings[k]);
+        }
+        if (highway == UINT32_MAX) return; // No roads in this block
+
+        vector<uint32_t> keys;
+        vector<uint32_t> values;
+        vector<long long> refs;
+        for (ProtoReader group : groups) {
+            while (group.next()) {
+                if (group.field != 3 || group.wireType != 2) {
+                    group.skip();
+                    continue;
+                }
+                ProtoReader way = group.bytes();
+                keys.clear();
+                values.clear();
+                refs.clear();
+                while (way.next()) {
+                    if (way.field == 2 && way.wireType == 2) {
+                        readPacked(way.bytes(), keys);
+                    } else if (way.field == 3 && way.wireType == 2) {
+                        readPacked(way.bytes(), values);
+                    } else if (way.field == 8 && way.wireType == 2) {
+                        readDeltas(way.bytes(), refs);
+                    } else {
+                        way.skip();
+                    }
+                }
+                bool road = false;
+                for (size_t k = 0; k < keys.size() && k < values.size(); k++) {
+                    if (keys[k] == highway && values[k] < routable.size() && routable[values[k]]) road = true;
+                }
+                if (!road) continue;
+                for (size_t k = 1; k < refs.size(); k++) {
+                    segments.push_back({refs[k - 1], refs[k]});
+                }
+            }
+        }
+    }
+
+    // Coordinates of the nodes in a block that are in osmIds. Blocks hold
+    // disjoint nodes, so blocks decoded in parallel write disjoint entries.
+    void readNodes(ProtoReader block, const vector<long long>& osmIds) {
+        vector<ProtoReader> groups;
+        BlockGeometry geometry;
+        splitBlock(block, nullptr, groups, geometry);
+        auto store = [&](long long id, long long lat, long long lon) {
+            auto it = lower_bound(osmIds.begin(), osmIds.end(), id);
+            if (it == osmIds.end() || *it != id) return;
+            // 1e-7 degrees = 100 nanodegrees
+            latitudes[it - osmIds.begin()] = (geometry.latOffset + geometry.granularity * lat) / 100;
+            longitudes[it - osmIds.begin()] = (geometry.lonOffset + geometry.granularity * lon) / 100;
+        };
+
+        vector<long long> ids;
+        vector<long long> lats;
+        vector<long long> lons;
+        for (ProtoReader group : groups) {
+            while (group.next()) {
+                if (group.field == 1 && group.wireType == 2) {
+                    ProtoReader node = group.bytes();
+                    long long id = 0, lat = 0, lon = 0;
+                    while (node.next()) {
+                        if (node.field == 1 && node.wireType == 0) {
+                            id = node.svarint();
+                        } else if (node.field == 8 && node.wireType == 0) {
+                            lat = node.svarint();
+                        } else if (node.field == 9 && node.wireType == 0) {
+                            lon = node.svarint();
+                        } else {
+                            node.skip();
+                        }
+                    }
+                    store(id, lat, lon);
+                } else if (group.field == 2 && group.wireType == 2) {
+                    ProtoReader dense = group.bytes();
+                    ids.clear();
+                    lats.clear();
+                    lons.clear();
+                    while (dense.next()) {
+                        if (dense.field == 1 && dense.wireType == 2) {
+                            readDeltas(dense.bytes(), ids);
+                        } else if (dense.field == 8 && dense.wireType == 2) {
+                            readDeltas(dense.bytes(), lats);
+                        } else if (dense.field == 9 && dense.wireType == 2) {
+                            readDeltas(dense.bytes(), lons);
+                        } else {
+                            dense.skip();
+                        }
+                    }
+                    if (lats.size() != ids.size() || lons.size() != ids.size()) throw runtime_error("corrupt dense nodes");
+                    for (size_t k = 0; k < ids.size(); k++) {
+                        store(ids[k], lats[k], lons[k]);
+                    }
+                } else {
+                    group.skip();
+                }
+            }
+        }
+    }
+
+    // Great-circle distance between two nodes (dense indices)
+    double distanceMetres(int a, int b) const {
+        const double kRadians = 3.14159265358979323846 / 180 * 1e-7;
+        const double kEarthRadius = 6371008.8;
+        double lat1 = latitudes[a] * kRadians, lat2 = latitudes[b] * kRadians;
+        double dLat = lat2 - lat1;
+        double dLon = (longitudes[b] - longitudes[a]) * kRadians;
+        double h = sin(dLat / 2) * sin(dLat / 2) + cos(lat1) * cos(lat2) * sin(dLon / 2) * sin(dLon / 2);
+        return 2 * kEarthRadius * asin(min(1.0, sqrt(h)));
+    }
+
+    ThreadPool* pool;
+    vector<int> latitudes;   // By dense node, 1e-7 degrees; INT_MIN = not seen yet
+    vector<int> longitudes;
+};
+
+// Load an OpenStreetMap PBF extract into g, replacing its edges and node
+// locations (see OsmPbfReader); osmIds[id - 1] is the OSM id of node id
+static bool importOsmPbf(Graph& g, const string& filename, bool largestComponent, vector<long long>& osmIds,
+                         string& error) {
+    vector<Graph::Arc> edges;
+    OsmPbfReader reader(g.threadPool());
+    if (!reader.read(filename, edges, osmIds, error)) return false;
+    g.clearNodeLocations();
+    g.assignEdges(edges, largestComponent);
+    const CSRGraph& csr = g.csr();
+    vector<int> ids(csr.nodeIds.begin(), csr.nodeIds.end());
+    vector<int> latitudes(ids.size());
+    vector<int> longitudes(ids.size());
+    for (size_t k = 0; k < ids.size(); k++) {
+        latitudes[k] = reader.latitude(ids[k] - 1);
+        longitudes[k] = reader.longitude(ids[k] - 1);
+    }
+    g.setNodeLocations(ids, latitudes, longitudes);
+    return true;
+}
+
+// Split g into numCells shards for serving across several processes or
+// machines (see ShardRouter). prefix.cell<k>.bin holds the edges inside
+// cell k as a plain graph file, for a `serve --graph` process to answer
+// queries on. prefix.overlay.bin holds the boundary nodes of all cells,
+// joined by the cut edges and, inside each cell, by the shortest distance
+// through the cell between every two of its boundary nodes; its
+// kSectionCellMap gives the cell of every node. A shortest path alternates
+// between stretches inside one cell and cut edges, so an overlay search
+// between per-cell searches at both ends is exact. Edges are taken as
+// undirected, as addEdge makes them.
+struct ShardSummary {
+    long long cutEdges = 0;
+    int boundaryNodes = 0;
+    long long overlayArcs = 0;
+    int largestCell = 0;  // Nodes
+};
+
+static bool writeShards(Graph& g, int numCells, const string& prefix, ShardSummary& summary, string& error) {
+    const CSRGraph& csr = g.csr();
+    int n = csr.numNodes();
+    vector<int> cellOf = GraphPartitioner::partition(csr, numCells);
+
+    vector<vector<Graph::Arc>> inside(numCells);
+    vector<Graph::Arc> overlayEdges;
+    vector<char> boundary(n, 0);
+    for (int u = 0; u < n; u++) {
+        for (int e = csr.offsets[u]; e < csr.offsets[u + 1]; e++) {
+            int v = csr.targets[e];
+            if (u >= v) continue; // Each edge once, from its lower end
+            Graph::Arc edge = {csr.nodeIds[u], csr.nodeIds[v], csr.weights[e]};
+            if (cellOf[u] == cellOf[v]) {
+                inside[cellOf[u]].push_back(edge);
+            } else {
+                boundary[u] = boundary[v] = 1;
+                overlayEdges.push_back(edge);
+                summary.cutEdges++;
+            }
+        }
+    }
+    vector<vector<int>> borders(numCells);
+    for (int k = 0; k < n; k++) {
+        int v = csr.byRank(k);
+        if (boundary[v]) borders[cellOf[v]].push_back(csr.nodeIds[v]);
+    }
+    vector<int> cellSizes(numCells, 0);
+    for (int v = 0; v < n; v++) cellSizes[cellOf[v]]++;
+    summary.largestCell = *max_element(cellSizes.begin(), cellSizes.end());
+
+    for (int cell = 0; cell < numCells; cell++) {
+        Graph shard;
+        shard.setThreadPool(g.threadPool());
+        shard.assignEdges(inside[cell], false);
+        DistanceMatrix through = shard.calculateDistanceMatrix(borders[cell]);
+        for (int i = 0; i < through.size(); i++) {
+            for (int j = i + 1; j < through.size(); j++) {
+                if (through.reachable(i, j)) overlayEdges.push_back({borders[cell][i], borders[cell][j], through.distance(i, j)});
+            }
+        }
+        string filename = prefix + ".cell" + to_string(cell) + ".bin";
+        if (!shard.saveBinary(filename)) {
+            error = "cannot write " + filename;
+            return false;
+        }
+    }
+
+    vector<int> cellMap;
+    cellMap.reserve(2 * n);
+    for (int k = 0; k < n; k++) {
+        cellMap.push_back(csr.nodeIds[csr.byRank(k)]);
+        cellMap.push_back(cellOf[csr.byRank(k)]);
+    }
+    Graph overlay;
+    overlay.assignEdges(overlayEdges, false);
+    summary.boundaryNodes = overlay.csr().numNodes();
+    summary.overlayArcs = overlay.csr().targets.size();
+    string filename = prefix + ".overlay.bin";
+    if (!overlay.saveBinary(filename, {{kSectionCellMap, {(const char*)cellMap.data(), cellMap.size() * sizeof(int)}}})) {
+        error = "cannot write " + filename;
+        return false;
+    }
+    return true;
+}
+
+// Answers path, batch and matrix requests on a graph split by writeShards,
+// with one shard server per cell (`serve --graph prefix.cell<k>.bin --port
+// P`, on any machine) and only the overlay in this process. A path query
+// asks the shards of both ends for the distances between the end and the
+// boundary nodes of its cell, searches the overlay in between, then asks
+// the shards along the way for the pieces of the path. Each round goes to
+// all shards involved at once, so a query costs two round trips whatever
+// the number of cells.
+class ShardRouter {
+public:
+    ~ShardRouter() {
+#ifndef _WIN32
+        for (unique_ptr<Shard>& shard : shards) {
+            for (int fd : shard->idle) close(fd);
+        }
+#endif
+    }
+
+    // Load the overlay written by writeShards; addresses are "host:port"
+    // of the shard servers in cell order. They are connected to on first use.
+    bool open(const string& overlayFile, const vector<string>& addresses, ThreadPool* pool, string& error) {
+        GraphFileReader reader;
+        const char* cells;
+        uint64_t bytes;
+        if (!overlay.loadBinary(overlayFile) || !reader.open(overlayFile) ||
+            !reader.section(kSectionCellMap, UINT64_MAX, cells, bytes) || bytes % (2 * sizeof(int)) != 0) {
+            error = "not a shard overlay file: " + overlayFile;
+            return false;
+        }
+        cellMap = ArrayView<int>((const int*)cells, bytes / sizeof(int));
+        mapStorage = reader.file;
+        int numCells = 0;
+        for (size_t k = 0; k < cellMap.size(); k += 2) {
+            if (cellMap[k + 1] < 0 || (k > 0 && cellMap[k] <= cellMap[k - 2])) {
+                error = "corrupt cell map in " + overlayFile;
+                return false;
+            }
+            numCells = max(numCells, cellMap[k + 1] + 1);
+        }
+        if ((int)addresses.size() != numCells) {
+            error = "the overlay has " + to_string(numCells) + " cells but " + to_string(addresses.size()) +
+                    " shard addresses were given";
+            return false;
+        }
+        for (const string& address : addresses) {
+            size_t colon = address.rfind(':');
+            if (colon == string::npos || colon == 0 || colon + 1 == address.size()) {
+                error = "shard address must be host:port: " + address;
+                return false;
+            }
+            shards.emplace_back(new Shard());
+            shards.back()->host = address.substr(0, colon);
+            shards.back()->port = address.substr(colon + 1);
+        }
+
+        overlay.setThreadPool(pool);
+        const CSRGraph& g = overlay.csr();
+        borders.assign(numCells, {});
+        for (int k = 0; k < g.numNodes(); k++) {
+            int id = g.nodeIds[g.byRank(k)];
+            int cell = cellOf(id);
+            if (cell < 0) {
+                error = "overlay node " + to_string(id) + " has no cell";
+                return false;
+            }
+            borders[cell].push_back(id);
+        }
+        return true;
+    }
+
+    // Cell of a node id, -1 if the graph has no such node
+    int cellOf(int nodeId) const {
+        size_t low = 0, high = cellMap.size() / 2;
+        while (low < high) {
+            size_t middle = (low + high) / 2;
+            if (cellMap[2 * middle] < nodeId) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return low < cellMap.size() / 2 && cellMap[2 * low] == nodeId ? cellMap[2 * low + 1] : -1;
+    }
+
+    // Node ids of a shortest path from src to dest, empty if there is none
+    // or trace is false; distance is its length (INT_MAX if none). Without
+    // trace the query takes one round trip instead of two.
+    vector<int> path(int src, int dest, int& distance, bool trace = true) {
+        distance = INT_MAX;
+        int from = cellOf(src), to = cellOf(dest);
+        if (from < 0 || to < 0) return vector<int>();
+        if (src == dest) {
+            distance = 0;
+            return vector<int>(1, src);
+        }
+
+        // Round 1: src to its cell's boundary, dest to its cell's, and src
+        // to dest directly when they share a cell
+        vector<vector<pair<int, int>>> queries(from == to ? 1 : 2);
+        for (int b : borders[from]) queries[0].push_back({src, b});
+        for (int b : borders[to]) queries.back().push_back({dest, b});
+        if (from == to) queries[0].push_back({src, dest});
+        vector<vector<int>> answers = distances({from, to}, queries);
+        const vector<int>& leave = answers[0];
+        const vector<int>& enter = answers.back();
+        size_t enterFirst = from == to ? borders[from].size() : 0;
+        long long direct = from == to && answers[0].back() >= 0 ? answers[0].back() : LLONG_MAX;
+
+        vector<pair<int, long long>> seeds;
+        for (size_t k = 0; k < borders[from].size(); k++) {
+            if (leave[k] >= 0) seeds.push_back({borders[from][k], leave[k]});
+        }
+        vector<pair<int, long long>> exits;
+        for (size_t k = 0; k < borders[to].size(); k++) {
+            if (enter[enterFirst + k] >= 0) exits.push_back({borders[to][k], enter[enterFirst + k]});
+        }
+        vector<int> via; // Overlay nodes of the best route, if it beats the direct one
+        long long best = overlaySearch(seeds, src, exits, dest, direct, via);
+        if (best == LLONG_MAX) return vector<int>();
+        distance = (int)min(best, (long long)INT_MAX - 1);
+        if (!trace) return vector<int>();
+
+        // Round 2: the pieces inside cells; cut edges join them as they are
+        vector<tuple<int, int, int>> pieces; // (cell, from, to), in path order
+        if (via.empty()) {
+            pieces.push_back({from, src, dest});
+        } else {
+            if (via.front() != src) pieces.push_back({from, src, via.front()});
+            for (size_t k = 0; k + 1 < via.size(); k++) {
+                int cell = cellOf(via[k]);
+                if (cell == cellOf(via[k + 1])) pieces.push_back({cell, via[k], via[k + 1]});
+            }
+            if (via.back() != dest) pieces.push_back({to, via.back(), dest});
+        }
+        vector<vector<int>> segments = paths(pieces);
+        vector<int> result(1, src);
+        size_t piece = 0;
+        auto append = [&](int a, int b) {
+            if (piece < pieces.size() && get<1>(pieces[piece]) == a && get<2>(pieces[piece]) == b) {
+                const vector<int>& segment = segments[piece++];
+                if (segment.empty()) throw runtime_error("shard " + to_string(get<0>(pieces[piece - 1])) + " lost a path");
+                result.insert(result.end(), segment.begin() + 1, segment.end());
+            } else {
+                result.push_back(b); // Cut edge
+            }
+        };
+        if (via.empty()) {
+            append(src, dest);
+        } else {
+            if (via.front() != src) append(src, via.front());
+            for (size_t k = 0; k + 1 < via.size(); k++) append(via[k], via[k + 1]);
+            if (via.back() != dest) append(via.back(), dest);
+        }
+        return result;
+    }
+
+    // Distances between every pair of nodes: one round to the shards of
+    // the nodes' cells, then an overlay search per node on the thread pool
+    DistanceMatrix distanceMatrix(const vector<int>& nodes) {
+        int n = nodes.size();
+        DistanceMatrix result(n);
+        vector<int> cells(n);
+        map<int, vector<int>> stopsOf; // Cell -> positions in nodes
+        for (int i = 0; i < n; i++) {
+            cells[i] = cellOf(nodes[i]);
+            if (cells[i] >= 0) stopsOf[cells[i]].push_back(i);
+        }
+
+        // Per cell: each of its nodes to all of them, then to its boundary
+        vector<int> involved;
+        vector<vector<pair<int, int>>> queries;
+        vector<int> slot(n, -1); // Position of node i among its cell's nodes
+        for (const auto& entry : stopsOf) {
+            involved.push_back(entry.first);
+            queries.emplace_back();
+            const vector<int>& stops = entry.second;
+            for (size_t k = 0; k < stops.size(); k++) slot[stops[k]] = k;
+            for (int i : stops) {
+                for (int j : stops) queries.back().push_back({nodes[i], nodes[j]});
+                for (int b : borders[entry.first]) queries.back().push_back({nodes[i], b});
+            }
+        }
+        vector<vector<int>> answers = distances(involved, queries);
+        vector<const int*> rowOf(n, nullptr); // Distances of node i to its cell's nodes, then boundary
+        vector<int> boundaryAt(n, 0);         // Where the boundary starts in rowOf[i]
+        for (size_t c = 0; c < involved.size(); c++) {
+            const vector<int>& stops = stopsOf.at(involved[c]);
+            size_t width = stops.size() + borders[involved[c]].size();
+            for (size_t k = 0; k < stops.size(); k++) {
+                rowOf[stops[k]] = answers[c].data() + k * width;
+                boundaryAt[stops[k]] = stops.size();
+            }
+        }
+
+        // The rows run concurrently and only read the arrays above
+
+        const CSRGraph& g = overlay.csr();
+        forEachIndex(overlay.threadPool(), n, [&](int, int i) {
+            vector<int> row(n, INT_MAX);
+            row[i] = 0;
+            if (cells[i] >= 0) {
+                vector<pair<int, long long>> seeds;
+                const vector<int>& border = borders[cells[i]];
+                size_t first = boundaryAt[i];
+                for (size_t k = 0; k < border.size(); k++) {
+                    if (rowOf[i][first + k] >= 0) seeds.push_back({border[k], rowOf[i][first + k]});
+                }
+                const vector<long long>& reach = settleOverlay(seeds, nodes[i]);
+                for (int j = 0; j < n; j++) {
+                    if (cells[j] < 0) continue;
+                    long long best = i == j ? 0 : LLONG_MAX;
+                    if (cells[j] == cells[i] && rowOf[i][slot[j]] >= 0) best = min(best, (long long)rowOf[i][slot[j]]);
+                    const vector<int>& targetBorder = borders[cells[j]];
+                    size_t targetFirst = boundaryAt[j];
+                    for (size_t k = 0; k < targetBorder.size(); k++) {
+                        long long through = reach[g.index(targetBorder[k])];
+                        int last = rowOf[j][targetFirst + k];
+                        if (through != LLONG_MAX && last >= 0) best = min(best, through + last);
+                    }
+                    int own = g.index(nodes[j]);
+                    if (own >= 0) best = min(best, reach[own]);
+                    if (best != LLONG_MAX) row[j] = (int)min(best, (long long)INT_MAX - 1);
+                }
+            }
+            result.setRow(i, row);
+        });
+        return result;
+    }
+
+private:
+    // Longest wait for a shard to accept, take or answer a request
+    static constexpr int kTimeoutSeconds = 10;
+
+    // Connections to one shard server, kept open between requests; each
+    // carries one request at a time
+    struct Shard {
+        string host;
+        string port;
+        mutex lock;
+        vector<int> idle;
+    };
+
+    // Multi-source search over the overlay from src's seeds (plus src if it
+    // is a boundary node) to dest's exits, pruned at bound. Returns the best
+    // distance found below bound, filling via with the overlay route of it,
+    // or bound itself with via empty.
+    long long overlaySearch(const vector<pair<int, long long>>& seeds, int src,
+                            const vector<pair<int, long long>>& exits, int dest, long long bound, vector<int>& via) {
+        const CSRGraph& g = overlay.csr();
+        vector<long long> exitCost(g.numNodes(), LLONG_MAX);
+        for (const pair<int, long long>& exit : exits) {
+            int v = g.index(exit.first);
+            exitCost[v] = min(exitCost[v], exit.second);
+        }
+        if (g.index(dest) >= 0) exitCost[g.index(dest)] = 0;
+        vector<long long> dist(g.numNodes(), LLONG_MAX);
+        vector<int> parent(g.numNodes(), -1);
+        priority_queue<pair<long long, int>, vector<pair<long long, int>>, greater<pair<long long, int>>> queue;
+        auto seed = [&](int id, long long d) {
+            int v = g.index(id);
+            if (d < dist[v]) {
+                dist[v] = d;
+                queue.push({d, v});
+            }
+        };
+        for (const pair<int, long long>& s : seeds) seed(s.first, s.second);
+        if (g.index(src) >= 0) seed(src, 0);
+        long long best = bound;
+        int last = -1;
+        while (!queue.empty()) {
+            pair<long long, int> top = queue.top();
+            queue.pop();
+            int u = top.second;
+            if (top.first != dist[u]) continue;
+            if (top.first >= best) break;
+            if (exitCost[u] != LLONG_MAX && top.first + exitCost[u] < best) {
+                best = top.first + exitCost[u];
+                last = u;
+            }
+            for (int e = g.offsets[u]; e < g.offsets[u + 1]; e++) {
+                int v = g.targets[e];
+                if (top.first + g.weights[e] < dist[v]) {
+                    dist[v] = top.first + g.weights[e];
+                    parent[v] = u;
+                    queue.push({dist[v], v});
+                }
+            }
+        }
+        via.clear();
+        for (int v = last; v >= 0; v = parent[v]) via.push_back(g.nodeIds[v]);
+        reverse(via.begin(), via.end());
+        return best;
+    }
+
+    // Distance to every overlay node (dense index) from the seeds plus
+    // src if it is a boundary node; reused per thread
+    const vector<long long>& settleOverlay(const vector<pair<int, long long>>& seeds, int src) {
+        const CSRGraph& g = overlay.csr();
+        thread_local vector<long long> dist;
+        dist.assign(g.numNodes(), LLONG_MAX);
+        priority_queue<pair<long long, int>, vector<pair<long long, int>>, greater<pair<long long, int>>> queue;
+        auto seed = [&](int v, long long d) {
+            if (v >= 0 && d < dist[v]) {
+                dist[v] = d;
+                queue.push({d, v});
+            }
+        };
+        for (const pair<int, long long>& s : seeds) seed(g.index(s.first), s.second);
+        seed(g.index(src), 0);
+        while (!queue.empty()) {
+            pair<long long, int> top = queue.top();
+            queue.pop();
+            if (top.first != dist[top.second]) continue;
+            for (int e = g.offsets[top.second]; e < g.offsets[top.second + 1]; e++) {
+                seed(g.targets[e], top.first + g.weights[e]);
+            }
+        }
+        return dist;
+    }
+
+    // Distances for the (src, dest) queries sent to each cell, -1 where
+    // there is no path; cells may repeat, asking that shard once
+    vector<vector<int>> distances(const vector<int>& cells, const vector<vector<pair<int, int>>>& queries) {
+        vector<pair<int, string>> requests;
+        for (size_t k = 0; k < queries.size(); k++) {
+            string line;
+            JsonWriter out(&line);
+            out.raw("{\"type\": \"batch\", \"paths\": false, \"queries\": [");
+            for (size_t q = 0; q < queries[k].size(); q++) {
+                if (q > 0) out.raw(", ");
+                out.raw('[').number(queries[k][q].first).raw(", ").number(queries[k][q].second).raw(']');
+            }
+            out.raw("]}");
+            requests.push_back({cells[k], move(line)});
+        }
+        vector<JsonValue> responses = ask(requests);
+        vector<vector<int>> result;
+        for (size_t k = 0; k < responses.size(); k++) {
+            const JsonValue* values = responses[k].get("distances");
+            if (values == nullptr || values->type != JsonValue::Array || values->items.size() != queries[k].size()) {
+                throw runtime_error("unexpected response from shard " + to_string(cells[k]));
+            }
+            result.emplace_back();
+            for (const JsonValue& value : values->items) result.back().push_back((int)value.number);
+        }
+        return result;
+    }
+
+    // Node ids of the shortest path inside the cell for each (cell, from, to)
+    vector<vector<int>> paths(const vector<tuple<int, int, int>>& pieces) {
+        map<int, vector<size_t>> byCell;
+        for (size_t k = 0; k < pieces.size(); k++) byCell[get<0>(pieces[k])].push_back(k);
+        vector<pair<int, string>> requests;
+        for (const auto& entry : byCell) {
+            string line;
+            JsonWriter out(&line);
+            out.raw("{\"type\": \"batch\", \"queries\": [");
+            for (size_t q = 0; q < entry.second.size(); q++) {
+                const tuple<int, int, int>& piece = pieces[entry.second[q]];
+                if (q > 0) out.raw(", ");
+                out.raw('[').number(get<1>(piece)).raw(", ").number(get<2>(piece)).raw(']');
+            }
+            out.raw("]}");
+            requests.push_back({entry.first, move(line)});
+        }
+        vector<JsonValue> responses = ask(requests);
+        vector<vector<int>> result(pieces.size());
+        size_t r = 0;
+        for (const auto& entry : byCell) {
+            const JsonValue* results = responses[r].get("results");
+            if (results == nullptr || results->type != JsonValue::Array || results->items.size() != entry.second.size()) {
+                throw runtime_error("unexpected response from shard " + to_string(entry.first));
+            }
+            for (size_t q = 0; q < entry.second.size(); q++) {
+                const JsonValue* path = results->items[q].get("path");
+                if (path == nullptr || path->type != JsonValue::Array) {
+                    throw runtime_error("unexpected response from shard " + to_string(entry.first));
+                }
+                for (const JsonValue& node : path->items) result[entry.second[q]].push_back((int)node.number);
+            }
+            r++;
+        }
+        return result;
+    }
+
+    // Send every (cell, request line) to its shard before reading any
+    // response, so the shards work on them at the same time. Throws on a
+    // connection failure or an error response.
+    vector<JsonValue> ask(const vector<pair<int, string>>& requests) {
+#ifndef _WIN32
+        vector<int> fds(requests.size(), -1);
+        vector<JsonValue> responses(requests.size());
+        try {
+            for (size_t k = 0; k < requests.size(); k++) {
+                fds[k] = acquire(requests[k].first);
+                string line = requests[k].second + "\n";
+                size_t sent = 0;
+                while (sent < line.size()) {
+                    ssize_t written = ::send(fds[k], line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+                    if (written <= 0) throw runtime_error("shard " + to_string(requests[k].first) + " went away");
+                    sent += written;
+                }
+            }
+            string line;
+            char buffer[65536];
+            for (size_t k = 0; k < requests.size(); k++) {
+                // One response line per request, and nothing after it
+                line.clear();
+                while (line.empty() || line.back() != '\n') {
+                    ssize_t received = recv(fds[k], buffer, sizeof(buffer), 0);
+                    if (received <= 0) throw runtime_error("shard " + to_string(requests[k].first) + " went away");
+                    line.append(buffer, received);
+                }
+                string error;
+                if (!JsonValue::parse(line, responses[k], error)) {
+                    throw runtime_error("invalid response from shard " + to_string(requests[k].first));
+                }
+                const JsonValue* message = responses[k].get("error");
+                if (message != nullptr) throw runtime_error("shard " + to_string(requests[k].first) + ": " + message->str);
+                release(requests[k].first, fds[k]);
+                fds[k] = -1;
+            }
+        } catch (...) {
+            for (int fd : fds) {
+                if (fd >= 0) close(fd);
+            }
+            throw;
+        }
+        return responses;
+#else
+        (void)requests;
+        throw runtime_error("shard routing is not supported on this platform");
+#endif
+    }
+
+#ifndef _WIN32
+    int acquire(int cell) {
+        Shard& shard = *shards[cell];
+        {
+            lock_guard<mutex> lock(shard.lock);
+            if (!shard.idle.empty()) {
+                int fd = shard.idle.back();
+                shard.idle.pop_back();
+                return fd;
+            }
+        }
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* found = nullptr;
+        if (getaddrinfo(shard.host.c_str(), shard.port.c_str(), &hints, &found) != 0) {
+            throw runtime_error("cannot resolve shard " + to_string(cell) + " at " + shard.host);
+        }
+        // A stalled shard fails the queries that need it instead of holding
+        // their workers forever; on Linux the send timeout bounds connect too
+        timeval timeout = {kTimeoutSeconds, 0};
+        int fd = -1;
+        for (addrinfo* a = found; a != nullptr && fd < 0; a = a->ai_next) {
+            fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (fd < 0) continue;
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            if (connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(found);
+        if (fd < 0) throw runtime_error("cannot connect to shard " + to_string(cell) + " at " + shard.host + ":" + shard.port);
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        return fd;
+    }
+
+    void release(int cell, int fd) {
+        lock_guard<mutex> lock(shards[cell]->lock);
+        shards[cell]->idle.push_back(fd);
+    }
+#endif
+
+    Graph overlay;
+    ArrayView<int> cellMap;               // (node id, cell) pairs, ids ascending
+    shared_ptr<const void> mapStorage;
+    vector<vector<int>> borders;          // Boundary node ids of each cell, ascending
+    vector<unique_ptr<Shard>> shards;
+};
+
+// Pickup/destination details for each user id; pretty = the indented layout
+// used by the CLI, otherwise one line. Unknown ids get empty strings.
+static void writeUserDetails(JsonWriter& out, const Graph& g, const vector<int>& userIds, bool pretty) {
+    static const UserInfo noUser;
+    for (size_t i = 0; i < userIds.size(); i++) {
+        const UserInfo* info = g.findUser(userIds[i]);
+        if (info == nullptr) info = &noUser;
+        if (pretty) {
+            out.raw("    {\n");
+            out.raw("      \"user_id\": ").number(userIds[i]).raw(",\n");
+            out.raw("      \"name\": ").str(info->name).raw(",\n");
+            out.raw("      \"pickup\": ").str(info->pickup).raw(",\n");
+            out.raw("      \"destination\": ").str(info->destination).raw("\n");
+            out.raw("    }");
+            if (i < userIds.size() - 1) out.raw(',');
+            out.raw('\n');
+        } else {
+            if (i > 0) out.raw(", ");
+            out.raw("{\"user_id\": ").number(userIds[i]);
+            out.raw(", \"name\": ").str(info->name);
+            out.raw(", \"pickup\": ").str(info->pickup);
+            out.raw(", \"destination\": ").str(info->destination).raw('}');
+        }
+    }
+}
+
+// Fleet plan as "routes", "distance" and "unassigned"; stops maps plan
+// indices to node ids. Each route carries its node-by-node "path" like the
+// single-route modes, stitched from the matrix search trees.
+static void writeFleetPlan(JsonWriter& out, Graph& g, const FleetPlan& plan, const vector<int>& stops,
+                           const vector<shared_ptr<const PathTree>>& trees, bool pretty) {
+    out.raw(pretty ? "  \"routes\": [\n" : "\"routes\": [");
+    for (size_t r = 0; r < plan.routes.size(); r++) {
+        const VehicleRoute& route = plan.routes[r];
+        vector<int> visited(1, stops[route.depot]);
+        for (int stop : route.stops) visited.push_back(stops[stop]);
+        visited.push_back(stops[route.depot]);
+        if (r > 0) out.raw(pretty ? ",\n" : ", ");
+        out.raw(pretty ? "    {\"vehicle\": " : "{\"vehicle\": ").number(r);
+        out.raw(", \"depot\": ").number(stops[route.depot]);
+        out.raw(", \"stops\": ").intArray(visited);
+        out.raw(", \"load\": ").number(route.load);
+        out.raw(", \"distance\": ").number(route.distance);
+        out.raw(", \"path\": ").intArray(g.expandRoute(visited, trees)).raw('}');
+    }
+    vector<int> unassigned;
+    for (int stop : plan.unassigned) unassigned.push_back(stops[stop]);
+    out.raw(pretty ? "\n  ],\n  \"distance\": " : "], \"distance\": ").number(plan.distance);
+    out.raw(pretty ? ",\n  \"unassigned\": " : ", \"unassigned\": ").intArray(unassigned);
+}
+
+// The work counters of the request running on this thread as a "stats"
+// member, following a previous one; nothing unless built with
+// -DVRP_ENABLE_STATS
+static void writeQueryStats(JsonWriter& out, bool pretty) {
+#ifdef VRP_ENABLE_STATS
+    const QueryStats* stats = activeStats();
+    if (stats == nullptr) return;
+    out.raw(pretty ? ",\n  \"stats\": {\"settled\": " : ", \"stats\": {\"settled\": ").number(stats->settled);
+    out.raw(", \"relaxed\": ").number(stats->relaxed);
+    out.raw(", \"heap_pushes\": ").number(stats->pushes);
+    out.raw(", \"heap_pops\": ").number(stats->pops);
+    out.raw(", \"stale_pops\": ").number(stats->stalePops);
+    out.raw(", \"cache_hits\": ").number(stats->cacheHits);
+    out.raw(", \"cache_misses\": ").number(stats->cacheMisses);
+    out.raw(", \"tour_scans\": ").number(stats->tourScans);
+    out.raw(", \"tour_moves\": ").number(stats->tourMoves);
+    if (const RequestArena* arena = activeArena()) {
+        out.raw(", \"arena_allocations\": ").number(arena->numAllocations());
+        out.raw(", \"arena_bytes\": ").number(arena->numBytes());
+    }
+    out.raw(", \"matrix_us\": ").number(stats->matrixNanos / 1000);
+    out.raw(", \"tsp_us\": ").number(stats->tspNanos / 1000);
+    out.raw(", \"stitch_us\": ").number(stats->stitchNanos / 1000).raw('}');
+#else
+    (void)out;
+    (void)pretty;
+#endif
+}
+
+// One vehicle's open tour for live dispatch, kept between requests together
+// with its stop matrix, so that a rider joining or cancelling costs one search
+// and a local repair instead of a new plan. stops[0] is where the vehicle is
+// and stays first. A new stop gets the one matrix row (and, the graph being
+// undirected, column) it needs, goes into the gap where it adds the least and
+// the tour is then improved starting from the stops around the change; a
+// removed stop is cut out and its former neighbours are repaired the same way.
+class LiveRoute {
+public:
+    // Plan from scratch over distinct stops, the vehicle's position first
+    void plan(Graph& g, const vector<int>& nodes) {
+        stops = nodes;
+        d = g.calculateDistanceMatrix(stops);
+        nearest = TourImprover::nearestNeighbors(d, TourImprover::kNeighbors);
+        tour = g.solveTSP(d);
+    }
+
+    // Recompute the matrix after the edge weights changed, keeping the tour
+    // as the starting point of a (capped) local search over all of it
+    void refresh(Graph& g) {
+        d = g.calculateDistanceMatrix(stops);
+        nearest = TourImprover::nearestNeighbors(d, TourImprover::kNeighbors);
+        double budget = g.tspTimeBudgetMs();
+        if (budget != 0) TourImprover(d, nearest).improve(tour, budget < 0 || budget > kRepairBudgetMs ? kRepairBudgetMs : budget);
+    }
+
+    // Insert node at its cheapest place; false if it already is a stop
+    bool add(Graph& g, int node) {
+        if (stops.empty()) {
+            plan(g, vector<int>(1, node));
+            return true;
+        }
+        if (find(stops.begin(), stops.end(), node) != stops.end()) return false;
+        vector<int> row = g.distancesFrom(node, stops);
+        int k = stops.size();
+        stops.push_back(node);
+        d.resize(k + 1);
+        for (int j = 0; j < k; j++) {
+            d.setDistance(k, j, row[j]);
+            d.setDistance(j, k, row[j]);
+        }
+        d[k][k] = 0;
+        nearest.emplace_back();
+        refillNeighbors(k);
+        for (int a = 0; a < k; a++) placeNeighbor(a, k);
+
+        // Gap x lies after tour[x]; the last one is the open end
+        int m = tour.size();
+        in.resize(m);
+        out.resize(m);
+        leg.resize(m);
+        delta.resize(m);
+        for (int x = 0; x < m; x++) {
+            bool end = x == m - 1;
+            in[x] = d[tour[x]][k];
+            out[x] = end ? 0 : d[k][tour[x + 1]];
+            leg[x] = end ? 0 : d[tour[x]][tour[x + 1]];
+        }
+        simd().gapDeltas(in.data(), out.data(), leg.data(), m, delta.data());
+        int best = min_element(delta.begin(), delta.end()) - delta.begin();
+        tour.insert(tour.begin() + best + 1, k);
+        repair(g, best + 1);
+        return true;
+    }
+
+    // Drop a stop other than the vehicle's position; false if node is not one
+    bool remove(Graph& g, int node) {
+        int k = find(stops.begin() + min((size_t)1, stops.size()), stops.end(), node) - stops.begin();
+        if (k >= (int)stops.size()) return false;
+        stops.erase(stops.begin() + k);
+        d.erase(k);
+        int at = find(tour.begin(), tour.end(), k) - tour.begin();
+        tour.erase(tour.begin() + at);
+        for (int& stop : tour) stop -= stop > k;
+        nearest.erase(nearest.begin() + k);
+        for (int a = 0; a < (int)nearest.size(); a++) {
+            vector<int>& list = nearest[a];
+            bool listed = find(list.begin(), list.end(), k) != list.end();
+            for (int& b : list) b -= b > k;
+            if (listed) refillNeighbors(a); // Its next nearest moves up
+        }
+        if (at < (int)tour.size()) repair(g, at); // Around the new leg tour[at - 1] -> tour[at]
+        return true;
+    }
+
+    // The vehicle is now at node: replace its position's row and column.
+    // Reaching a pending stop serves it, so that stop is dropped rather than
+    // left in the tour next to the position. Needs a planned route.
+    void moveTo(Graph& g, int node) {
+        if (isStop(node)) remove(g, node);
+        stops[0] = node;
+        vector<int> row = g.distancesFrom(node, stops);
+        for (int j = 1; j < (int)stops.size(); j++) {
+            d.setDistance(0, j, row[j]);
+            d.setDistance(j, 0, row[j]);
+        }
+        refillNeighbors(0);
+        for (int a = 1; a < (int)stops.size(); a++) {
+            vector<int>& list = nearest[a];
+            if (find(list.begin(), list.end(), 0) != list.end()) {
+                refillNeighbors(a); // The position may have moved away
+            } else {
+                placeNeighbor(a, 0);
+            }
+        }
+        if (tour.size() > 1) repair(g, 1);
+    }
+
+    // Stop node ids in visiting order
+    vector<int> order() const {
+        vector<int> result;
+        for (int stop : tour) result.push_back(stops[stop]);
+        return result;
+    }
+
+    // Length of the tour, -1 if a leg has no path
+    long long length() const {
+        long long total = 0;
+        for (size_t x = 1; x < tour.size(); x++) {
+            if (!d.reachable(tour[x - 1], tour[x])) return -1;
+            total += d[tour[x - 1]][tour[x]];
+        }
+        return total;
+    }
+
+    // Whether node is one of the stops after the vehicle's position
+    bool isStop(int node) const {
+        return stops.size() > 1 && find(stops.begin() + 1, stops.end(), node) != stops.end();
+    }
+
+    int position() const { return stops.empty() ? -1 : stops[0]; }
+
+private:
+    // Local search from the stops around tour[at] (the ones whose edges changed)
+    void repair(Graph& g, int at) {
+        double budget = g.tspTimeBudgetMs();
+        if (budget == 0) return;
+        vector<int> focus;
+        for (int x = max(0, at - 1); x <= min(at + 1, (int)tour.size() - 1); x++) focus.push_back(tour[x]);
+        TourImprover(d, nearest).improve(tour, budget < 0 || budget > kRepairBudgetMs ? kRepairBudgetMs : budget, &focus);
+    }
+
+    // Put stop b (not yet listed) into the nearest list of a if it is near enough
+    void placeNeighbor(int a, int b) {
+        vector<int>& list = nearest[a];
+        auto place = upper_bound(list.begin(), list.end(), b,
+                                 [&](int x, int y) { return make_pair(d[a][x], x) < make_pair(d[a][y], y); });
+        if (list.size() < (size_t)TourImprover::kNeighbors) {
+            list.insert(place, b);
+        } else if (place != list.end()) {
+            list.insert(place, b);
+            list.pop_back();
+        }
+    }
+
+    // Nearest list of a from scratch, as TourImprover::nearestNeighbors has it
+    void refillNeighbors(int a) {
+        vector<int>& list = nearest[a];
+        list.clear();
+        for (int b = 0; b < (int)stops.size(); b++) {
+            if (b != a) list.push_back(b);
+        }
+        int count = min(TourImprover::kNeighbors, (int)list.size());
+        partial_sort(list.begin(), list.begin() + count, list.end(),
+                     [&](int x, int y) { return make_pair(d[a][x], x) < make_pair(d[a][y], y); });
+        list.resize(count);
+    }
+
+    // Cap on the local repair, so an add or remove stays well under a millisecond
+    static constexpr double kRepairBudgetMs = 0.2;
+
+    vector<int> stops;                 // Node ids; 0 = the vehicle's position
+    DistanceMatrix d;                  // Between stops
+    vector<vector<int>> nearest;       // TourImprover candidate lists
+    vector<int> tour;                  // Stop indices in visiting order, tour[0] = 0
+    vector<long long> in, out, leg, delta;  // Insertion scratch
+};
+
+// Long-running query daemon. It answers line-delimited JSON requests against
+// an already built Graph, one response line per request, tagged with the
+// request's "id". Requests are handled concurrently by a fixed set of worker
+// threads, so responses may come back out of order. An "update" request
+// changes edge weights on a copy of the graph and swaps it in once it is
+// ready; every other request runs entirely on the graph it started with.
+//
+//   {"id": 1, "type": "path", "src": 1, "dest": 20}
+//   -> {"id": 1, "path": [1, 3, 9, 12, 20]}
+//   {"id": 2, "type": "tsp", "users": [1, 5, 9]}
+//   -> {"id": 2, "path": [...], "details": [...]}
+//   {"id": 3, "type": "cvrp", "depots": [1], "customers": [4, 9, 17], "capacity": 2}
+//   -> {"id": 3, "routes": [{"vehicle": 0, ..., "path": [...]}, ...], ...}
+//   {"id": 4, "type": "stats"}
+//   -> {"id": 4, "version": 0, "cache": {"distance_hits": 12, ...}}
+//   {"id": 5, "type": "update", "edges": [[1, 2, 9], [2, 3, 4]]}
+//   -> {"id": 5, "updated": 2, "version": 1}
+//   {"id": 6, "type": "path", "src": 1, "dest": 20, "departure": 28800}
+//   -> {"id": 6, "path": [...], "travel_time": 31}
+//   {"id": 7, "type": "profile", "src": 1, "targets": [4, 20]}
+//   -> {"id": 7, "profiles": [[[0, 11], [25200, 19], ...], [[0, 23]]]}
+//   {"id": 8, "type": "batch", "queries": [[1, 20], [1, 4], [5, 9]]}
+//   -> {"id": 8, "results": [{"distance": 19, "path": [1, 3, 9, 12, 20]}, ...]}
+//   {"id": 9, "type": "metrics"}
+//   -> {"id": 9, "metrics": "# HELP vrp_requests_total ..."}
+//   {"id": 10, "type": "matrix", "nodes": [1, 5, 9], "file": "/tmp/m.bin"}
+//   -> {"id": 10, "file": "/tmp/m.bin", "size": 3, "cell_bytes": 4}
+//   {"id": 11, "type": "snap", "points": [[77.2090, 28.6139], [77.1025, 28.7041]]}
+//   -> {"id": 11, "snapped": [{"node": 412, "offset": 38, "distance": 6.21, "edge": [412, 977], ...}, ...]}
+//   {"id": 12, "type": "dispatch", "vehicle": 3, "stops": [1, 5, 9]}
+//   -> {"id": 12, "vehicle": 3, "stops": [1, 5, 9], "length": 21}
+//   {"id": 13, "type": "dispatch", "vehicle": 3, "add": 17}
+//   -> {"id": 13, "vehicle": 3, "stops": [1, 5, 17, 9], "length": 29}
+//
+// With a ShardRouter the graph is only the overlay of a sharded one: path,
+// batch and matrix requests (without "departure") are answered through the
+// shard servers, stats and metrics locally, and the rest is refused.
+//
+// In socket mode "GET /metrics" serves the same text over HTTP for a
+// Prometheus scraper. Built with -DVRP_ENABLE_STATS, every response also
+// carries the "stats" of its own request (nodes settled, edges relaxed, heap
+// operations, cache hits, phase times).
+class RouteServer {
+public:
+    RouteServer(Graph& graph, int numWorkers, ShardRouter* shardRouter = nullptr)
+        : current(make_shared<Snapshot>()), router(shardRouter) {
+        graph.freeze(); // Queries only read the graph from here on
+        current->graph = graph;
+        if (numWorkers <= 0) {
+            numWorkers = max(1u, thread::hardware_concurrency());
+        }
+        for (int w = 0; w < numWorkers; w++) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~RouteServer() {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueReady.notify_all();
+        for (thread& t : workers) {
+            t.join();
+        }
+    }
+
+    // Answer one request line with one response line (no trailing newline).
+    // The response is written into a caller-owned buffer reused across requests.
+    void handle(const string& line, string& response) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        int type = kNumRequestTypes;
+        bool ok = respond(line, response, type);
+        requestCounts[type].fetch_add(1, memory_order_relaxed);
+        if (!ok) requestErrors.fetch_add(1, memory_order_relaxed);
+        requestNanos.fetch_add(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count(),
+                               memory_order_relaxed);
+    }
+
+    string handle(const string& line) {
+        string response;
+        handle(line, response);
+        return response;
+    }
+
+    // Prometheus text exposition of the request counters, the cache and,
+    // in a -DVRP_ENABLE_STATS build, the search and solver counters
+    string metrics() {
+        shared_ptr<Snapshot> snapshot = atomic_load(&current);
+        ostringstream text;
+        text << "# HELP vrp_requests_total Requests answered, by type.\n# TYPE vrp_requests_total counter\n";
+        for (int t = 0; t <= kNumRequestTypes; t++) {
+            text << "vrp_requests_total{type=\"" << (t < kNumRequestTypes ? kRequestTypes[t] : "other") << "\"} "
+                 << requestCounts[t] << "\n";
+        }
+        text << "# HELP vrp_request_errors_total Requests answered with an error.\n# TYPE vrp_request_errors_total counter\n"
+             << "vrp_request_errors_total " << requestErrors << "\n";
+        text << "# HELP vrp_request_seconds_total Time spent answering requests.\n# TYPE vrp_request_seconds_total counter\n"
+             << "vrp_request_seconds_total " << requestNanos / 1e9 << "\n";
+        text << "# HELP vrp_graph_version Edge weight updates applied.\n# TYPE vrp_graph_version gauge\n"
+             << "vrp_graph_version " << snapshot->version << "\n";
+        if (RouteCache* cache = snapshot->graph.cache()) {
+            text << "# HELP vrp_cache_lookups_total Route cache lookups of the current graph version.\n"
+                 << "# TYPE vrp_cache_lookups_total counter\n"
+                 << "vrp_cache_lookups_total{kind=\"distance\",result=\"hit\"} " << cache->distanceHits << "\n"
+                 << "vrp_cache_lookups_total{kind=\"distance\",result=\"miss\"} " << cache->distanceMisses << "\n"
+                 << "vrp_cache_lookups_total{kind=\"path\",result=\"hit\"} " << cache->pathHits << "\n"
+                 << "vrp_cache_lookups_total{kind=\"path\",result=\"miss\"} " << cache->pathMisses << "\n";
+        }
+#ifdef VRP_ENABLE_STATS
+        const QueryStats& stats = processStats();
+        const pair<const char*, long long> counters[] = {
+            {"vrp_nodes_settled_total", stats.settled}, {"vrp_edges_relaxed_total", stats.relaxed},
+            {"vrp_heap_pushes_total", stats.pushes}, {"vrp_heap_pops_total", stats.pops},
+            {"vrp_stale_pops_total", stats.stalePops}, {"vrp_tour_scans_total", stats.tourScans},
+            {"vrp_tour_moves_total", stats.tourMoves}, {"vrp_arena_allocations_total", stats.arenaAllocations},
+            {"vrp_arena_bytes_total", stats.arenaBytes},
+        };
+        for (const auto& counter : counters) {
+            text << "# TYPE " << counter.first << " counter\n" << counter.first << " " << counter.second << "\n";
+        }
+        text << "# HELP vrp_phase_seconds_total Wall time by phase.\n# TYPE vrp_phase_seconds_total counter\n"
+             << "vrp_phase_seconds_total{phase=\"matrix\"} " << stats.matrixNanos / 1e9 << "\n"
+             << "vrp_phase_seconds_total{phase=\"tsp\"} " << stats.tspNanos / 1e9 << "\n"
+             << "vrp_phase_seconds_total{phase=\"stitch\"} " << stats.stitchNanos / 1e9 << "\n";
+#endif
+        return text.str();
+    }
+
+    // Serve requests from in until end of input, writing responses to out
+    void serveStream(istream& in, ostream& out) {
+        mutex outMutex;
+        string line;
+        while (getline(in, line)) {
+            if (line.find_first_not_of(" \t\r") == string::npos) continue;
+            submit([this, line, &out, &outMutex] {
+                thread_local string response;
+                handle(line, response);
+                response += '\n';
+                lock_guard<mutex> lock(outMutex);
+                out.write(response.data(), response.size());
+                out.flush();
+            });
+        }
+        waitIdle();
+    }
+
+#ifndef _WIN32
+    // Accept TCP connections on host:port (an IPv4 address, loopback by
+    // default; shard servers on other machines need e.g. 0.0.0.0) and serve
+    // each one like serveStream. Returns false if the port cannot be opened,
+    // otherwise never returns.
+    bool serveSocket(int port, const string& host = "127.0.0.1") {
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) return false;
+        int listener = socket(AF_INET, SOCK_STREAM, 0);
+        if (listener < 0) return false;
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (::bind(listener, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, 64) < 0) {
+            close(listener);
+            return false;
+        }
+
+        while (true) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0) continue;
+            thread([this, fd] { serveConnection(fd); }).detach();
+        }
+    }
+#endif
+
+private:
+    // What requests run against; replaced as a whole by handleUpdate
+    struct Snapshot {
+        Graph graph;
+        shared_ptr<RouteCache> cache;  // Owned here once an update replaced the caller's
+        long long version = 0;         // Updates applied so far
+    };
+
+    // Live dispatch state of one vehicle (see handleDispatch)
+    struct Vehicle {
+        mutex lock;
+        LiveRoute route;
+        long long version = 0; // Graph version its matrix was computed on
+    };
+
+    // Request types counted separately in the metrics; the rest are "other"
+    static constexpr const char* kRequestTypes[] = {"path", "batch", "profile", "matrix", "tsp",
+                                                    "pdp", "cvrp", "snap", "dispatch", "stats", "update", "metrics"};
+    static constexpr int kNumRequestTypes = sizeof(kRequestTypes) / sizeof(kRequestTypes[0]);
+
+    // The work of handle(); returns false for an error response. typeIndex
+    // is set once the request type is known.
+    bool respond(const string& line, string& response, int& typeIndex) {
+        response.clear();
+        JsonWriter out(&response);
+        out.raw('{');
+        JsonValue request;
+        string error;
+        if (!JsonValue::parse(line, request, error)) {
+            out.raw("\"error\": ").str("invalid JSON: " + error).raw('}');
+            return false;
+        }
+        if (request.type != JsonValue::Object) {
+            out.raw("\"error\": \"request must be a JSON object\"}");
+            return false;
+        }
+
+        if (const JsonValue* value = request.get("id")) {
+            if (value->isInt()) {
+                out.raw("\"id\": ").number((long long)value->number).raw(", ");
+            } else if (value->type == JsonValue::String) {
+                out.raw("\"id\": ").str(value->str).raw(", ");
+            }
+        }
+
+        size_t body = response.size();
+        shared_ptr<Snapshot> snapshot = atomic_load(&current);
+        Graph& g = snapshot->graph;
+        VRP_STATS(QueryStats stats);
+        VRP_STATS(StatsScope scope(&stats));
+        RequestArena arena;  // Scratch state of this request, released in one go
+        ArenaScope arenaScope(&arena);
+        try {
+            const JsonValue* type = request.get("type");
+            if (type == nullptr || type->type != JsonValue::String) {
+                throw invalid_argument("missing request type");
+            }
+            typeIndex = find(kRequestTypes, kRequestTypes + kNumRequestTypes, type->str) - kRequestTypes;
+            if (router != nullptr && type->str != "stats" && type->str != "metrics") {
+                handleSharded(type->str, request, out);
+            } else if (type->str == "path") {
+                handlePath(g, request, out);
+            } else if (type->str == "batch") {
+                handleBatch(g, request, out);
+            } else if (type->str == "profile") {
+                handleProfile(g, request, out);
+            } else if (type->str == "matrix") {
+                handleMatrix(g, request, out);
+            } else if (type->str == "tsp") {
+                handleTsp(g, request, out);
+            } else if (type->str == "pdp") {
+                handlePickupDelivery(g, request, out);
+            } else if (type->str == "cvrp") {
+                handleFleet(g, request, out);
+            } else if (type->str == "snap") {
+                handleSnap(g, request, out);
+            } else if (type->str == "dispatch") {
+                handleDispatch(*snapshot, request, out);
+            } else if (type->str == "stats") {
+                handleStats(*snapshot, out);
+            } else if (type->str == "update") {
+                handleUpdate(request, out);
+            } else if (type->str == "metrics") {
+                out.raw("\"metrics\": ").str(metrics());
+            } else {
+                throw invalid_argument("unknown request type: " + type->str);
+            }
+            writeQueryStats(out, false);
+        } catch (const exception& e) {
+            response.resize(body);
+            out.raw("\"error\": ").str(e.what()).raw('}');
+            return false;
+        }
+        out.raw('}');
+        return true;
+    }
+
+#ifndef _WIN32
+    // A socket stays open until the last response queued for it has been sent
+    struct Connection {
+        int fd;
+        mutex writeMutex;
+
+        explicit Connection(int socketFd) : fd(socketFd) {}
+        ~Connection() { close(fd); }
+
+        void send(const string& line) {
+            lock_guard<mutex> lock(writeMutex);
+            size_t sent = 0;
+            while (sent < line.size()) {
+                ssize_t n = ::send(fd, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+                if (n <= 0) return; // Client went away
+                sent += n;
+            }
+        }
+    };
+
+    void serveConnection(int fd) {
+        shared_ptr<Connection> conn = make_shared<Connection>(fd);
+        string pending;
+        char buffer[65536];
+        ssize_t n;
+        while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+            pending.append(buffer, n);
+            if (pending.compare(0, 4, "GET ") == 0) {
+                // A metrics scrape rather than a JSON client: answer the
+                // HTTP request once its header is complete, then hang up
+                if (pending.find("\r\n\r\n") == string::npos && pending.find("\n\n") == string::npos) continue;
+                bool found = pending.compare(4, 9, "/metrics ") == 0 || pending.compare(4, 9, "/metrics?") == 0;
+                string body = found ? metrics() : "not found\n";
+                conn->send(string(found ? "HTTP/1.0 200 OK\r\n" : "HTTP/1.0 404 Not Found\r\n") +
+                           "Content-Type: text/plain; version=0.0.4\r\nContent-Length: " + to_string(body.size()) +
+                           "\r\nConnection: close\r\n\r\n" + body);
+                return;
+            }
+            size_t start = 0;
+            size_t newline;
+            while ((newline = pending.find('\n', start)) != string::npos) {
+                string line = pending.substr(start, newline - start);
+                start = newline + 1;
+                if (line.find_first_not_of(" \t\r") == string::npos) continue;
+                submit([this, conn, line] {
+                    thread_local string response;
+                    handle(line, response);
+                    response += '\n';
+                    conn->send(response);
+                });
+            }
+            pending.erase(0, start);
+        }
+    }
+#endif
+
+    static int requireInt(const JsonValue& request, const string& key) {
+        const JsonValue* value = request.get(key);
+        if (value == nullptr || !value->isInt()) {
+            throw invalid_argument("\"" + key + "\" must be an integer");
+        }
+        return (int)value->number;
+    }
+
+    void handlePath(Graph& g, const JsonValue& request, JsonWriter& out) {
+        int src = requireInt(request, "src");
+        int dest = requireInt(request, "dest");
+        if (request.get("departure") != nullptr) {
+            // Fastest path for that departure time, using the profiles
+            int travelTime;
+            vector<int> path = g.dijkstra(src, dest, requireInt(request, "departure"), &travelTime);
+            out.raw("\"path\": ").intArray(path).raw(", \"travel_time\": ").number(path.empty() ? -1 : travelTime);
+            return;
+        }
+        vector<int> path = g.dijkstra(src, dest);
+        out.raw("\"path\": ").intArray(path);
+    }
+
+    // Many path queries in one request: "queries" is a list of [src, dest]
+    // pairs, answered in order as {"distance", "path"} (distance -1 if there
+    // is no path). Queries sharing a source share one search. With "paths":
+    // false only the distances are wanted, answered as one "distances" array.
+    void handleBatch(Graph& g, const JsonValue& request, JsonWriter& out) {
+        vector<pair<int, int>> pairs = batchQueries(request);
+        bool tracePaths = batchTracesPaths(request);
+        vector<vector<int>> paths(pairs.size());
+        vector<int> distances(pairs.size());
+        g.shortestPaths(pairs, [&](size_t k, const vector<int>& path, int distance) {
+            if (tracePaths) paths[k] = path; // Each k is written by exactly one thread
+            distances[k] = distance == INT_MAX ? -1 : distance;
+        }, tracePaths);
+        writeBatch(paths, distances, tracePaths, out);
+    }
+
+    static vector<pair<int, int>> batchQueries(const JsonValue& request) {
+        const JsonValue* queries = request.get("queries");
+        if (queries == nullptr || queries->type != JsonValue::Array) {
+            throw invalid_argument("\"queries\" must be an array of [src, dest] pairs");
+        }
+        vector<pair<int, int>> pairs;
+        for (const JsonValue& query : queries->items) {
+            vector<int> pair = requireIntArray(query, "queries");
+            if (pair.size() != 2) throw invalid_argument("\"queries\" must be an array of [src, dest] pairs");
+            pairs.push_back({pair[0], pair[1]});
+        }
+        return pairs;
+    }
+
+    static bool batchTracesPaths(const JsonValue& request) {
+        const JsonValue* withPaths = request.get("paths");
+        return withPaths == nullptr || withPaths->type != JsonValue::Bool || withPaths->boolean;
+    }
+
+    static void writeBatch(const vector<vector<int>>& paths, const vector<int>& distances, bool tracePaths,
+                           JsonWriter& out) {
+        if (!tracePaths) {
+            out.raw("\"distances\": ").intArray(distances);
+            return;
+        }
+        out.raw("\"results\": [");
+        for (size_t k = 0; k < distances.size(); k++) {
+            if (k > 0) out.raw(", ");
+            out.raw("{\"distance\": ").number(distances[k])
+               .raw(", \"path\": ").intArray(paths[k]).raw('}');
+        }
+        out.raw(']');
+    }
+
+    // Travel time from "src" to each of "targets" as a function of the
+    // departure time: per target a list of [time, travel_time] points, in
+    // whole units, linear in between and wrapping around the day ([] if
+    // unreachable).
+    void handleProfile(Graph& g, const JsonValue& request, JsonWriter& out) {
+        int src = requireInt(request, "src");
+        const JsonValue* targets = request.get("targets");
+        if (targets == nullptr) throw invalid_argument("missing \"targets\"");
+        vector<TravelTimeFunction> profiles = g.profileSearch(src, requireIntArray(*targets, "targets"));
+        out.raw("\"profiles\": [");
+        for (size_t k = 0; k < profiles.size(); k++) {
+            if (k > 0) out.raw(", ");
+            out.raw('[');
+            long long previous = -1;
+            for (const pair<double, double>& point : profiles[k].points) {
+                long long time = llround(point.first);
+                if (time == previous || time >= profiles[k].period) continue; // Merged by rounding
+                if (previous >= 0) out.raw(", ");
+                out.raw('[').number(time).raw(", ").number(llround(point.second)).raw(']');
+                previous = time;
+            }
+            out.raw(']');
+        }
+        out.raw(']');
+    }
+
+    // Distance matrix between "nodes" (travel times when leaving at
+    // "departure", if given). With "file" the matrix is written there in the
+    // DistanceMatrix binary form, for the client to map without copying;
+    // "compact" asks for 16-bit cells, used when all distances fit. Without
+    // "file" the rows come back inline with -1 for unreachable pairs.
+    void handleMatrix(Graph& g, const JsonValue& request, JsonWriter& out) {
+        const JsonValue* nodes = request.get("nodes");
+        if (nodes == nullptr) throw invalid_argument("missing \"nodes\"");
+        vector<int> nodeIds = requireIntArray(*nodes, "nodes");
+        DistanceMatrix distances = request.get("departure") != nullptr
+            ? g.calculateDistanceMatrix(nodeIds, requireInt(request, "departure"))
+            : g.calculateDistanceMatrix(nodeIds);
+        writeMatrix(distances, request, out);
+    }
+
+    static void writeMatrix(const DistanceMatrix& distances, const JsonValue& request, JsonWriter& out) {
+        const JsonValue* file = request.get("file");
+        if (file != nullptr) {
+            if (file->type != JsonValue::String) throw invalid_argument("\"file\" must be a string");
+            const JsonValue* compact = request.get("compact");
+            bool small = compact != nullptr && compact->type == JsonValue::Bool && compact->boolean &&
+                         distances.fitsCompact();
+            if (!distances.write(file->str, small)) throw runtime_error("cannot write " + file->str);
+            out.raw("\"file\": ").str(file->str)
+               .raw(", \"size\": ").number(distances.size())
+               .raw(", \"cell_bytes\": ").number(small ? 2 : 4);
+            return;
+        }
+        out.raw("\"matrix\": [");
+        vector<int> row(distances.size());
+        for (int i = 0; i < distances.size(); i++) {
+            for (int j = 0; j < distances.size(); j++) {
+                row[j] = distances.reachable(i, j) ? distances.distance(i, j) : -1;
+            }
+            if (i > 0) out.raw(", ");
+            out.intArray(row);
+        }
+        out.raw(']');
+    }
+
+    // The requests answered through the ShardRouter, in the same form as
+    // on an unsharded graph
+    void handleSharded(const string& type, const JsonValue& request, JsonWriter& out) {
+        if ((type == "path" || type == "matrix") && request.get("departure") != nullptr) {
+            throw invalid_argument("\"departure\" is not supported by a shard router");
+        }
+        if (type == "path") {
+            int distance;
+            vector<int> path = router->path(requireInt(request, "src"), requireInt(request, "dest"), distance);
+            out.raw("\"path\": ").intArray(path);
+        } else if (type == "batch") {
+            vector<pair<int, int>> pairs = batchQueries(request);
+            bool tracePaths = batchTracesPaths(request);
+            vector<vector<int>> paths(pairs.size());
+            vector<int> distances(pairs.size());
+            for (size_t k = 0; k < pairs.size(); k++) {
+                paths[k] = router->path(pairs[k].first, pairs[k].second, distances[k], tracePaths);
+                if (distances[k] == INT_MAX) distances[k] = -1;
+            }
+            writeBatch(paths, distances, tracePaths, out);
+        } else if (type == "matrix") {
+            const JsonValue* nodes = request.get("nodes");
+            if (nodes == nullptr) throw invalid_argument("missing \"nodes\"");
+            writeMatrix(router->distanceMatrix(requireIntArray(*nodes, "nodes")), request, out);
+        } else if (find(kRequestTypes, kRequestTypes + kNumRequestTypes, type) != kRequestTypes + kNumRequestTypes) {
+            throw invalid_argument("\"" + type + "\" requests are not supported by a shard router");
+        } else {
+            throw invalid_argument("unknown request type: " + type);
+        }
+    }
+
+    // Snap "points", [longitude, latitude] pairs in degrees, onto the road
+    // network: {"node", "offset", "distance", "edge", "fraction"} per point
+    // as in Graph::SnappedPoint, edge being [from, to]; null where the graph
+    // has no located edge at all
+    void handleSnap(Graph& g, const JsonValue& request, JsonWriter& out) {
+        const JsonValue* points = request.get("points");
+        const char* expected = "\"points\" must be an array of [longitude, latitude] pairs";
+        if (points == nullptr || points->type != JsonValue::Array) throw invalid_argument(expected);
+        vector<pair<double, double>> coordinates;
+        coordinates.reserve(points->items.size());
+        for (const JsonValue& point : points->items) {
+            if (point.type != JsonValue::Array || point.items.size() != 2 ||
+                point.items[0].type != JsonValue::Number || point.items[1].type != JsonValue::Number) {
+                throw invalid_argument(expected);
+            }
+            coordinates.push_back({point.items[0].number, point.items[1].number});
+        }
+        if (g.spatialIndex() == nullptr) throw invalid_argument("the graph has no node locations");
+
+        vector<Graph::SnappedPoint> snapped = g.snapPoints(coordinates);
+        out.raw("\"snapped\": [");
+        for (size_t k = 0; k < snapped.size(); k++) {
+            const Graph::SnappedPoint& point = snapped[k];
+            if (k > 0) out.raw(", ");
+            if (point.node < 0) {
+                out.raw("null");
+                continue;
+            }
+            out.raw("{\"node\": ").number(point.node)
+               .raw(", \"offset\": ").number(point.offset)
+               .raw(", \"distance\": ").fixed(point.distance, 2)
+               .raw(", \"edge\": [").number(point.from).raw(", ").number(point.to)
+               .raw("], \"fraction\": ").fixed(point.fraction, 6).raw('}');
+        }
+        out.raw(']');
+    }
+
+    void handleTsp(Graph& g, const JsonValue& request, JsonWriter& out) {
+        const JsonValue* users = request.get("users");
+        if (users == nullptr || users->type != JsonValue::Array || users->items.size() < 2) {
+            throw invalid_argument("\"users\" must be an array of at least two node ids");
+        }
+        vector<int> userIds;
+        for (const JsonValue& user : users->items) {
+            if (!user.isInt()) throw invalid_argument("\"users\" must contain integers");
+            userIds.push_back((int)user.number);
+        }
+
+        vector<int> route = g.planMultiUserRoute(userIds);
+        out.raw("\"path\": ").intArray(route).raw(", \"details\": [");
+        writeUserDetails(out, g, userIds, false);
+        out.raw(']');
+    }
+
+    static vector<int> requireIntArray(const JsonValue& value, const string& key) {
+        if (value.type != JsonValue::Array) {
+            throw invalid_argument("\"" + key + "\" must be an array of integers");
+        }
+        vector<int> result;
+        for (const JsonValue& item : value.items) {
+            if (!item.isInt()) throw invalid_argument("\"" + key + "\" must be an array of integers");
+            result.push_back((int)item.number);
+        }
+        return result;
+    }
+
+    // Pickup and delivery, either on graph nodes ("start" plus "requests" as
+    // [pickup, delivery] pairs) or on an explicit "matrix" whose stops follow
+    // the PickupDeliveryPlan layout (negative entries = no path). Optional:
+    // "demands" (default 1 each), "capacity" (default unlimited) and "return"
+    // (back to the start).
+    void handlePickupDelivery(Graph& g, const JsonValue& request, JsonWriter& out) {
+        const JsonValue* matrix = request.get("matrix");
+        DistanceMatrix distances;
+        vector<int> stops;
+        if (matrix != nullptr) {
+            if (matrix->type != JsonValue::Array || matrix->items.size() % 2 != 1) {
+                throw invalid_argument("\"matrix\" must be a square array with an odd number of rows");
+            }
+            distances = DistanceMatrix(matrix->items.size());
+            for (int i = 0; i < distances.size(); i++) {
+                vector<int> row = requireIntArray(matrix->items[i], "matrix");
+                if ((int)row.size() != distances.size()) throw invalid_argument("\"matrix\" must be square");
+                distances.setRow(i, row);
+            }
+        } else {
+            stops.push_back(requireInt(request, "start"));
+            const JsonValue* requests = request.get("requests");
+            if (requests == nullptr || requests->type != JsonValue::Array) {
+                throw invalid_argument("\"requests\" must be an array of [pickup, delivery] pairs");
+            }
+            for (const JsonValue& pair : requests->items) {
+                vector<int> nodes = requireIntArray(pair, "requests");
+                if (nodes.size() != 2) throw invalid_argument("\"requests\" must be an array of [pickup, delivery] pairs");
+                stops.insert(stops.end(), nodes.begin(), nodes.end());
+            }
+            for (int node : stops) {
+                if (g.csr().index(node) < 0) throw invalid_argument("unknown node: " + to_string(node));
+            }
+        }
+        int numRequests = (matrix != nullptr ? distances.size() : stops.size()) / 2;
+
+        vector<int> demands(numRequests, 1);
+        if (const JsonValue* value = request.get("demands")) {
+            demands = requireIntArray(*value, "demands");
+            if ((int)demands.size() != numRequests) throw invalid_argument("\"demands\" needs one entry per request");
+            for (int demand : demands) {
+                if (demand < 0) throw invalid_argument("\"demands\" must not be negative");
+            }
+        }
+        int capacity = request.get("capacity") != nullptr ? requireInt(request, "capacity") : INT_MAX;
+        const JsonValue* back = request.get("return");
+        bool returnToStart = back != nullptr && back->type == JsonValue::Bool && back->boolean;
+
+        vector<shared_ptr<const PathTree>> trees;
+        PickupDeliveryPlan plan = matrix != nullptr
+            ? PickupDeliverySolver(distances, demands, capacity, returnToStart).solve(g.tspTimeBudgetMs())
+            : g.planPickupDelivery(stops, demands, capacity, returnToStart, &trees);
+        out.raw("\"order\": ").intArray(plan.order)
+           .raw(", \"distance\": ").number(plan.distance)
+           .raw(", \"unassigned\": ").intArray(plan.unassigned);
+        if (matrix == nullptr) {
+            vector<int> visited;
+            for (int stop : plan.order) visited.push_back(stops[stop]);
+            out.raw(", \"stops\": ").intArray(visited)
+               .raw(", \"path\": ").intArray(g.expandRoute(visited, trees));
+        }
+    }
+
+    // Capacitated routing from "depots" to "customers" (node ids). Optional:
+    // "demands" (default 1 each) and "capacity" (default unlimited).
+    void handleFleet(Graph& g, const JsonValue& request, JsonWriter& out) {
+        const JsonValue* depots = request.get("depots");
+        const JsonValue* customers = request.get("customers");
+        if (depots == nullptr || customers == nullptr) {
+            throw invalid_argument("\"depots\" and \"customers\" are required");
+        }
+        vector<int> depotIds = requireIntArray(*depots, "depots");
+        vector<int> customerIds = requireIntArray(*customers, "customers");
+        if (depotIds.empty()) throw invalid_argument("\"depots\" must not be empty");
+        vector<int> demands(customerIds.size(), 1);
+        if (const JsonValue* value = request.get("demands")) {
+            demands = requireIntArray(*value, "demands");
+            if (demands.size() != customerIds.size()) throw invalid_argument("\"demands\" needs one entry per customer");
+            for (int demand : demands) {
+                if (demand < 0) throw invalid_argument("\"demands\" must not be negative");
+            }
         }
-        
-        return tour;
+        int capacity = request.get("capacity") != nullptr ? requireInt(request, "capacity") : INT_MAX;
+        vector<int> stops = depotIds;
+        stops.insert(stops.end(), customerIds.begin(), customerIds.end());
+        for (int node : stops) {
+            if (g.csr().index(node) < 0) throw invalid_argument("unknown node: " + to_string(node));
+        }
+
+        vector<shared_ptr<const PathTree>> trees;
+        FleetPlan plan = g.planFleet(depotIds, customerIds, demands, capacity, &trees);
+        writeFleetPlan(out, g, plan, stops, trees, false);
     }
 
-    // Plan optimal multi-user route (TSP solution)
-    vector<int> planMultiUserRoute(const vector<int>& userIds) {
-        vector<int> pickupNodes;
-        vector<int> destinationNodes;
-        
-        // Extract pickup and destination nodes
-        for (int userId : userIds) {
-            pickupNodes.push_back(userId);  // Using the user node as pickup point
+    // Live route of one "vehicle", kept between requests (see LiveRoute).
+    // "stops" plans it from scratch, the vehicle's position first ([] forgets
+    // the vehicle); otherwise "position" (the vehicle moved), "remove" (a
+    // rider cancelled) and "add" (a rider joined) change it in that order,
+    // each a node id; a "position" on a pending stop serves and drops it.
+    // Answers the stops in visiting order and the tour "length" (-1 if a leg
+    // has no path), plus the full "path" if asked for with "path": true. A
+    // route planned before an update is recomputed on the new weights at its
+    // next request.
+    void handleDispatch(Snapshot& snapshot, const JsonValue& request, JsonWriter& out) {
+        Graph& g = snapshot.graph;
+        int id = requireInt(request, "vehicle");
+        const JsonValue* stops = request.get("stops");
+        vector<int> planned;
+        if (stops != nullptr) {
+            planned = requireIntArray(*stops, "stops");
+            vector<int> sorted = planned;
+            sort(sorted.begin(), sorted.end());
+            if (adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+                throw invalid_argument("\"stops\" must not repeat a node");
+            }
         }
-        
-        // Calculate distance matrix for pickup nodes
-        auto pickupDistances = calculateDistanceMatrix(pickupNodes);
-        
-        // Solve TSP for pickup route
-        auto pickupOrder = solveTSP(pickupDistances);
-        
-        // Create vector of pickup nodes in TSP order
-        vector<int> orderedPickups;
-        for (int idx : pickupOrder) {
-            orderedPickups.push_back(pickupNodes[idx]);
+        vector<int> nodes = planned;
+        for (const char* key : {"position", "remove", "add"}) {
+            if (request.get(key) != nullptr) nodes.push_back(requireInt(request, key));
         }
-        
-        // Extract destinations for each user (in the same order as the optimized pickup)
-        for (int idx : pickupOrder) {
-            int userId = pickupNodes[idx];
-            // In a real system, you would get the destination node id
-            // For this demo, we'll use the user node id + 20 to simulate destination nodes
-            destinationNodes.push_back(userId);  // Using the same node for simplicity
+        for (int node : nodes) {
+            if (g.csr().index(node) < 0) throw invalid_argument("unknown node: " + to_string(node));
         }
-        
-        // Calculate distance matrix for destination nodes
-        auto destDistances = calculateDistanceMatrix(destinationNodes);
-        
-        // Solve TSP for destination route
-        auto destOrder = solveTSP(destDistances);
-        
-        // Create vector of destination nodes in TSP order
-        vector<int> orderedDestinations;
-        for (int idx : destOrder) {
-            orderedDestinations.push_back(destinationNodes[idx]);
+
+        shared_ptr<Vehicle> vehicle;
+        {
+            lock_guard<mutex> lock(vehiclesMutex);
+            auto found = vehicles.find(id);
+            if (stops != nullptr && planned.empty()) {
+                if (found != vehicles.end()) vehicles.erase(found);
+                out.raw("\"vehicle\": ").number(id).raw(", \"stops\": [], \"length\": 0");
+                return;
+            }
+            if (found == vehicles.end()) {
+                if (stops == nullptr) throw invalid_argument("unknown vehicle " + to_string(id) + " (plan it with \"stops\")");
+                found = vehicles.emplace(id, make_shared<Vehicle>()).first;
+            }
+            vehicle = found->second;
         }
-        
-        // Combine results into a single route
-        vector<int> fullRoute;
-        fullRoute.push_back(orderedPickups[0]); // Start at first pickup
-        
-        // Add intermediate pickups
-        for (size_t i = 1; i < orderedPickups.size(); i++) {
-            // Get shortest path between consecutive pickups
-            vector<int> subpath = dijkstra(orderedPickups[i-1], orderedPickups[i]);
-            // Add all but the first node (to avoid duplication)
-            for (size_t j = 1; j < subpath.size(); j++) {
-                fullRoute.push_back(subpath[j]);
+
+        lock_guard<mutex> lock(vehicle->lock); // Requests for one vehicle take turns
+        LiveRoute& route = vehicle->route;
+        if (stops != nullptr) {
+            route.plan(g, planned);
+        } else if (vehicle->version != snapshot.version) {
+            route.refresh(g);
+        }
+        vehicle->version = snapshot.version;
+        // Check every change before making any, so an error leaves the route as it was
+        int position = request.get("position") != nullptr ? requireInt(request, "position") : route.position();
+        int removed = request.get("remove") != nullptr ? requireInt(request, "remove") : -1;
+        if (request.get("remove") != nullptr && !route.isStop(removed)) {
+            throw invalid_argument("node " + to_string(removed) + " is not a stop of vehicle " + to_string(id));
+        }
+        if (request.get("add") != nullptr) {
+            int added = requireInt(request, "add");
+            if (added == position || (route.isStop(added) && added != removed)) {
+                throw invalid_argument("node " + to_string(added) + " already is a stop of vehicle " + to_string(id));
             }
         }
-        
-        // Add path to first destination
-        vector<int> toFirstDest = dijkstra(orderedPickups.back(), orderedDestinations[0]);
-        for (size_t i = 1; i < toFirstDest.size(); i++) {
-            fullRoute.push_back(toFirstDest[i]);
+        if (request.get("position") != nullptr) route.moveTo(g, position);
+        if (request.get("remove") != nullptr && removed != position) route.remove(g, removed); // Else moveTo did
+        if (request.get("add") != nullptr) route.add(g, requireInt(request, "add"));
+
+        vector<int> order = route.order();
+        out.raw("\"vehicle\": ").number(id)
+           .raw(", \"stops\": ").intArray(order)
+           .raw(", \"length\": ").number(route.length());
+        const JsonValue* path = request.get("path");
+        if (path != nullptr && path->type == JsonValue::Bool && path->boolean) {
+            out.raw(", \"path\": ").intArray(g.expandRoute(order));
         }
-        
-        // Add remaining destinations
-        for (size_t i = 1; i < orderedDestinations.size(); i++) {
-            vector<int> subpath = dijkstra(orderedDestinations[i-1], orderedDestinations[i]);
-            for (size_t j = 1; j < subpath.size(); j++) {
-                fullRoute.push_back(subpath[j]);
+    }
+
+    // Graph version (number of updates applied) and cache counters, or
+    // "cache": null when caching is off
+    void handleStats(Snapshot& snapshot, JsonWriter& out) {
+        out.raw("\"version\": ").number(snapshot.version).raw(", ");
+        RouteCache* cache = snapshot.graph.cache();
+        if (cache == nullptr) {
+            out.raw("\"cache\": null");
+            return;
+        }
+        out.raw("\"cache\": {\"distance_hits\": ").number(cache->distanceHits);
+        out.raw(", \"distance_misses\": ").number(cache->distanceMisses);
+        out.raw(", \"path_hits\": ").number(cache->pathHits);
+        out.raw(", \"path_misses\": ").number(cache->pathMisses);
+        out.raw(", \"distances\": ").number(cache->numDistances());
+        out.raw(", \"trees\": ").number(cache->numTrees()).raw('}');
+    }
+
+    // New weights for existing edges as [u, v, weight] triples. The next
+    // snapshot starts with an empty cache, since cached routes may no longer
+    // be shortest; requests still running on the old one keep theirs.
+    void handleUpdate(const JsonValue& request, JsonWriter& out) {
+        const JsonValue* edges = request.get("edges");
+        if (edges == nullptr || edges->type != JsonValue::Array) {
+            throw invalid_argument("\"edges\" must be an array of [u, v, weight] triples");
+        }
+        vector<Graph::Arc> changes;
+        for (const JsonValue& edge : edges->items) {
+            if (edge.type != JsonValue::Array || edge.items.size() != 3 || !edge.items[0].isInt() ||
+                !edge.items[1].isInt() || !edge.items[2].isInt()) {
+                throw invalid_argument("\"edges\" must be an array of [u, v, weight] triples");
             }
+            changes.push_back({(int)edge.items[0].number, (int)edge.items[1].number, (int)edge.items[2].number});
         }
-        
-        return fullRoute;
+
+        lock_guard<mutex> lock(updateMutex);
+        shared_ptr<Snapshot> previous = atomic_load(&current);
+        shared_ptr<Snapshot> next = make_shared<Snapshot>();
+        next->graph = previous->graph;
+        next->version = previous->version + 1;
+        if (RouteCache* cache = previous->graph.cache()) {
+            next->cache = make_shared<RouteCache>(cache->distanceCapacity(), cache->treeCapacity());
+            next->graph.setRouteCache(next->cache.get());
+        }
+        if (!next->graph.updateEdgeWeights(changes)) {
+            throw invalid_argument("unknown edge or negative weight");
+        }
+        atomic_store(&current, next);
+        out.raw("\"updated\": ").number(changes.size()).raw(", \"version\": ").number(next->version);
     }
 
-    // Generate enhanced JSON with user information
-    void exportToJson(const string& filename) {
-        ofstream outFile(filename);
-        outFile << "{\n  \"nodes\": [\n";
-        
-        // Get unique nodes
-        vector<int> nodes;
-        for (auto& pair : adjList) {
-            nodes.push_back(pair.first);
+    void submit(function<void()> task) {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            tasks.push_back(move(task));
+            pendingTasks++;
         }
-        sort(nodes.begin(), nodes.end());
-        
-        // Write nodes with user info
-        for (size_t i = 0; i < nodes.size(); i++) {
-            int node = nodes[i];
-            outFile << "    {\n";
-            outFile << "      \"id\": " << node << ",\n";
-            outFile << "      \"user\": \"" << users[node].name << "\",\n";
-            outFile << "      \"pickup\": \"" << users[node].pickup << "\",\n";
-            outFile << "      \"destination\": \"" << users[node].destination << "\"\n";
-            outFile << "    }";
-            if (i < nodes.size() - 1) outFile << ",";
-            outFile << "\n";
+        queueReady.notify_one();
+    }
+
+    void waitIdle() {
+        unique_lock<mutex> lock(queueMutex);
+        idle.wait(lock, [this] { return pendingTasks == 0; });
+    }
+
+    void workerLoop() {
+        while (true) {
+            function<void()> task;
+            {
+                unique_lock<mutex> lock(queueMutex);
+                queueReady.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) return;
+                task = move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+            lock_guard<mutex> lock(queueMutex);
+            if (--pendingTasks == 0) {
+                idle.notify_all();
+            }
         }
-        
-        outFile << "  ],\n  \"edges\": [\n";
-        
-        // Write edges
-        bool firstEdge = true;
-        for (size_t i = 0; i < nodes.size(); i++) {
-            int node = nodes[i];
-            for (auto& edge : adjList[node]) {
-                // Only write each edge once (where node < neighbor)
-                if (node < edge.first) {
-                    if (!firstEdge) outFile << ",\n";
-                    outFile << "    {\"source\": " << node 
-                           << ", \"target\": " << edge.first 
-                           << ", \"weight\": " << edge.second << "}";
-                    firstEdge = false;
+    }
+
+    shared_ptr<Snapshot> current;  // Read and replaced with atomic_load/atomic_store
+    ShardRouter* router;           // Set when the graph is a shard overlay
+    mutex updateMutex;             // One update at a time
+    mutex vehiclesMutex;           // Guards the map; each vehicle has its own lock
+    map<int, shared_ptr<Vehicle>> vehicles;
+    atomic<long long> requestCounts[kNumRequestTypes + 1] = {};  // By kRequestTypes index, last = other
+    atomic<long long> requestErrors{0};
+    atomic<long long> requestNanos{0};
+    vector<thread> workers;
+    mutex queueMutex;
+    condition_variable queueReady;
+    condition_variable idle;
+    deque<function<void()>> tasks;
+    int pendingTasks = 0;
+    bool stopping = false;
+};
+
+// Batch mode: read path queries from in, one per line as "src dest" or as a
+// JSON object {"id": ..., "src": ..., "dest": ...}, and stream one NDJSON
+// result line per query to out:
+//   {"id": 7, "src": 1, "dest": 20, "distance": 19, "path": [1, 3, 9, 12, 20]}
+// The id is the query's own "id", else its line number (from 1). Queries are
+// taken in chunks so each source is searched once per chunk (see
+// Graph::shortestPaths); results come back in completion order. Unreachable
+// pairs get distance -1 and an empty path, bad lines an "error".
+static void runBatch(Graph& g, istream& in, FILE* out) {
+    const size_t kChunkSize = 1 << 16;
+    JsonWriter writer(out);
+    mutex writerMutex;
+    string line;
+    long long lineNumber = 0;
+    bool more = true;
+    while (more) {
+        vector<pair<int, int>> queries;
+        vector<long long> ids;
+        while (queries.size() < kChunkSize && (more = (bool)getline(in, line))) {
+            lineNumber++;
+            size_t start = line.find_first_not_of(" \t\r");
+            if (start == string::npos || line[start] == '#') continue;
+            long long id = lineNumber;
+            int src, dest;
+            string error;
+            if (line[start] == '{') {
+                JsonValue query;
+                if (!JsonValue::parse(line, query, error)) {
+                    error = "invalid JSON: " + error;
+                } else {
+                    const JsonValue* srcValue = query.get("src");
+                    const JsonValue* destValue = query.get("dest");
+                    const JsonValue* idValue = query.get("id");
+                    if (srcValue == nullptr || !srcValue->isInt() || destValue == nullptr || !destValue->isInt()) {
+                        error = "\"src\" and \"dest\" must be integers";
+                    } else {
+                        src = (int)srcValue->number;
+                        dest = (int)destValue->number;
+                        if (idValue != nullptr && idValue->isInt()) id = (long long)idValue->number;
+                    }
                 }
+            } else if (sscanf(line.c_str(), "%d %d", &src, &dest) != 2) {
+                error = "expected \"src dest\"";
+            }
+            if (!error.empty()) {
+                writer.raw("{\"id\": ").number(id).raw(", \"error\": ").str(error).raw("}\n");
+                continue;
             }
+            queries.push_back({src, dest});
+            ids.push_back(id);
         }
-        
-        outFile << "\n  ]\n}";
-        outFile.close();
+
+        g.shortestPaths(queries, [&](size_t k, const vector<int>& path, int distance) {
+            lock_guard<mutex> lock(writerMutex);
+            writer.raw("{\"id\": ").number(ids[k])
+                  .raw(", \"src\": ").number(queries[k].first)
+                  .raw(", \"dest\": ").number(queries[k].second)
+                  .raw(", \"distance\": ").number(distance == INT_MAX ? -1 : distance)
+                  .raw(", \"path\": ").intArray(path).raw("}\n");
+        });
+        writer.flush(); // Hand each finished chunk to the reader right away
     }
-};
+}
 
-int main(int argc, char* argv[]) {
-    Graph g;
-    
+// Synthetic benchmark graphs. Node ids are 1..numNodes and weights are
+// drawn from rng, so a given size and seed always yields the same graph.
+
+// Four-neighbour grid, as square as possible (the last row may be partial)
+static void generateGridGraph(Graph& g, int numNodes, mt19937& rng) {
+    int side = max(1, (int)ceil(sqrt((double)numNodes)));
+    uniform_int_distribution<int> weight(1, 100);
+    for (int v = 0; v < numNodes; v++) {
+        if ((v + 1) % side != 0 && v + 1 < numNodes) g.addEdge(v + 1, v + 2, weight(rng));
+        if (v + side < numNodes) g.addEdge(v + 1, v + side + 1, weight(rng));
+    }
+}
+
+// Random geometric graph: points in the unit square, joined when closer than a
+// radius chosen for an average degree of about six. Weights are proportional
+// to Euclidean length. Small instances may be disconnected.
+static void generateGeometricGraph(Graph& g, int numNodes, mt19937& rng) {
+    const double pi = 3.14159265358979323846;
+    double radius = sqrt(6.0 / (pi * max(1, numNodes)));
+    int cells = max(1, (int)(1.0 / radius));
+    uniform_real_distribution<double> coordinate(0.0, 1.0);
+    vector<double> x(numNodes), y(numNodes);
+    vector<vector<int>> grid((size_t)cells * cells);
+    for (int v = 0; v < numNodes; v++) {
+        x[v] = coordinate(rng);
+        y[v] = coordinate(rng);
+        int cx = min(cells - 1, (int)(x[v] * cells));
+        int cy = min(cells - 1, (int)(y[v] * cells));
+        grid[(size_t)cy * cells + cx].push_back(v);
+    }
+    for (int v = 0; v < numNodes; v++) {
+        int cx = min(cells - 1, (int)(x[v] * cells));
+        int cy = min(cells - 1, (int)(y[v] * cells));
+        for (int ny = max(0, cy - 1); ny <= min(cells - 1, cy + 1); ny++) {
+            for (int nx = max(0, cx - 1); nx <= min(cells - 1, cx + 1); nx++) {
+                for (int u : grid[(size_t)ny * cells + nx]) {
+                    if (u <= v) continue; // Each pair once
+                    double d = hypot(x[u] - x[v], y[u] - y[v]);
+                    if (d < radius) {
+                        g.addEdge(v + 1, u + 1, max(1, (int)(d / radius * 1000)));
+                    }
+                }
+            }
+        }
+    }
+}
+
+static double millisecondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Time the routing kernels on g and print the figures as JSON: point-to-point
+// queries on random pairs, then a distance matrix, solveTSP and
+// planMultiUserRoute over matrixSize random nodes.
+static void runBenchmark(Graph& g, int numQueries, int matrixSize, mt19937& rng, int numLandmarks, bool customizable) {
+    auto start = chrono::steady_clock::now();
+    const CSRGraph& csr = g.csr();
+    double freezeMs = millisecondsSince(start);
+    int n = csr.numNodes();
+    cout << "{\n  \"nodes\": " << n << ",\n  \"arcs\": " << csr.targets.size()
+         << ",\n  \"freeze_ms\": " << freezeMs;
+    if (numLandmarks > 0 && g.landmarkIndex() == nullptr) {
+        start = chrono::steady_clock::now();
+        g.buildLandmarks(numLandmarks);
+        cout << ",\n  \"landmarks\": " << g.landmarkIndex()->numLandmarks()
+             << ",\n  \"landmarks_ms\": " << millisecondsSince(start);
+    }
+    if (customizable && g.customizableHierarchy() == nullptr) {
+        start = chrono::steady_clock::now();
+        g.buildCustomizableHierarchy();
+        cout << ",\n  \"cch_arcs\": " << g.customizableHierarchy()->numArcs()
+             << ",\n  \"cch_levels\": " << g.customizableHierarchy()->numLevels()
+             << ",\n  \"cch_ms\": " << millisecondsSince(start);
+    }
+    if (g.customizableHierarchy() != nullptr) {
+        // Traffic update: slow down one edge in a hundred by half
+        vector<Graph::Arc> changes;
+        uniform_int_distribution<int> pickArc(0, max(0, (int)csr.targets.size() - 1));
+        for (size_t k = 0; k < csr.targets.size() / 200; k++) {
+            int e = pickArc(rng);
+            int tail = upper_bound(csr.offsets.begin(), csr.offsets.end(), e) - csr.offsets.begin() - 1;
+            changes.push_back({csr.nodeIds[tail], csr.nodeIds[csr.targets[e]], csr.weights[e] + csr.weights[e] / 2});
+        }
+        start = chrono::steady_clock::now();
+        g.updateEdgeWeights(changes);
+        cout << ",\n  \"update_edges\": " << changes.size()
+             << ",\n  \"update_ms\": " << millisecondsSince(start);
+    }
+    if (n == 0) {
+        cout << "\n}" << endl;
+        return;
+    }
+
+    uniform_int_distribution<int> pick(0, n - 1);
+    vector<pair<int, int>> pairs(numQueries);
+    for (pair<int, int>& q : pairs) {
+        q = {csr.nodeIds[pick(rng)], csr.nodeIds[pick(rng)]};
+    }
+    long long settled = 0;
+    int found = 0;
+    start = chrono::steady_clock::now();
+    for (const pair<int, int>& q : pairs) {
+        if (!g.dijkstra(q.first, q.second).empty()) found++;
+        settled += localWorkspace().settled;
+    }
+    double queryMs = millisecondsSince(start);
+    cout << ",\n  \"queries\": " << numQueries
+         << ",\n  \"queries_found\": " << found
+         << ",\n  \"query_ms\": " << queryMs
+         << ",\n  \"queries_per_sec\": " << (queryMs > 0 ? numQueries * 1000.0 / queryMs : 0.0);
+    if (g.contractionHierarchy() == nullptr && g.customizableHierarchy() == nullptr &&
+        g.landmarkIndex() == nullptr && numQueries > 0) {
+        cout << ",\n  \"settled_per_query\": " << (double)settled / numQueries;
+    }
+
+    vector<int> nodes(min(matrixSize, n));
+    for (int& node : nodes) {
+        node = csr.nodeIds[pick(rng)];
+    }
+    start = chrono::steady_clock::now();
+    DistanceMatrix distances = g.calculateDistanceMatrix(nodes);
+    double matrixMs = millisecondsSince(start);
+    start = chrono::steady_clock::now();
+    g.solveTSP(distances);
+    double tspMs = millisecondsSince(start);
+    start = chrono::steady_clock::now();
+    g.planMultiUserRoute(nodes);
+    double planMs = millisecondsSince(start);
+    cout << ",\n  \"matrix_nodes\": " << nodes.size()
+         << ",\n  \"matrix_ms\": " << matrixMs
+         << ",\n  \"tsp_ms\": " << tspMs
+         << ",\n  \"plan_route_ms\": " << planMs
+         << ",\n  \"simd\": \"" << simd().name << "\"\n}" << endl;
+}
+
+// The small demo road network with its users that the tool routes on unless
+// a graph file is given
+static void addDemoGraph(Graph& g) {
     // Add edges
     g.addEdge(1, 2, 4);
     g.addEdge(1, 3, 2);
@@ -319,13 +8253,671 @@ int main(int argc, char* argv[]) {
     g.addUser(18, "Rachel Moore", "901 Factory Ave, Industrial", "112 Office Park, Business Center");
     g.addUser(19, "Sam Thompson", "223 Restaurant Row, Dining District", "334 Hotel Circle, Lodging");
     g.addUser(20, "Tina White", "445 Historic Way, Old Town", "556 Modern Blvd, New Development");
+}
+
+#ifdef VRP_PYTHON_MODULE
+// Python extension module "vrp_engine", for calling the engine in-process
+// instead of through the command-line tool and its JSON:
+//
+//   c++ -O2 -std=c++17 -shared -fPIC -DVRP_PYTHON_MODULE $(python3 -m pybind11 --includes)
+//       dijkstra.cpp -o vrp_engine$(python3-config --extension-suffix)
+//
+// Paths, tours and matrices come back as numpy arrays over the engine's own
+// buffers, without a copy. Searches and solvers run with the GIL released,
+// so several Python threads can query one graph at once; changing a graph
+// (adding edges, loading, building indices) must not overlap its queries.
+namespace py = pybind11;
+
+// A Graph plus the thread pool it runs matrix rows on
+struct PythonGraph {
+    Graph graph;
+    unique_ptr<ThreadPool> pool;
+
+    // Build the CSR arrays while the GIL is still held, so concurrent
+    // queries only ever read the graph
+    Graph& frozen() {
+        graph.freeze();
+        return graph;
+    }
+};
+
+// Hand values over to numpy without copying; the array owns them from then on
+template<typename T>
+static py::array_t<T> toNumpy(vector<T>&& values) {
+    vector<T>* owned = new vector<T>(move(values));
+    py::capsule release(owned, [](void* p) { delete static_cast<vector<T>*>(p); });
+    return py::array_t<T>(owned->size(), owned->data(), release);
+}
+
+// Strided (n, n) view of a matrix, whose rows keep their padding. The array's
+// base is the matrix itself, which lets the solvers below recognise it.
+static py::array toNumpy(DistanceMatrix&& distances) {
+    py::object owner = py::cast(move(distances));
+    const DistanceMatrix& matrix = owner.cast<const DistanceMatrix&>();
+    size_t cell = sizeof(DistanceMatrix::Value);
+    return py::array_t<DistanceMatrix::Value>({(size_t)matrix.size(), (size_t)matrix.columns()},
+                                              {matrix.rowStride() * cell, cell}, matrix[0], owner);
+}
+
+// The matrix a solver runs on: the engine's own when the array came from
+// distance_matrix(), otherwise a copy of any square 2-D array in which
+// negative entries (or UINT32_MAX) mean no path
+struct MatrixArgument {
+    const DistanceMatrix* matrix = nullptr;
+    DistanceMatrix copy;
+
+    explicit MatrixArgument(const py::array& array) {
+        py::object base = array.base();
+        if (py::isinstance<DistanceMatrix>(base) && py::isinstance<py::array_t<DistanceMatrix::Value>>(array)) {
+            const DistanceMatrix& shared = base.cast<const DistanceMatrix&>();
+            py::ssize_t cell = sizeof(DistanceMatrix::Value);
+            if (array.ndim() == 2 && array.data() == shared[0] && array.shape(0) == shared.size() &&
+                array.shape(1) == shared.columns() && array.strides(0) == (py::ssize_t)shared.rowStride() * cell &&
+                array.strides(1) == cell && shared.size() == shared.columns()) {
+                matrix = &shared;
+                return;
+            }
+        }
+        py::array_t<long long, py::array::c_style | py::array::forcecast> cells(array);
+        if (cells.ndim() != 2 || cells.shape(0) != cells.shape(1)) {
+            throw invalid_argument("matrix must be a square 2-D array");
+        }
+        auto view = cells.unchecked<2>();
+        copy = DistanceMatrix(cells.shape(0));
+        for (int i = 0; i < copy.size(); i++) {
+            for (int j = 0; j < copy.size(); j++) {
+                long long value = view(i, j);
+                copy[i][j] = value < 0 || value >= DistanceMatrix::kUnreachable ? DistanceMatrix::kUnreachable
+                                                                                 : (DistanceMatrix::Value)value;
+            }
+        }
+        matrix = &copy;
+    }
+};
+
+static vector<int> checkedDemands(const py::object& demands, size_t count, const char* what) {
+    if (demands.is_none()) return vector<int>(count, 1);
+    vector<int> result = demands.cast<vector<int>>();
+    if (result.size() != count) throw invalid_argument(string("demands needs one entry per ") + what);
+    for (int demand : result) {
+        if (demand < 0) throw invalid_argument("demands must not be negative");
+    }
+    return result;
+}
+
+static int checkedCapacity(const py::object& capacity) {
+    return capacity.is_none() ? INT_MAX : capacity.cast<int>();
+}
+
+static void requireNodes(const CSRGraph& csr, const vector<int>& nodes) {
+    for (int node : nodes) {
+        if (csr.index(node) < 0) throw invalid_argument("unknown node: " + to_string(node));
+    }
+}
+
+PYBIND11_MODULE(vrp_engine, m) {
+    m.doc() = "In-process bindings of the vehicle routing engine";
+    m.attr("UNREACHABLE") = DistanceMatrix::kUnreachable;
+
+    py::class_<DistanceMatrix>(m, "_DistanceMatrix");
+
+    py::class_<PythonGraph>(m, "Graph")
+        .def(py::init<>())
+        .def_static("demo", [] {
+            unique_ptr<PythonGraph> built(new PythonGraph());
+            addDemoGraph(built->graph);
+            return built;
+        }, "The demo network the command-line tool routes on")
+        .def("add_edge", [](PythonGraph& self, int u, int v, int weight) { self.graph.addEdge(u, v, weight); })
+        .def("add_user", [](PythonGraph& self, int node, const string& name, const string& pickup,
+                            const string& destination) { self.graph.addUser(node, name, pickup, destination); })
+        .def("load_binary", [](PythonGraph& self, const string& filename) { return self.graph.loadBinary(filename); })
+        .def("load_json", [](PythonGraph& self, const string& filename) { return self.graph.loadJson(filename); })
+        .def("save_binary", [](PythonGraph& self, const string& filename) { return self.graph.saveBinary(filename); })
+        .def("load_contraction_hierarchy", [](PythonGraph& self, const string& filename) {
+            return self.graph.loadContractionHierarchy(filename);
+        })
+        .def("build_landmarks", [](PythonGraph& self, int count) {
+            Graph& g = self.frozen();
+            py::gil_scoped_release release;
+            g.buildLandmarks(count);
+        }, py::arg("count") = 16)
+        .def("build_customizable_hierarchy", [](PythonGraph& self) {
+            Graph& g = self.frozen();
+            py::gil_scoped_release release;
+            g.buildCustomizableHierarchy();
+        })
+        .def("reorder_nodes", [](PythonGraph& self) { self.frozen().reorderNodes(); },
+             "Lay the nodes out in BFS order for faster searches; node ids stay the same")
+        .def("set_node_locations", [](PythonGraph& self, const vector<int>& nodes, const vector<double>& longitudes,
+                                      const vector<double>& latitudes) {
+            vector<int> fixedLatitudes, fixedLongitudes;
+            for (double latitude : latitudes) fixedLatitudes.push_back(fixedDegrees(latitude));
+            for (double longitude : longitudes) fixedLongitudes.push_back(fixedDegrees(longitude));
+            if (!self.graph.setNodeLocations(nodes, fixedLatitudes, fixedLongitudes)) {
+                throw invalid_argument("unknown node, mismatched lengths or coordinate out of range");
+            }
+        }, py::arg("nodes"), py::arg("longitudes"), py::arg("latitudes"),
+           "Positions of the given nodes in degrees, for snap()")
+        .def("snap", [](PythonGraph& self, py::array_t<double, py::array::c_style | py::array::forcecast> points) {
+            Graph& g = self.frozen();
+            if (points.size() != 0 && (points.ndim() != 2 || points.shape(1) != 2)) {
+                throw invalid_argument("points must be an (n, 2) array of longitude, latitude");
+            }
+            if (g.spatialIndex() == nullptr) throw invalid_argument("the graph has no node locations");
+            vector<pair<double, double>> coordinates(points.size() / 2);
+            const double* cells = points.data();
+            for (size_t k = 0; k < coordinates.size(); k++) {
+                coordinates[k] = {cells[2 * k], cells[2 * k + 1]};
+            }
+            vector<Graph::SnappedPoint> snapped;
+            {
+                py::gil_scoped_release release;
+                snapped = g.snapPoints(coordinates);
+            }
+            vector<int> nodes, offsets, from, to;
+            vector<double> distances, fractions;
+            for (const Graph::SnappedPoint& point : snapped) {
+                nodes.push_back(point.node);
+                offsets.push_back(point.offset);
+                distances.push_back(point.distance);
+                from.push_back(point.from);
+                to.push_back(point.to);
+                fractions.push_back(point.fraction);
+            }
+            return py::dict(py::arg("node") = toNumpy(move(nodes)), py::arg("offset") = toNumpy(move(offsets)),
+                            py::arg("distance") = toNumpy(move(distances)), py::arg("from") = toNumpy(move(from)),
+                            py::arg("to") = toNumpy(move(to)), py::arg("fraction") = toNumpy(move(fractions)));
+        }, "Nearest edge of each (longitude, latitude) row, as arrays; node is -1 where there is none")
+        .def("set_threads", [](PythonGraph& self, int threads) {
+            self.graph.setThreadPool(nullptr);
+            self.pool.reset(threads != 1 ? new ThreadPool(threads) : nullptr);
+            self.graph.setThreadPool(self.pool.get());
+        }, "Matrix rows and fleet search on this many threads (0 = all cores, 1 = none)")
+        .def("set_time_budget", [](PythonGraph& self, double milliseconds) { self.graph.setTspTimeBudget(milliseconds); },
+             "Local search time limit of the solvers; negative = to a local optimum, 0 = construction only")
+        .def_property_readonly("num_nodes", [](PythonGraph& self) { return self.frozen().csr().numNodes(); })
+        .def_property_readonly("num_arcs", [](PythonGraph& self) { return self.frozen().csr().targets.size(); })
+        .def("node_ids", [](PythonGraph& self) {
+            const CSRGraph& csr = self.frozen().csr();
+            return toNumpy(vector<int>(csr.nodeIds.begin(), csr.nodeIds.end()));
+        })
+        .def("shortest_path", [](PythonGraph& self, int src, int dest, py::object departure) {
+            Graph& g = self.frozen();
+            bool timed = !departure.is_none();
+            int leaving = timed ? departure.cast<int>() : 0;
+            vector<int> path;
+            {
+                py::gil_scoped_release release;
+                path = timed ? g.dijkstra(src, dest, leaving) : g.dijkstra(src, dest);
+            }
+            return toNumpy(move(path));
+        }, py::arg("src"), py::arg("dest"), py::arg("departure") = py::none(),
+           "Node ids of the shortest path (fastest when leaving at departure), empty if there is none")
+        .def("shortest_paths", [](PythonGraph& self, const vector<pair<int, int>>& pairs) {
+            Graph& g = self.frozen();
+            vector<vector<int>> paths(pairs.size());
+            vector<int> distances(pairs.size());
+            {
+                py::gil_scoped_release release;
+                g.shortestPaths(pairs, [&](size_t k, const vector<int>& path, int distance) {
+                    paths[k] = path; // Each k is written by exactly one thread
+                    distances[k] = distance;
+                });
+            }
+            py::list results;
+            for (size_t k = 0; k < pairs.size(); k++) {
+                results.append(py::make_tuple(distances[k] == INT_MAX ? -1 : distances[k], toNumpy(move(paths[k]))));
+            }
+            return results;
+        }, "(distance, path) per (src, dest) pair; distance -1 and an empty path where there is none")
+        .def("distance_matrix", [](PythonGraph& self, const vector<int>& nodes) {
+            Graph& g = self.frozen();
+            DistanceMatrix distances;
+            {
+                py::gil_scoped_release release;
+                RequestArena arena;
+                ArenaScope arenaScope(&arena);
+                distances = g.calculateDistanceMatrix(nodes);
+            }
+            return toNumpy(move(distances));
+        }, "uint32 (n, n) distances between nodes, UNREACHABLE where there is no path")
+        .def("solve_tsp", [](PythonGraph& self, const py::array& matrix) {
+            Graph& g = self.frozen();
+            MatrixArgument distances(matrix);
+            vector<int> tour;
+            {
+                py::gil_scoped_release release;
+                RequestArena arena;
+                ArenaScope arenaScope(&arena);
+                tour = g.solveTSP(*distances.matrix);
+            }
+            return toNumpy(move(tour));
+        }, "Open tour over the matrix rows starting at row 0")
+        .def("plan_route", [](PythonGraph& self, const vector<int>& userIds) {
+            Graph& g = self.frozen();
+            vector<int> route;
+            {
+                py::gil_scoped_release release;
+                RequestArena arena;
+                ArenaScope arenaScope(&arena);
+                route = g.planMultiUserRoute(userIds);
+            }
+            static const UserInfo noUser;
+            py::list details;
+            for (int userId : userIds) {
+                const UserInfo* info = g.findUser(userId);
+                if (info == nullptr) info = &noUser;
+                details.append(py::dict(py::arg("user_id") = userId, py::arg("name") = info->name,
+                                        py::arg("pickup") = info->pickup, py::arg("destination") = info->destination));
+            }
+            return py::dict(py::arg("path") = toNumpy(move(route)), py::arg("details") = details);
+        }, "Multi-user route over the given user nodes, like the tsp mode")
+        .def("pickup_delivery", [](PythonGraph& self, const py::array& matrix, py::object demands,
+                                   py::object capacity, bool returnToStart) {
+            Graph& g = self.frozen();
+            MatrixArgument distances(matrix);
+            if (distances.matrix->size() % 2 != 1) {
+                throw invalid_argument("matrix must have an odd number of rows");
+            }
+            vector<int> demandList = checkedDemands(demands, distances.matrix->size() / 2, "request");
+            int limit = checkedCapacity(capacity);
+            PickupDeliveryPlan plan;
+            {
+                py::gil_scoped_release release;
+                RequestArena arena;
+                ArenaScope arenaScope(&arena);
+                plan = PickupDeliverySolver(*distances.matrix, demandList, limit, returnToStart).solve(g.tspTimeBudgetMs());
+            }
+            return py::dict(py::arg("order") = toNumpy(move(plan.order)), py::arg("distance") = plan.distance,
+                            py::arg("unassigned") = toNumpy(move(plan.unassigned)));
+        }, py::arg("matrix"), py::arg("demands") = py::none(), py::arg("capacity") = py::none(),
+           py::arg("return_to_start") = false,
+           "Pickup and delivery over a matrix laid out as start, then pickup and delivery of each request")
+        .def("fleet", [](PythonGraph& self, const vector<int>& depots, const vector<int>& customers,
+                         py::object demands, py::object capacity) {
+            Graph& g = self.frozen();
+            if (depots.empty()) throw invalid_argument("depots must not be empty");
+            vector<int> stops = depots;
+            stops.insert(stops.end(), customers.begin(), customers.end());
+            requireNodes(g.csr(), stops);
+            vector<int> demandList = checkedDemands(demands, customers.size(), "customer");
+            int limit = checkedCapacity(capacity);
+            FleetPlan plan;
+            vector<vector<int>> visits;
+            vector<vector<int>> paths;
+            {
+                py::gil_scoped_release release;
+                RequestArena arena;
+                ArenaScope arenaScope(&arena);
+                vector<shared_ptr<const PathTree>> trees;
+                plan = g.planFleet(depots, customers, demandList, limit, &trees);
+                for (const VehicleRoute& route : plan.routes) {
+                    vector<int> visited(1, stops[route.depot]);
+                    for (int stop : route.stops) visited.push_back(stops[stop]);
+                    visited.push_back(stops[route.depot]);
+                    paths.push_back(g.expandRoute(visited, trees));
+                    visits.push_back(move(visited));
+                }
+            }
+            py::list routes;
+            for (size_t r = 0; r < plan.routes.size(); r++) {
+                routes.append(py::dict(py::arg("vehicle") = r, py::arg("depot") = stops[plan.routes[r].depot],
+                                       py::arg("stops") = toNumpy(move(visits[r])), py::arg("load") = plan.routes[r].load,
+                                       py::arg("distance") = plan.routes[r].distance,
+                                       py::arg("path") = toNumpy(move(paths[r]))));
+            }
+            vector<int> unassigned;
+            for (int stop : plan.unassigned) unassigned.push_back(stops[stop]);
+            return py::dict(py::arg("routes") = routes, py::arg("distance") = plan.distance,
+                            py::arg("unassigned") = toNumpy(move(unassigned)));
+        }, py::arg("depots"), py::arg("customers"), py::arg("demands") = py::none(), py::arg("capacity") = py::none(),
+           "Capacitated routes from the depots to the customers, like the cvrp mode");
+}
+#else
+int main(int argc, char* argv[]) {
+    // Strip options so the positional arguments keep their usual places
+    int threads = 1;
+    int workers = 0;
+    int port = 0;
+    string host = "127.0.0.1";
+    string shardList;
+    string chFile;
+    string graphFile;
+    bool gzipExport = false;
+    QueueKind queueKind = QueueKind::Binary;
+    double tspTimeBudget = -1;
+    int capacity = INT_MAX;
+    bool returnToStart = false;
+    long long cacheSize = 1 << 20;
+    int numLandmarks = 0;
+    bool customizable = false;
+    bool largestComponent = false;
+    bool reorder = false;
+    string profilesFile;
+    int departure = -1;
+    vector<char*> positional;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "--host") == 0 && i + 1 < argc) {
+            host = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+            shardList = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--gzip") == 0) {
+            gzipExport = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--graph") == 0 && i + 1 < argc) {
+            graphFile = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--ch") == 0 && i + 1 < argc) {
+            chFile = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--cch") == 0) {
+            customizable = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--largest-component") == 0) {
+            largestComponent = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--reorder") == 0) {
+            reorder = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--landmarks") == 0 && i + 1 < argc) {
+            numLandmarks = atoi(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "--profiles") == 0 && i + 1 < argc) {
+            profilesFile = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--departure") == 0 && i + 1 < argc) {
+            departure = atoi(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cacheSize = atoll(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "--capacity") == 0 && i + 1 < argc) {
+            capacity = atoi(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "--return") == 0) {
+            returnToStart = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--time-budget") == 0 && i + 1 < argc) {
+            tspTimeBudget = atof(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "--simd") == 0 && i + 1 < argc) {
+            if (!selectSimdKernels(argv[++i])) {
+                cerr << "Unsupported SIMD kernels: " << argv[i] << " (expected avx512, avx2, neon or scalar)" << endl;
+                return 1;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--queue") == 0 && i + 1 < argc) {
+            string kind = argv[++i];
+            if (kind == "binary") {
+                queueKind = QueueKind::Binary;
+            } else if (kind == "dary") {
+                queueKind = QueueKind::Dary;
+            } else if (kind == "radix") {
+                queueKind = QueueKind::Radix;
+            } else {
+                cerr << "Unknown queue: " << kind << " (expected binary, dary or radix)" << endl;
+                return 1;
+            }
+            continue;
+        }
+        positional.push_back(argv[i]);
+    }
+    argc = positional.size();
+    positional.push_back(nullptr);
+    argv = positional.data();
+
+    Graph g;
+    g.setQueueKind(queueKind);
+    g.setTspTimeBudget(tspTimeBudget);
+    unique_ptr<ThreadPool> pool;
+    if (threads != 1) {
+        pool.reset(new ThreadPool(threads));
+        g.setThreadPool(pool.get());
+    }
+
+    addDemoGraph(g);
 
-    // Export graph structure to JSON
-    g.exportToJson("graph_data.json");
+    if (!graphFile.empty()) {
+        // Replace the built-in demo graph with a binary graph file
+        if (!g.loadBinary(graphFile)) {
+            cerr << "Cannot load graph file: " << graphFile << endl;
+            return 1;
+        }
+    } else {
+        // Export graph structure to JSON
+        if (!g.exportToJson(gzipExport ? "graph_data.json.gz" : "graph_data.json", gzipExport)) {
+            cerr << "Cannot write graph_data.json" << (gzipExport ? ".gz (built without zlib?)" : "") << endl;
+        }
+    }
     
+    if (!chFile.empty() && !g.loadContractionHierarchy(chFile)) {
+        cerr << "Cannot load contraction hierarchy for this graph: " << chFile << endl;
+        return 1;
+    }
+    if (numLandmarks > 0 && g.landmarkIndex() == nullptr) {
+        g.buildLandmarks(numLandmarks); // Unless the graph file already has them
+    }
+    if (customizable) {
+        g.buildCustomizableHierarchy();
+    }
+    if (!profilesFile.empty() && !g.loadTravelTimes(profilesFile)) {
+        cerr << "Cannot load travel-time profiles (unknown edge or non-FIFO profile?): " << profilesFile << endl;
+        return 1;
+    }
+    VRP_STATS(QueryStats runStats);  // Reported with the result of a single query
+    VRP_STATS(StatsScope runScope(&runStats));
+    RequestArena runArena;
+    ArenaScope runArenaScope(&runArena);
+
+    if ((argc == 2 || argc == 3) && strcmp(argv[1], "batch") == 0) {
+        // Batch mode - expects format: ./dijkstra batch [queries.txt], or
+        // queries on stdin
+        if (argc == 3 && strcmp(argv[2], "-") != 0) {
+            ifstream queries(argv[2]);
+            if (!queries) {
+                cerr << "Cannot read queries: " << argv[2] << endl;
+                return 1;
+            }
+            runBatch(g, queries, stdout);
+        } else {
+            runBatch(g, cin, stdout);
+        }
+        return 0;
+    }
+
+    if (argc == 2 && strcmp(argv[1], "serve") == 0) {
+        // Server mode - one JSON request per line on stdin, or per line on
+        // each TCP connection when --port is given
+        unique_ptr<RouteCache> cache;
+        if (cacheSize > 0) {
+            cache.reset(new RouteCache(cacheSize, max(16LL, cacheSize / 256)));
+            g.setRouteCache(cache.get());
+        }
+        // With --shards the graph file is the overlay written by partition,
+        // and the listed servers answer for its cells
+        unique_ptr<ShardRouter> router;
+        if (!shardList.empty()) {
+            if (graphFile.empty()) {
+                cerr << "--shards needs --graph prefix.overlay.bin" << endl;
+                return 1;
+            }
+            vector<string> addresses;
+            stringstream list(shardList);
+            for (string address; getline(list, address, ',');) addresses.push_back(address);
+            router.reset(new ShardRouter());
+            string error;
+            if (!router->open(graphFile, addresses, pool.get(), error)) {
+                cerr << "Cannot route over shards: " << error << endl;
+                return 1;
+            }
+        }
+        RouteServer server(g, workers, router.get());
+        if (port > 0) {
+#ifndef _WIN32
+            if (!server.serveSocket(port, host)) {
+                cerr << "Cannot listen on " << host << ":" << port << endl;
+                return 1;
+            }
+#else
+            cerr << "Socket mode is not supported on this platform" << endl;
+            return 1;
+#endif
+        }
+        server.serveStream(cin, cout);
+        return 0;
+    }
+
     // Check command line arguments
     if (argc >= 3) {
-        if (strcmp(argv[1], "tsp") == 0) {
+        if (strcmp(argv[1], "ch-build") == 0) {
+            // Offline preprocessing - expects format: ./dijkstra ch-build graph.ch
+            g.buildContractionHierarchy();
+            if (!g.saveContractionHierarchy(argv[2])) {
+                cerr << "Cannot write contraction hierarchy: " << argv[2] << endl;
+                return 1;
+            }
+            const ContractionHierarchy* hierarchy = g.contractionHierarchy();
+            cout << "{\n  \"nodes\": " << hierarchy->numNodes()
+                 << ",\n  \"arcs\": " << hierarchy->numArcs() << "\n}";
+        } else if (strcmp(argv[1], "bench") == 0) {
+            // Benchmark - expects format: ./dijkstra bench grid|geometric [nodes] [queries]
+            // or ./dijkstra bench graph [queries] for the loaded (--graph/--ch) graph
+            string kind = argv[2];
+            bool synthetic = kind == "grid" || kind == "geometric";
+            if (!synthetic && kind != "graph") {
+                cout << "Usage for benchmarks: " << argv[0] << " bench grid|geometric [nodes] [queries]" << endl;
+                cout << "                      " << argv[0] << " bench graph [queries]" << endl;
+                return 1;
+            }
+            int next = 3;
+            int numNodes = synthetic && argc > next ? atoi(argv[next++]) : 100000;
+            int numQueries = argc > next ? atoi(argv[next]) : 1000;
+            mt19937 rng(1);
+            if (!synthetic) {
+                runBenchmark(g, numQueries, 100, rng, 0, false);
+                return 0;
+            }
+            Graph generated;
+            generated.setThreadPool(pool.get());
+            generated.setQueueKind(queueKind);
+            generated.setTspTimeBudget(tspTimeBudget);
+            auto start = chrono::steady_clock::now();
+            if (kind == "grid") {
+                generateGridGraph(generated, numNodes, rng);
+            } else {
+                generateGeometricGraph(generated, numNodes, rng);
+            }
+            cerr << "Generated " << kind << " graph in " << millisecondsSince(start) << " ms" << endl;
+            if (reorder) {
+                start = chrono::steady_clock::now();
+                generated.reorderNodes();
+                cerr << "Reordered nodes in " << millisecondsSince(start) << " ms" << endl;
+            }
+            runBenchmark(generated, numQueries, 100, rng, numLandmarks, customizable);
+        } else if (strcmp(argv[1], "convert") == 0) {
+            // Migration and import - expects format: ./dijkstra convert graph_data.json graph.bin,
+            // with an OSM extract (.pbf) or an edge list (.csv, .tsv, ...) as input instead of JSON
+            if (argc < 4) {
+                cout << "Usage for conversion: " << argv[0] << " convert [input.json|.pbf|.csv] [output.bin]" << endl;
+                return 1;
+            }
+            Graph converted;
+            converted.setThreadPool(pool.get());
+            string input = argv[2];
+            auto endsWith = [&input](const string& suffix) {
+                return input.size() >= suffix.size() && input.compare(input.size() - suffix.size(), suffix.size(), suffix) == 0;
+            };
+            string error;
+            if (endsWith(".json")) {
+                if (!converted.loadJson(input)) error = "cannot read graph JSON";
+                if (error.empty() && largestComponent) converted.keepLargestComponent();
+            } else if (endsWith(".pbf")) {
+                vector<long long> osmIds;
+                importOsmPbf(converted, input, largestComponent, osmIds, error);
+            } else {
+                importEdgeList(converted, input, largestComponent, error);
+            }
+            if (!error.empty()) {
+                cerr << "Cannot import " << input << ": " << error << endl;
+                return 1;
+            }
+            if (reorder) converted.reorderNodes();
+            if (numLandmarks > 0) converted.buildLandmarks(numLandmarks);
+            if (!converted.saveBinary(argv[3])) {
+                cerr << "Cannot write graph file: " << argv[3] << endl;
+                return 1;
+            }
+            cout << "{\n  \"nodes\": " << converted.csr().numNodes()
+                 << ",\n  \"arcs\": " << converted.csr().targets.size();
+            if (const SpatialIndex* spatial = converted.spatialIndex()) {
+                int located = 0;
+                for (int v = 0; v < converted.csr().numNodes(); v++) located += spatial->isLocated(v);
+                cout << ",\n  \"located\": " << located;
+            }
+            cout << "\n}";
+        } else if (strcmp(argv[1], "partition") == 0) {
+            // Sharding - expects format: ./dijkstra partition graph.bin cells prefix, writing
+            // prefix.cell0.bin ... for one `serve` each and prefix.overlay.bin for the router
+            if (argc < 5 || atoi(argv[3]) < 2) {
+                cout << "Usage for sharding: " << argv[0] << " partition [input.json|.bin] [cells >= 2] [prefix]" << endl;
+                return 1;
+            }
+            Graph whole;
+            whole.setThreadPool(pool.get());
+            string input = argv[2];
+            bool json = input.size() >= 5 && input.compare(input.size() - 5, 5, ".json") == 0;
+            if (!(json ? whole.loadJson(input) : whole.loadBinary(input))) {
+                cerr << "Cannot read graph: " << input << endl;
+                return 1;
+            }
+            int cells = atoi(argv[3]);
+            if (cells > whole.csr().numNodes()) {
+                cerr << "Cannot split " << whole.csr().numNodes() << " nodes into " << cells << " cells" << endl;
+                return 1;
+            }
+            ShardSummary summary;
+            string error;
+            if (!writeShards(whole, cells, argv[4], summary, error)) {
+                cerr << "Cannot partition " << input << ": " << error << endl;
+                return 1;
+            }
+            cout << "{\n  \"cells\": " << cells
+                 << ",\n  \"largest_cell\": " << summary.largestCell
+                 << ",\n  \"cut_edges\": " << summary.cutEdges
+                 << ",\n  \"boundary_nodes\": " << summary.boundaryNodes
+                 << ",\n  \"overlay_arcs\": " << summary.overlayArcs << "\n}";
+        } else if (strcmp(argv[1], "tsp") == 0) {
             // TSP mode - expects format: ./dijkstra tsp user1 user2 user3 user4
             if (argc < 4) {
                 cout << "Usage for TSP: " << argv[0] << " tsp [user_id1] [user_id2] ..." << endl;
@@ -340,47 +8932,154 @@ int main(int argc, char* argv[]) {
             vector<int> optimalRoute = g.planMultiUserRoute(userIds);
             
             // Output result as JSON
-            cout << "{\n  \"path\": [";
-            for (size_t i = 0; i < optimalRoute.size(); i++) {
-                cout << optimalRoute[i];
-                if (i < optimalRoute.size() - 1) cout << ", ";
-            }
-            cout << "],\n";
+            JsonWriter out(stdout);
+            out.raw("{\n  \"path\": ").intArray(optimalRoute).raw(",\n");
             
             // Include pickup and destination details
-            cout << "  \"details\": [\n";
-            for (size_t i = 0; i < userIds.size(); i++) {
-                int userId = userIds[i];
-                cout << "    {\n";
-                cout << "      \"user_id\": " << userId << ",\n";
-                cout << "      \"name\": \"" << g.users[userId].name << "\",\n";
-                cout << "      \"pickup\": \"" << g.users[userId].pickup << "\",\n";
-                cout << "      \"destination\": \"" << g.users[userId].destination << "\"\n";
-                cout << "    }";
-                if (i < userIds.size() - 1) cout << ",";
-                cout << "\n";
-            }
-            cout << "  ]\n}";
+            out.raw("  \"details\": [\n");
+            writeUserDetails(out, g, userIds, true);
+            out.raw("  ]");
+            writeQueryStats(out, true);
+            out.raw("\n}");
+        } else if (strcmp(argv[1], "cvrp") == 0) {
+            // Fleet routing - expects format: ./dijkstra cvrp depot1,depot2 customer[:demand] ...
+            if (argc < 4) {
+                cout << "Usage for fleet routing: " << argv[0] << " cvrp [depot1,depot2,...] [customer[:demand]] ... [--capacity N]" << endl;
+                return 1;
+            }
+            vector<int> depots;
+            for (const char* text = argv[2]; *text != '\0';) {
+                char* end;
+                depots.push_back(strtol(text, &end, 10));
+                if (end == text || (*end != ',' && *end != '\0')) {
+                    cerr << "Invalid depot list: " << argv[2] << endl;
+                    return 1;
+                }
+                text = *end == ',' ? end + 1 : end;
+            }
+            vector<int> customers;
+            vector<int> demands;
+            for (int i = 3; i < argc; i++) {
+                int customer, demand = 1;
+                if (sscanf(argv[i], "%d:%d", &customer, &demand) < 1 || demand < 0) {
+                    cerr << "Invalid customer (expected node[:demand]): " << argv[i] << endl;
+                    return 1;
+                }
+                customers.push_back(customer);
+                demands.push_back(demand);
+            }
+            vector<int> stops = depots;
+            stops.insert(stops.end(), customers.begin(), customers.end());
+            for (int node : stops) {
+                if (g.csr().index(node) < 0) {
+                    cerr << "Unknown node: " << node << endl;
+                    return 1;
+                }
+            }
+
+            vector<shared_ptr<const PathTree>> trees;
+            FleetPlan plan = g.planFleet(depots, customers, demands, capacity, &trees);
+            JsonWriter out(stdout);
+            out.raw("{\n");
+            writeFleetPlan(out, g, plan, stops, trees, true);
+            writeQueryStats(out, true);
+            out.raw("\n}");
+        } else if (strcmp(argv[1], "pdp") == 0) {
+            // Pickup and delivery - expects format: ./dijkstra pdp start pickup:delivery[:demand] ...
+            if (argc < 4) {
+                cout << "Usage for pickup and delivery: " << argv[0] << " pdp [start_node] [pickup:delivery[:demand]] ..." << endl;
+                return 1;
+            }
+            vector<int> stops(1, atoi(argv[2]));
+            vector<int> demands;
+            for (int i = 3; i < argc; i++) {
+                int pickup, delivery, demand = 1;
+                if (sscanf(argv[i], "%d:%d:%d", &pickup, &delivery, &demand) < 2 || demand < 0) {
+                    cerr << "Invalid request (expected pickup:delivery[:demand]): " << argv[i] << endl;
+                    return 1;
+                }
+                stops.push_back(pickup);
+                stops.push_back(delivery);
+                demands.push_back(demand);
+            }
+            for (int node : stops) {
+                if (g.csr().index(node) < 0) {
+                    cerr << "Unknown node: " << node << endl;
+                    return 1;
+                }
+            }
+
+            vector<shared_ptr<const PathTree>> trees;
+            PickupDeliveryPlan plan = g.planPickupDelivery(stops, demands, capacity, returnToStart, &trees);
+            vector<int> visited;
+            for (int stop : plan.order) {
+                visited.push_back(stops[stop]);
+            }
+
+            JsonWriter out(stdout);
+            out.raw("{\n  \"stops\": ").intArray(visited)
+               .raw(",\n  \"distance\": ").number(plan.distance)
+               .raw(",\n  \"unassigned\": ").intArray(plan.unassigned)
+               .raw(",\n  \"path\": ").intArray(g.expandRoute(visited, trees));
+            writeQueryStats(out, true);
+            out.raw("\n}");
         } else {
             // Original shortest path mode
             int src = atoi(argv[1]);
             int dest = atoi(argv[2]);
             
-            vector<int> shortestPath = g.dijkstra(src, dest);
-            
-            // Output result as JSON
-            cout << "{\n  \"path\": [";
-            for (size_t i = 0; i < shortestPath.size(); i++) {
-                cout << shortestPath[i];
-                if (i < shortestPath.size() - 1) cout << ", ";
+            if (departure >= 0) {
+                // Fastest path for a departure time, with its travel time
+                int travelTime;
+                vector<int> fastestPath = g.dijkstra(src, dest, departure, &travelTime);
+                JsonWriter out(stdout);
+                out.raw("{\n  \"path\": ").intArray(fastestPath)
+                   .raw(",\n  \"travel_time\": ").number(fastestPath.empty() ? -1 : travelTime);
+                writeQueryStats(out, true);
+                out.raw("\n}");
+            } else {
+                vector<int> shortestPath = g.dijkstra(src, dest);
+
+                // Output result as JSON
+                JsonWriter out(stdout);
+                out.raw("{\n  \"path\": ").intArray(shortestPath);
+                writeQueryStats(out, true);
+                out.raw("\n}");
             }
-            cout << "]\n}";
         }
     } else {
         cout << "Usage for shortest path: " << argv[0] << " [start_node] [end_node]" << endl;
         cout << "Usage for TSP: " << argv[0] << " tsp [user_id1] [user_id2] ..." << endl;
+        cout << "Usage for CH preprocessing: " << argv[0] << " ch-build [output_file]" << endl;
+        cout << "Usage for server mode: " << argv[0] << " serve [--port N] [--workers N]" << endl;
+        cout << "Usage for batch queries: " << argv[0] << " batch [queries.txt] (lines of \"src dest\", default stdin)" << endl;
+        cout << "Usage for conversion: " << argv[0] << " convert [input.json|.pbf|.csv] [output.bin] [--largest-component]" << endl;
+        cout << "Usage for sharding: " << argv[0] << " partition [input.json|.bin] [cells] [prefix]" << endl;
+        cout << "Usage for pickup and delivery: " << argv[0] << " pdp [start_node] [pickup:delivery[:demand]] ... [--capacity N] [--return]" << endl;
+        cout << "Usage for fleet routing: " << argv[0] << " cvrp [depot1,depot2,...] [customer[:demand]] ... [--capacity N]" << endl;
+        cout << "Usage for benchmarks: " << argv[0] << " bench grid|geometric [nodes] [queries]" << endl;
+        cout << "                      " << argv[0] << " bench graph [queries]" << endl;
+        cout << "Options: --threads N (distance matrix worker threads, 0 = all cores)" << endl;
+        cout << "         --graph FILE (load a binary graph file instead of the built-in graph)" << endl;
+        cout << "         --ch FILE   (answer shortest path queries with a contraction hierarchy)" << endl;
+        cout << "         --cch       (customizable hierarchy: fast queries that survive server weight updates)" << endl;
+        cout << "         --largest-component (convert: keep only the largest connected component)" << endl;
+        cout << "         --reorder   (convert, bench: lay nodes out in BFS order for cache locality)" << endl;
+        cout << "         --landmarks N (ALT shortest path queries with N landmarks, e.g. 16; convert stores them)" << endl;
+        cout << "         --profiles FILE (time-of-day travel times, lines of: u v time:travel_time ...)" << endl;
+        cout << "         --departure T (shortest path mode: fastest path leaving at time T, in seconds of the day)" << endl;
+        cout << "         --queue Q   (Dijkstra priority queue: binary (default), dary or radix)" << endl;
+        cout << "         --time-budget MS (tsp/pdp local search time limit, 0 = construction heuristic only)" << endl;
+        cout << "         --simd K    (tour kernels: avx512, avx2, neon or scalar; default the best this CPU runs)" << endl;
+        cout << "         --workers N (server request threads, default all cores)" << endl;
+        cout << "         --cache N   (server mode: cached pair distances, default 1048576, 0 = off)" << endl;
+        cout << "         --port N    (server mode: listen on 127.0.0.1:N instead of stdin)" << endl;
+        cout << "         --host ADDR (server mode: listen on ADDR instead of 127.0.0.1, e.g. 0.0.0.0 for shards)" << endl;
+        cout << "         --shards H:P,... (server mode: route over shard servers; --graph is the overlay)" << endl;
+        cout << "         --gzip      (write graph_data.json.gz; needs a -DVRP_WITH_ZLIB -lz build)" << endl;
     }
 
     return 0;
 
-}
\ No newline at end of file
+}
+#endif